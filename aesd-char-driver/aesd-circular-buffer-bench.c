@@ -0,0 +1,183 @@
+/**
+ * @file aesd-circular-buffer-bench.c
+ * @brief Userspace microbenchmark for the circular buffer implementation
+ *
+ * Prints one JSON object per measurement to stdout, so results of different revisions
+ * and capacities can be collected and compared by scripts.
+ *
+ * Usage: aesd-circular-buffer-bench [iterations]
+ *
+ * @author Heiko Schmidt
+ * @date 2026-10-19
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aesd-circular-buffer.h"
+
+#define DEFAULT_ITERATIONS 1000000UL
+#define ENTRY_SIZE 64U
+#define NSEC_PER_SEC 1000000000ULL
+
+// keeps the compiler from dropping the measured work
+static volatile size_t sink;
+
+static char payload[ENTRY_SIZE];
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + (unsigned long long)ts.tv_nsec;
+}
+
+static void report(const char *bench, const char *param, unsigned long long param_val,
+        unsigned long iterations, unsigned long long elapsed_ns)
+{
+    printf("{\"bench\":\"%s\",\"capacity\":%u,\"%s\":%llu,\"iterations\":%lu,"
+            "\"total_ns\":%llu,\"ns_per_op\":%.3f,\"ops_per_s\":%.0f}\n",
+            bench, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, param, param_val, iterations,
+            elapsed_ns, (double)elapsed_ns / iterations,
+            elapsed_ns > 0 ? (double)iterations * NSEC_PER_SEC / elapsed_ns : 0.0);
+}
+
+static void fill_buffer(struct aesd_circular_buffer *buffer)
+{
+    struct aesd_buffer_entry entry = { .buffptr = payload, .size = ENTRY_SIZE };
+
+    aesd_circular_buffer_init(buffer);
+    for(size_t i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++)
+        aesd_circular_buffer_add_entry(buffer, &entry);
+}
+
+static void bench_add_entry(unsigned long iterations)
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entry = { .buffptr = payload, .size = ENTRY_SIZE };
+
+    aesd_circular_buffer_init(&buffer);
+
+    const unsigned long long start = now_ns();
+    for(unsigned long i = 0; i < iterations; i++)
+        aesd_circular_buffer_add_entry(&buffer, &entry);
+    const unsigned long long elapsed = now_ns() - start;
+
+    sink = buffer.in_offs;
+    report("add_entry", "batch", 1, iterations, elapsed);
+}
+
+static void bench_add_entries(unsigned long iterations, size_t batch)
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entries[2 * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    struct aesd_buffer_entry evicted[2 * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+
+    for(size_t i = 0; i < batch; i++) {
+        entries[i].buffptr = payload;
+        entries[i].size = ENTRY_SIZE;
+    }
+
+    aesd_circular_buffer_init(&buffer);
+
+    // at least one round, so fewer iterations than a batch still measure something
+    const unsigned long rounds = iterations >= batch ? iterations / batch : 1UL;
+    const unsigned long long start = now_ns();
+    for(unsigned long i = 0; i < rounds; i++)
+        sink += aesd_circular_buffer_add_entries(&buffer, entries, batch, evicted);
+    const unsigned long long elapsed = now_ns() - start;
+
+    report("add_entries", "batch", batch, rounds * batch, elapsed);
+}
+
+static void bench_find_fpos(unsigned long iterations, size_t char_offset)
+{
+    struct aesd_circular_buffer buffer;
+    size_t entry_offset = 0;
+
+    fill_buffer(&buffer);
+
+    const unsigned long long start = now_ns();
+    for(unsigned long i = 0; i < iterations; i++) {
+        struct aesd_buffer_entry *e = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, char_offset, &entry_offset);
+        // offsets past the data find no entry and leave entry_offset unset
+        if(e != NULL)
+            sink += 1 + entry_offset;
+    }
+    const unsigned long long elapsed = now_ns() - start;
+
+    report("find_entry_offset_for_fpos", "char_offset", char_offset, iterations, elapsed);
+}
+
+static void bench_fill_iovec(unsigned long iterations)
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_iovec iov[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    size_t cnt;
+    const size_t total = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * ENTRY_SIZE;
+
+    fill_buffer(&buffer);
+
+    const unsigned long long start = now_ns();
+    for(unsigned long i = 0; i < iterations; i++)
+        sink += aesd_circular_buffer_fill_iovec(&buffer, 0, total, iov, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, &cnt);
+    const unsigned long long elapsed = now_ns() - start;
+
+    report("fill_iovec", "bytes", total, iterations, elapsed);
+}
+
+static void bench_foreach(unsigned long iterations)
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry *entry;
+    uint8_t index;
+
+    fill_buffer(&buffer);
+
+    const unsigned long long start = now_ns();
+    for(unsigned long i = 0; i < iterations; i++) {
+        size_t sum = 0;
+        AESD_CIRCULAR_BUFFER_FOREACH(entry, &buffer, index) {
+            sum += entry->size;
+        }
+        sink += sum;
+    }
+    const unsigned long long elapsed = now_ns() - start;
+
+    report("foreach", "entries", AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, iterations, elapsed);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long iterations = DEFAULT_ITERATIONS;
+
+    if(argc > 1) {
+        iterations = strtoul(argv[1], NULL, 10);
+        if(iterations == 0) {
+            fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    memset(payload, 'x', ENTRY_SIZE);
+
+    bench_add_entry(iterations);
+    bench_add_entries(iterations, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED / 2 > 0 ? AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED / 2 : 1);
+    bench_add_entries(iterations, 2 * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+
+    // lookup cost grows with the number of entries walked, so sample across the whole buffer
+    const size_t total = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * ENTRY_SIZE;
+    bench_find_fpos(iterations, 0);
+    bench_find_fpos(iterations, total / 4);
+    bench_find_fpos(iterations, total / 2);
+    bench_find_fpos(iterations, total - 1);
+    bench_find_fpos(iterations, total);
+
+    bench_fill_iovec(iterations);
+    bench_foreach(iterations);
+
+    return EXIT_SUCCESS;
+}
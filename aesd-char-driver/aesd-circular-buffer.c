@@ -59,10 +59,70 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct
     return NULL;
 }
 
+/**
+ * @param buffer the buffer to read from.  Any necessary locking must be performed by caller.
+ * @param char_offset the zero referenced character index to start reading at, as described for
+ *      aesd_circular_buffer_find_entry_offset_for_fpos
+ * @param max_len the maximum number of bytes to cover
+ * @param iov the vector array to fill, one element per touched entry.  The elements point directly
+ *      into the entry buffers, so they are only valid until the next add_entry call.
+ * @param iov_max number of elements available in @param iov.  AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+ *      elements are always sufficient to cover the whole buffer.
+ * @param iov_cnt_rtn is a pointer to store the number of filled elements of @param iov
+ * @return the number of bytes covered by the filled vector, 0 if char_offset is beyond the stored data
+ */
+size_t aesd_circular_buffer_fill_iovec(struct aesd_circular_buffer *buffer,
+            size_t char_offset, size_t max_len, struct aesd_iovec *iov, size_t iov_max, size_t *iov_cnt_rtn)
+{
+    size_t total = 0U;
+    size_t cnt = 0U;
+    size_t entry_offset = 0U;
+    struct aesd_buffer_entry *entry;
+
+    if(buffer == NULL || iov == NULL || iov_cnt_rtn == NULL)
+        return 0U;
+
+    *iov_cnt_rtn = 0U;
+
+    // look up the start position once, afterwards just walk the following entries
+    entry = aesd_circular_buffer_find_entry_offset_for_fpos(buffer, char_offset, &entry_offset);
+    if(entry == NULL)
+        return 0U;
+
+    size_t idx = entry - &buffer->entry[0];
+    size_t i = (idx + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - buffer->out_offs) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+
+    for(; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED && total < max_len && cnt < iov_max; i++) {
+        entry = &buffer->entry[idx];
+        idx = (idx + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+
+        // unused entries have no size and are skipped like in the offset lookup
+        if(entry->size <= entry_offset) {
+            entry_offset = 0U;
+            continue;
+        }
+
+        size_t len = entry->size - entry_offset;
+        if(len > max_len - total)
+            len = max_len - total;
+
+        iov[cnt].iov_base = (void *)(entry->buffptr + entry_offset);
+        iov[cnt].iov_len = len;
+        cnt++;
+
+        total += len;
+        entry_offset = 0U;
+    }
+
+    *iov_cnt_rtn = cnt;
+    return total;
+}
+
 /**
 * Adds entry @param add_entry to @param buffer in the location specified in buffer->in_offs.
 * If the buffer was already full, overwrites the oldest entry and advances buffer->out_offs to the
 * new start location.
+* If an evict hook is registered, it is called with the overwritten entry first.
 * Any necessary locking must be handled by the caller
 * Any memory referenced in @param add_entry must be allocated by and/or must have a lifetime managed by the caller.
 */
@@ -75,6 +135,10 @@ void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const s
     if(buffer == NULL)
         return;
 
+    // hand the oldest entry back before it gets overwritten
+    if(buffer->evict_hook != NULL && !buffer->init_state && buffer->in_offs == buffer->out_offs)
+        buffer->evict_hook(&buffer->entry[buffer->in_offs], buffer->evict_ctx);
+
     // insert the emtry
     buffer->entry[buffer->in_offs] = *add_entry;
 
@@ -94,6 +158,90 @@ void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const s
     buffer->init_state = false;
 }
 
+/**
+ * @return the number of valid entries currently stored in @param buffer
+ */
+static size_t aesd_circular_buffer_entry_count(const struct aesd_circular_buffer *buffer)
+{
+    if(buffer->init_state)
+        return 0U;
+
+    // in == out outside of init state means all entries are in use
+    if(buffer->full || buffer->in_offs == buffer->out_offs)
+        return AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+
+    return (buffer->in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - buffer->out_offs) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+/**
+* Adds the @param count entries in @param add_entries to @param buffer in one pass, with the same
+* result as calling aesd_circular_buffer_add_entry for each of them in order.
+* If @param evicted_rtn is not NULL, every entry dropped by the operation is stored there oldest first:
+* previously stored entries that were overwritten, followed by leading entries of @param add_entries
+* that would have been overwritten within the batch itself.  It must provide room for @param count entries.
+* A registered evict hook is called for the same entries, in the same order.
+* Any necessary locking must be handled by the caller
+* Any memory referenced in @param add_entries must be allocated by and/or must have a lifetime managed by the caller.
+* @return the number of entries stored in @param evicted_rtn
+*/
+size_t aesd_circular_buffer_add_entries(struct aesd_circular_buffer *buffer,
+            const struct aesd_buffer_entry *add_entries, size_t count, struct aesd_buffer_entry *evicted_rtn)
+{
+    if(buffer == NULL || add_entries == NULL || count == 0U)
+        return 0U;
+
+    const size_t stored = aesd_circular_buffer_entry_count(buffer);
+
+    // only the newest entries of a large batch end up in the buffer, they are placed as if the
+    // skipped ones had been written before
+    const size_t skip = count > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED ? count - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED : 0U;
+    const size_t add = count - skip;
+    const size_t in_start = (buffer->in_offs + skip) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    size_t evict = stored + add > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED ? stored + add - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED : 0U;
+    size_t n;
+
+    if(evict > stored)
+        evict = stored;
+
+    if(evicted_rtn != NULL) {
+        // oldest stored entries, split at the end of the ring
+        n = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - buffer->out_offs;
+        if(n > evict)
+            n = evict;
+        memcpy(evicted_rtn, &buffer->entry[buffer->out_offs], n * sizeof(struct aesd_buffer_entry));
+        memcpy(evicted_rtn + n, &buffer->entry[0], (evict - n) * sizeof(struct aesd_buffer_entry));
+
+        memcpy(evicted_rtn + evict, add_entries, skip * sizeof(struct aesd_buffer_entry));
+    }
+
+    if(buffer->evict_hook != NULL) {
+        for(n = 0U; n < evict; n++)
+            buffer->evict_hook(&buffer->entry[(buffer->out_offs + n) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED], buffer->evict_ctx);
+
+        for(n = 0U; n < skip; n++)
+            buffer->evict_hook(&add_entries[n], buffer->evict_ctx);
+    }
+
+    // copy the new entries in at most two spans
+    n = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - in_start;
+    if(n > add)
+        n = add;
+    memcpy(&buffer->entry[in_start], add_entries + skip, n * sizeof(struct aesd_buffer_entry));
+    memcpy(&buffer->entry[0], add_entries + skip + n, (add - n) * sizeof(struct aesd_buffer_entry));
+
+    buffer->in_offs = (in_start + add) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+
+    // oldest entry directly follows the newest one once the buffer wrapped
+    if(stored + count >= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
+        buffer->out_offs = buffer->in_offs;
+
+    // full is set when the last single add would have overwritten an entry
+    buffer->full = stored + count > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    buffer->init_state = false;
+
+    return evict + skip;
+}
+
 /**
 * Initializes the circular buffer described by @param buffer to an empty struct
 */
@@ -102,3 +250,17 @@ void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
     memset(buffer,0,sizeof(struct aesd_circular_buffer));
     buffer->init_state = true;
 }
+
+/**
+* Registers @param hook to be called with @param ctx for every entry dropped from @param buffer,
+* so the memory of overwritten entries can be released or recycled. Pass NULL to remove the hook.
+* Must be called after aesd_circular_buffer_init, which clears the hook.
+*/
+void aesd_circular_buffer_set_evict_hook(struct aesd_circular_buffer *buffer, aesd_evict_hook_t hook, void *ctx)
+{
+    if(buffer == NULL)
+        return;
+
+    buffer->evict_hook = hook;
+    buffer->evict_ctx = ctx;
+}
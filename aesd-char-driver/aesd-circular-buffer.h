@@ -10,13 +10,31 @@
 
 #ifdef __KERNEL__
 #include <linux/types.h>
+#include <linux/uio.h>  // struct kvec
 #else
 #include <stddef.h> // size_t
 #include <stdint.h> // uintx_t
 #include <stdbool.h>
+#include <sys/uio.h> // struct iovec
 #endif
 
+/**
+ * Can be overridden at compile time, e.g. to benchmark other capacities. in_offs and out_offs
+ * are uint8_t, so at most 255 entries are supported.
+ */
+#ifndef AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
+#endif
+
+/**
+ * I/O vector type filled by aesd_circular_buffer_fill_iovec. Both variants provide the
+ * iov_base and iov_len members, so callers can use them the same way in kernel and userspace.
+ */
+#ifdef __KERNEL__
+#define aesd_iovec kvec
+#else
+#define aesd_iovec iovec
+#endif
 
 struct aesd_buffer_entry
 {
@@ -30,6 +48,13 @@ struct aesd_buffer_entry
     size_t size;
 };
 
+/**
+ * Hook called with each entry which is dropped from the buffer, before it is overwritten.
+ * @param entry the dropped entry, whose buffptr can be freed or recycled by the hook
+ * @param ctx the context pointer registered with aesd_circular_buffer_set_evict_hook
+ */
+typedef void (*aesd_evict_hook_t)(const struct aesd_buffer_entry *entry, void *ctx);
+
 struct aesd_circular_buffer
 {
     /**
@@ -53,15 +78,31 @@ struct aesd_circular_buffer
      * flag if buffer is in init state
      */
     bool init_state;
+    /**
+     * optional hook to release entries which are overwritten, NULL if not used
+     */
+    aesd_evict_hook_t evict_hook;
+    /**
+     * context passed to evict_hook
+     */
+    void *evict_ctx;
 };
 
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn );
 
+extern size_t aesd_circular_buffer_fill_iovec(struct aesd_circular_buffer *buffer,
+            size_t char_offset, size_t max_len, struct aesd_iovec *iov, size_t iov_max, size_t *iov_cnt_rtn);
+
 extern void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry);
 
+extern size_t aesd_circular_buffer_add_entries(struct aesd_circular_buffer *buffer,
+            const struct aesd_buffer_entry *add_entries, size_t count, struct aesd_buffer_entry *evicted_rtn);
+
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
+extern void aesd_circular_buffer_set_evict_hook(struct aesd_circular_buffer *buffer, aesd_evict_hook_t hook, void *ctx);
+
 /**
  * Create a for loop to iterate over each member of the circular buffer.
  * Useful when you've allocated memory for circular buffer entries and need to free it
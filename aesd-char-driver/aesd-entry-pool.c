@@ -0,0 +1,150 @@
+/**
+ * @file aesd-entry-pool.c
+ * @brief Recycling allocator for circular buffer entry payloads
+ *
+ * Entries overwritten in a full circular buffer are returned to per size class free lists
+ * and handed out again for the next write, so a steady write load does not hit
+ * kmalloc/kfree or malloc/free for every entry.
+ *
+ * @author Heiko Schmidt
+ * @date 2026-10-19
+ *
+ */
+
+#ifdef __KERNEL__
+#include <linux/slab.h>
+#include <linux/string.h>
+#define POOL_ALLOC(size) kmalloc(size, GFP_KERNEL)
+#define POOL_FREE(ptr) kfree(ptr)
+#else
+#include <stdlib.h>
+#include <string.h>
+#define POOL_ALLOC(size) malloc(size)
+#define POOL_FREE(ptr) free(ptr)
+#endif
+
+#include "aesd-entry-pool.h"
+
+/**
+ * @return the size class index for @param size, AESD_ENTRY_POOL_CLASSES if it is not pooled
+ */
+static size_t aesd_entry_pool_class(size_t size)
+{
+    size_t cls = 0U;
+    size_t cls_size = AESD_ENTRY_POOL_MIN_SIZE;
+
+    while(cls < AESD_ENTRY_POOL_CLASSES && cls_size < size) {
+        cls++;
+        cls_size <<= 1;
+    }
+
+    return cls;
+}
+
+/**
+* Initializes the pool described by @param pool with empty free lists
+*/
+void aesd_entry_pool_init(struct aesd_entry_pool *pool)
+{
+    memset(pool, 0, sizeof(struct aesd_entry_pool));
+}
+
+/**
+ * @param pool the pool to take the block from.  Any necessary locking must be performed by caller.
+ * @param size the number of bytes needed
+ * @return a block of at least @param size bytes, or NULL if the system allocator failed
+ */
+char *aesd_entry_pool_alloc(struct aesd_entry_pool *pool, size_t size)
+{
+    const size_t cls = aesd_entry_pool_class(size);
+    void *block;
+
+    if(cls >= AESD_ENTRY_POOL_CLASSES)
+        return POOL_ALLOC(size);
+
+    // reuse a released block of the same class
+    block = pool->free_list[cls];
+    if(block != NULL) {
+        pool->free_list[cls] = *(void **)block;
+        pool->free_cnt[cls]--;
+        return block;
+    }
+
+    return POOL_ALLOC((size_t)AESD_ENTRY_POOL_MIN_SIZE << cls);
+}
+
+/**
+ * Grows or shrinks @param ptr, previously allocated from @param pool with @param old_size bytes,
+ * to @param new_size bytes.  The block is kept if it is still in the same size class, which makes
+ * accumulating partial writes cheap.
+ * @return the resized block, or NULL if allocation failed, in which case @param ptr is still valid
+ */
+char *aesd_entry_pool_realloc(struct aesd_entry_pool *pool, char *ptr, size_t old_size, size_t new_size)
+{
+    char *new_ptr;
+
+    if(ptr == NULL)
+        return aesd_entry_pool_alloc(pool, new_size);
+
+    if(aesd_entry_pool_class(old_size) == aesd_entry_pool_class(new_size)
+            && aesd_entry_pool_class(new_size) < AESD_ENTRY_POOL_CLASSES)
+        return ptr;
+
+    new_ptr = aesd_entry_pool_alloc(pool, new_size);
+    if(new_ptr == NULL)
+        return NULL;
+
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    aesd_entry_pool_free(pool, ptr, old_size);
+
+    return new_ptr;
+}
+
+/**
+ * Returns the block @param ptr of @param size bytes to @param pool.  Blocks exceeding the cache
+ * limit of their class are released to the system allocator.
+ * Any necessary locking must be performed by caller.
+ */
+void aesd_entry_pool_free(struct aesd_entry_pool *pool, const char *ptr, size_t size)
+{
+    const size_t cls = aesd_entry_pool_class(size);
+    void *block = (void *)ptr;
+
+    if(block == NULL)
+        return;
+
+    if(cls >= AESD_ENTRY_POOL_CLASSES || pool->free_cnt[cls] >= AESD_ENTRY_POOL_MAX_CACHED) {
+        POOL_FREE(block);
+        return;
+    }
+
+    *(void **)block = pool->free_list[cls];
+    pool->free_list[cls] = block;
+    pool->free_cnt[cls]++;
+}
+
+/**
+ * Evict hook for aesd_circular_buffer_set_evict_hook, with the struct aesd_entry_pool as @param ctx.
+ * Entries must have been allocated from the pool with their current size.
+ */
+void aesd_entry_pool_evict(const struct aesd_buffer_entry *entry, void *ctx)
+{
+    aesd_entry_pool_free((struct aesd_entry_pool *)ctx, entry->buffptr, entry->size);
+}
+
+/**
+ * Releases all cached blocks of @param pool to the system allocator.
+ */
+void aesd_entry_pool_destroy(struct aesd_entry_pool *pool)
+{
+    size_t cls;
+
+    for(cls = 0U; cls < AESD_ENTRY_POOL_CLASSES; cls++) {
+        while(pool->free_list[cls] != NULL) {
+            void *block = pool->free_list[cls];
+            pool->free_list[cls] = *(void **)block;
+            POOL_FREE(block);
+        }
+        pool->free_cnt[cls] = 0U;
+    }
+}
@@ -0,0 +1,52 @@
+/*
+ * aesd-entry-pool.h
+ *
+ *  Created on: October 19th, 2026
+ *      Author: Heiko Schmidt
+ */
+
+#ifndef AESD_ENTRY_POOL_H
+#define AESD_ENTRY_POOL_H
+
+#include "aesd-circular-buffer.h"
+
+/**
+ * Payloads are rounded up to power of two size classes starting at AESD_ENTRY_POOL_MIN_SIZE.
+ * Larger payloads are passed directly to the system allocator.
+ */
+#define AESD_ENTRY_POOL_MIN_SHIFT 5
+#define AESD_ENTRY_POOL_CLASSES 8
+#define AESD_ENTRY_POOL_MIN_SIZE (1U << AESD_ENTRY_POOL_MIN_SHIFT)
+#define AESD_ENTRY_POOL_MAX_SIZE (AESD_ENTRY_POOL_MIN_SIZE << (AESD_ENTRY_POOL_CLASSES - 1))
+
+/**
+ * Number of released blocks kept per size class. One buffer worth of entries is enough to serve
+ * a steady state where every write evicts the oldest entry.
+ */
+#define AESD_ENTRY_POOL_MAX_CACHED AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+
+struct aesd_entry_pool
+{
+    /**
+     * Singly linked lists of released blocks per size class, linked through the blocks themselves
+     */
+    void *free_list[AESD_ENTRY_POOL_CLASSES];
+    /**
+     * Number of blocks in the corresponding free_list
+     */
+    size_t free_cnt[AESD_ENTRY_POOL_CLASSES];
+};
+
+extern void aesd_entry_pool_init(struct aesd_entry_pool *pool);
+
+extern char *aesd_entry_pool_alloc(struct aesd_entry_pool *pool, size_t size);
+
+extern char *aesd_entry_pool_realloc(struct aesd_entry_pool *pool, char *ptr, size_t old_size, size_t new_size);
+
+extern void aesd_entry_pool_free(struct aesd_entry_pool *pool, const char *ptr, size_t size);
+
+extern void aesd_entry_pool_evict(const struct aesd_buffer_entry *entry, void *ctx);
+
+extern void aesd_entry_pool_destroy(struct aesd_entry_pool *pool);
+
+#endif /* AESD_ENTRY_POOL_H */
@@ -0,0 +1,42 @@
+/*
+ * aesd_ioctl.h
+ *
+ *  Created on: October 19th, 2026
+ *      Author: Heiko Schmidt
+ *
+ *  ioctl definitions shared between the aesdchar device implementations and userspace
+ */
+
+#ifndef AESD_IOCTL_H
+#define AESD_IOCTL_H
+
+#ifdef __KERNEL__
+#include <asm-generic/ioctl.h>
+#include <linux/types.h>
+#else
+#include <sys/ioctl.h>
+#include <stdint.h>
+#endif
+
+/**
+ * Parameters of the AESDCHAR_IOCSEEKTO command
+ */
+struct aesd_seekto {
+    /**
+     * The zero referenced write command to seek into, 0 being the oldest stored one
+     */
+    uint32_t write_cmd;
+    /**
+     * The zero referenced offset within the write command
+     */
+    uint32_t write_cmd_offset;
+};
+
+// Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
+#define AESD_IOC_MAGIC 0x16
+
+// Seek the file position of the caller to the write command and offset given in struct aesd_seekto
+#define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+#define AESDCHAR_IOC_MAXNR 1
+
+#endif /* AESD_IOCTL_H */
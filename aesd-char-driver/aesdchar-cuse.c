@@ -0,0 +1,318 @@
+/*
+ * Userspace emulation of the aesdchar device on top of CUSE
+ *
+ * Writes are accumulated until a newline is found and then stored as one entry of the
+ * circular buffer, reads return the concatenated entries starting at the file position.
+ * This allows to exercise and benchmark the device path without loading a kernel module.
+ *
+ * CUSE devices are streams: the kernel neither tracks the file position nor forwards
+ * llseek, so the position is kept per open file here and can only be moved with the
+ * AESDCHAR_IOCSEEKTO ioctl.
+ *
+ * Usage: aesdchar-cuse [-n name] [-f] [-s] [-d]
+ * Author: Heiko Schmidt
+ */
+#define FUSE_USE_VERSION 31
+
+#include <cuse_lowlevel.h>
+#include <fuse_opt.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <pthread.h>
+
+#include "aesd-circular-buffer.h"
+#include "aesd-entry-pool.h"
+#include "aesd_ioctl.h"
+
+#define DEFAULT_DEV_NAME "aesdchar"
+#define DEV_INFO_BUF_SIZE 128
+
+typedef struct aesdchar_dev_s
+{
+    pthread_mutex_t lock;
+    struct aesd_circular_buffer buffer;
+    struct aesd_entry_pool pool;
+
+    // write in progress, not yet terminated by a newline
+    char *partial;
+    size_t partial_size;
+    // allocated for partial, doubled beyond the pool size classes
+    size_t partial_capacity;
+} aesdchar_dev_t;
+
+typedef struct aesdchar_file_s
+{
+    size_t pos;
+} aesdchar_file_t;
+
+typedef struct aesdchar_param_s
+{
+    char *dev_name;
+    int is_help;
+} aesdchar_param_t;
+
+static aesdchar_dev_t dev = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+#define AESDCHAR_OPT(t, p) { t, offsetof(aesdchar_param_t, p), 1 }
+
+static const struct fuse_opt aesdchar_opts[] = {
+    AESDCHAR_OPT("-n %s", dev_name),
+    AESDCHAR_OPT("--name=%s", dev_name),
+    FUSE_OPT_KEY("-h", 0),
+    FUSE_OPT_KEY("--help", 0),
+    FUSE_OPT_END
+};
+
+static int aesdchar_process_arg(void *data, const char *arg, int key, struct fuse_args *outargs)
+{
+    aesdchar_param_t *param = (aesdchar_param_t*)data;
+
+    if (key == 0)
+    {
+        param->is_help = 1;
+        fprintf(stderr, "Usage: aesdchar-cuse [-n name] [-f] [-s] [-d]\n"
+                "    -n, --name=NAME   device name, default " DEFAULT_DEV_NAME "\n");
+        return fuse_opt_add_arg(outargs, "-ho");
+    }
+
+    return 1;
+}
+
+/**
+ * @return the file position of the start of the @param write_cmd-th stored entry, or -1 if
+ * there is no such entry or @param offset is not within it.  Caller must hold dev.lock.
+ */
+static ssize_t aesdchar_seekto_pos(uint32_t write_cmd, uint32_t offset)
+{
+    size_t pos = 0;
+    size_t cmd = 0;
+    size_t idx = dev.buffer.out_offs;
+
+    for (size_t i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++)
+    {
+        const struct aesd_buffer_entry *entry = &dev.buffer.entry[idx];
+        idx = (idx + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+
+        // unused entries have no size
+        if (entry->size == 0)
+            continue;
+
+        if (cmd == write_cmd)
+            return offset < entry->size ? (ssize_t)(pos + offset) : -1;
+
+        pos += entry->size;
+        cmd++;
+    }
+
+    return -1;
+}
+
+static void aesdchar_open(fuse_req_t req, struct fuse_file_info *fi)
+{
+    aesdchar_file_t *file = (aesdchar_file_t*)calloc(1, sizeof(aesdchar_file_t));
+    if (file == NULL)
+    {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    fi->fh = (uintptr_t)file;
+    fuse_reply_open(req, fi);
+}
+
+static void aesdchar_release(fuse_req_t req, struct fuse_file_info *fi)
+{
+    free((void*)(uintptr_t)fi->fh);
+    fuse_reply_err(req, 0);
+}
+
+static void aesdchar_read(fuse_req_t req, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    aesdchar_file_t *file = (aesdchar_file_t*)(uintptr_t)fi->fh;
+    struct iovec iov[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    size_t cnt;
+
+    (void)off;
+
+    pthread_mutex_lock(&dev.lock);
+
+    // collect the whole range at once, the reply is sent directly from the entries
+    const size_t len = aesd_circular_buffer_fill_iovec(&dev.buffer, file->pos, size, iov,
+            AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, &cnt);
+    file->pos += len;
+
+    // keep the lock until the data is sent, entries may be evicted afterwards
+    fuse_reply_iov(req, iov, (int)cnt);
+
+    pthread_mutex_unlock(&dev.lock);
+}
+
+static void aesdchar_write(fuse_req_t req, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    size_t remaining = size;
+
+    (void)off;
+    (void)fi;
+
+    pthread_mutex_lock(&dev.lock);
+
+    while (remaining > 0)
+    {
+        const char *nl = (const char*)memchr(buf, '\n', remaining);
+        const size_t len = nl != NULL ? (size_t)(nl - buf) + 1 : remaining;
+
+        // append to the pending write, same size class blocks are grown in place and larger
+        // ones geometrically, so a long unterminated write copies O(n) bytes in total
+        const size_t needed = dev.partial_size + len;
+        if (needed > dev.partial_capacity)
+        {
+            size_t capacity = needed;
+            if (capacity > AESD_ENTRY_POOL_MAX_SIZE && capacity < 2 * dev.partial_capacity)
+                capacity = 2 * dev.partial_capacity;
+
+            char *p = aesd_entry_pool_realloc(&dev.pool, dev.partial, dev.partial_capacity, capacity);
+            if (p == NULL)
+            {
+                syslog(LOG_ERR, "Error allocating write buffer");
+                break;
+            }
+            dev.partial = p;
+            dev.partial_capacity = capacity;
+        }
+
+        memcpy(&dev.partial[dev.partial_size], buf, len);
+        dev.partial_size = needed;
+
+        // complete command, the evict hook recycles an overwritten entry
+        if (nl != NULL)
+        {
+            struct aesd_buffer_entry entry = { .buffptr = dev.partial, .size = dev.partial_size };
+            aesd_circular_buffer_add_entry(&dev.buffer, &entry);
+            dev.partial = NULL;
+            dev.partial_size = 0;
+            dev.partial_capacity = 0;
+        }
+
+        buf += len;
+        remaining -= len;
+    }
+
+    pthread_mutex_unlock(&dev.lock);
+
+    if (remaining == size)
+        fuse_reply_err(req, ENOMEM);
+    else
+        fuse_reply_write(req, size - remaining);
+}
+
+static void aesdchar_ioctl(fuse_req_t req, int cmd, void *arg, struct fuse_file_info *fi,
+        unsigned int flags, const void *in_buf, size_t in_bufsz, size_t out_bufsz)
+{
+    aesdchar_file_t *file = (aesdchar_file_t*)(uintptr_t)fi->fh;
+    struct aesd_seekto seekto;
+
+    (void)out_bufsz;
+
+    if (flags & FUSE_IOCTL_COMPAT)
+    {
+        fuse_reply_err(req, ENOSYS);
+        return;
+    }
+
+    if ((unsigned int)cmd != AESDCHAR_IOCSEEKTO)
+    {
+        fuse_reply_err(req, ENOTTY);
+        return;
+    }
+
+    // the kernel fetches the argument on a retry
+    if (in_bufsz < sizeof(struct aesd_seekto))
+    {
+        struct iovec iov = { .iov_base = arg, .iov_len = sizeof(struct aesd_seekto) };
+        fuse_reply_ioctl_retry(req, &iov, 1, NULL, 0);
+        return;
+    }
+
+    memcpy(&seekto, in_buf, sizeof(struct aesd_seekto));
+
+    pthread_mutex_lock(&dev.lock);
+    const ssize_t pos = aesdchar_seekto_pos(seekto.write_cmd, seekto.write_cmd_offset);
+    if (pos >= 0)
+        file->pos = (size_t)pos;
+    pthread_mutex_unlock(&dev.lock);
+
+    if (pos < 0)
+        fuse_reply_err(req, EINVAL);
+    else
+        fuse_reply_ioctl(req, 0, NULL, 0);
+}
+
+static void aesdchar_destroy(void *userdata)
+{
+    uint8_t index;
+    struct aesd_buffer_entry *entry;
+
+    (void)userdata;
+
+    pthread_mutex_lock(&dev.lock);
+
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, &dev.buffer, index) {
+        aesd_entry_pool_free(&dev.pool, entry->buffptr, entry->size);
+    }
+    aesd_entry_pool_free(&dev.pool, dev.partial, dev.partial_capacity);
+    aesd_entry_pool_destroy(&dev.pool);
+
+    pthread_mutex_unlock(&dev.lock);
+}
+
+static const struct cuse_lowlevel_ops aesdchar_ops = {
+    .open = aesdchar_open,
+    .release = aesdchar_release,
+    .read = aesdchar_read,
+    .write = aesdchar_write,
+    .ioctl = aesdchar_ioctl,
+    .destroy = aesdchar_destroy,
+};
+
+int main(int argc, char **argv)
+{
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    aesdchar_param_t param = { 0 };
+    char dev_info[DEV_INFO_BUF_SIZE];
+    const char *dev_info_argv[] = { dev_info };
+    struct cuse_info ci;
+    int ret;
+
+    openlog("aesdchar-cuse", 0, LOG_USER);
+
+    if (fuse_opt_parse(&args, &param, aesdchar_opts, aesdchar_process_arg) != 0)
+    {
+        syslog(LOG_ERR, "Error parsing options");
+        closelog();
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(dev_info, DEV_INFO_BUF_SIZE, "DEVNAME=%s", param.dev_name != NULL ? param.dev_name : DEFAULT_DEV_NAME);
+
+    aesd_circular_buffer_init(&dev.buffer);
+    aesd_entry_pool_init(&dev.pool);
+    aesd_circular_buffer_set_evict_hook(&dev.buffer, aesd_entry_pool_evict, &dev.pool);
+
+    memset(&ci, 0x0, sizeof(ci));
+    ci.dev_info_argc = 1;
+    ci.dev_info_argv = dev_info_argv;
+
+    ret = cuse_lowlevel_main(args.argc, args.argv, &ci, &aesdchar_ops, NULL);
+
+    fuse_opt_free_args(&args);
+    free(param.dev_name);
+    closelog();
+
+    return ret;
+}
@@ -0,0 +1,311 @@
+#define _GNU_SOURCE
+#include "exec-batch.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+#define EVENT_KIND_OUT 0U
+#define EVENT_KIND_ERR 1U
+#define EVENT_KIND_PID 2U
+#define EVENT_KIND_BITS 2U
+
+#define MAX_EVENTS 64
+#define READ_CHUNK_SIZE 4096U
+
+/**
+ * State of a running command, one per parallelism slot
+ */
+typedef struct exec_slot_s {
+    struct exec_cmd *cmd;
+    pid_t pid;
+    int pidfd;
+    int out_fd;
+    int err_fd;
+    bool exited;
+    size_t out_cap;
+    size_t err_cap;
+} exec_slot_t;
+
+static int pidfd_open_compat(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int watch_fd(int epfd, int fd, size_t slot_idx, unsigned int kind)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0x0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = ((uint64_t)slot_idx << EVENT_KIND_BITS) | kind;
+
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void unwatch_fd(int epfd, int *fd)
+{
+    if(*fd < 0)
+        return;
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, *fd, NULL);
+    close(*fd);
+    *fd = -1;
+}
+
+static void set_exit_status(exec_slot_t *slot, int status)
+{
+    if(WIFEXITED(status))
+        slot->cmd->status = WEXITSTATUS(status);
+    else if(WIFSIGNALED(status))
+        slot->cmd->status = 128 + WTERMSIG(status);
+    else
+        slot->cmd->status = -1;
+
+    slot->exited = true;
+}
+
+/**
+ * Reads everything currently available from @param fd into the buffer, returns false on EOF or error
+ */
+static bool drain_fd(int fd, char **buf, size_t *len, size_t *cap)
+{
+    for(;;) {
+        // keep room for the chunk and the terminating NUL
+        if(*cap - *len < READ_CHUNK_SIZE + 1) {
+            size_t new_cap = *cap == 0 ? READ_CHUNK_SIZE + 1 : *cap * 2;
+            char *p = (char*)realloc(*buf, new_cap);
+            if(p == NULL)
+                return false;
+            *buf = p;
+            *cap = new_cap;
+            (*buf)[*len] = '\0';
+        }
+
+        ssize_t n = read(fd, *buf + *len, READ_CHUNK_SIZE);
+        if(n > 0) {
+            *len += n;
+            (*buf)[*len] = '\0';
+            continue;
+        }
+
+        if(n < 0 && errno == EINTR)
+            continue;
+
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+}
+
+static bool launch(int epfd, exec_slot_t *slot, size_t slot_idx, struct exec_cmd *cmd)
+{
+    posix_spawn_file_actions_t actions;
+    int out_pipe[2] = { -1, -1 };
+    int err_pipe[2] = { -1, -1 };
+    int err;
+
+    memset(slot, 0x0, sizeof(exec_slot_t));
+    slot->cmd = cmd;
+    slot->pidfd = slot->out_fd = slot->err_fd = -1;
+
+    cmd->status = -1;
+    cmd->out = cmd->err = NULL;
+    cmd->out_len = cmd->err_len = 0;
+
+    if(cmd->argv == NULL || cmd->argv[0] == NULL)
+        return false;
+
+    // close on exec keeps the pipes of other commands out of this child
+    if(cmd->outfile == NULL && pipe2(out_pipe, O_CLOEXEC) < 0)
+        return false;
+
+    if(pipe2(err_pipe, O_CLOEXEC) < 0)
+        goto err_pipes;
+
+    if(posix_spawn_file_actions_init(&actions) != 0)
+        goto err_pipes;
+
+    if(cmd->outfile != NULL)
+        err = posix_spawn_file_actions_addopen(&actions, 1, cmd->outfile, O_WRONLY | O_TRUNC | O_CREAT,
+                S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+    else
+        err = posix_spawn_file_actions_adddup2(&actions, out_pipe[1], 1);
+
+    if(err == 0)
+        err = posix_spawn_file_actions_adddup2(&actions, err_pipe[1], 2);
+
+    if(err == 0)
+        err = posix_spawn(&slot->pid, cmd->argv[0], &actions, NULL, cmd->argv, environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+
+    if(err != 0)
+        goto err_pipes;
+
+    // only the child writes
+    if(out_pipe[1] >= 0)
+        close(out_pipe[1]);
+    close(err_pipe[1]);
+
+    slot->out_fd = out_pipe[0];
+    slot->err_fd = err_pipe[0];
+
+    if(slot->out_fd >= 0) {
+        fcntl(slot->out_fd, F_SETFL, O_NONBLOCK);
+        watch_fd(epfd, slot->out_fd, slot_idx, EVENT_KIND_OUT);
+    }
+    fcntl(slot->err_fd, F_SETFL, O_NONBLOCK);
+    watch_fd(epfd, slot->err_fd, slot_idx, EVENT_KIND_ERR);
+
+    // without pidfd support the exit is reaped once both pipes are closed
+    slot->pidfd = pidfd_open_compat(slot->pid);
+    if(slot->pidfd >= 0)
+        watch_fd(epfd, slot->pidfd, slot_idx, EVENT_KIND_PID);
+
+    return true;
+
+err_pipes:
+    for(int i = 0; i < 2; i++) {
+        if(out_pipe[i] >= 0)
+            close(out_pipe[i]);
+        if(err_pipe[i] >= 0)
+            close(err_pipe[i]);
+    }
+    return false;
+}
+
+/**
+ * Handles one epoll event, returns true if the command of the slot completed
+ */
+static bool handle_event(int epfd, exec_slot_t *slot, unsigned int kind)
+{
+    struct exec_cmd *cmd = slot->cmd;
+    int status;
+
+    switch(kind) {
+    case EVENT_KIND_OUT:
+        if(!drain_fd(slot->out_fd, &cmd->out, &cmd->out_len, &slot->out_cap))
+            unwatch_fd(epfd, &slot->out_fd);
+        break;
+
+    case EVENT_KIND_ERR:
+        if(!drain_fd(slot->err_fd, &cmd->err, &cmd->err_len, &slot->err_cap))
+            unwatch_fd(epfd, &slot->err_fd);
+        break;
+
+    case EVENT_KIND_PID:
+        if(waitpid(slot->pid, &status, WNOHANG) == slot->pid) {
+            set_exit_status(slot, status);
+            unwatch_fd(epfd, &slot->pidfd);
+        }
+        break;
+    }
+
+    if(slot->out_fd >= 0 || slot->err_fd >= 0)
+        return false;
+
+    if(!slot->exited && slot->pidfd < 0) {
+        if(waitpid(slot->pid, &status, 0) == slot->pid)
+            set_exit_status(slot, status);
+        else
+            slot->exited = true;
+    }
+
+    return slot->exited;
+}
+
+bool do_exec_batch(struct exec_cmd *cmds, size_t count, size_t max_parallel)
+{
+    struct epoll_event events[MAX_EVENTS];
+    exec_slot_t *slots;
+    size_t next = 0;
+    size_t running = 0;
+    bool ret = true;
+
+    if(max_parallel == 0)
+        max_parallel = 1;
+    if(max_parallel > count)
+        max_parallel = count;
+    if(count == 0)
+        return true;
+
+    slots = (exec_slot_t*)calloc(max_parallel, sizeof(exec_slot_t));
+    if(slots == NULL)
+        return false;
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(epfd < 0) {
+        free(slots);
+        return false;
+    }
+
+    while(next < count || running > 0) {
+        // fill free slots
+        for(size_t i = 0; i < max_parallel && next < count; i++) {
+            if(slots[i].cmd != NULL)
+                continue;
+
+            if(!launch(epfd, &slots[i], i, &cmds[next])) {
+                slots[i].cmd = NULL;
+                ret = false;
+            } else {
+                running++;
+            }
+            next++;
+        }
+
+        if(running == 0)
+            continue;
+
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            ret = false;
+            break;
+        }
+
+        for(int i = 0; i < n; i++) {
+            const size_t idx = events[i].data.u64 >> EVENT_KIND_BITS;
+            const unsigned int kind = events[i].data.u64 & ((1U << EVENT_KIND_BITS) - 1);
+
+            // a previous event in this round may have completed the slot already
+            if(slots[idx].cmd == NULL)
+                continue;
+
+            if(handle_event(epfd, &slots[idx], kind)) {
+                if(slots[idx].cmd->status != 0)
+                    ret = false;
+                slots[idx].cmd = NULL;
+                running--;
+            }
+        }
+    }
+
+    close(epfd);
+    free(slots);
+
+    return ret;
+}
+
+void exec_cmd_free_output(struct exec_cmd *cmd)
+{
+    free(cmd->out);
+    free(cmd->err);
+    cmd->out = cmd->err = NULL;
+    cmd->out_len = cmd->err_len = 0;
+}
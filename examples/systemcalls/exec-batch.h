@@ -0,0 +1,49 @@
+#ifndef EXEC_BATCH_H
+#define EXEC_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Description and result of one command run by do_exec_batch()
+ */
+struct exec_cmd {
+    /**
+     * NULL terminated argument vector, argv[0] is the absolute path of the command
+     */
+    char *const *argv;
+    /**
+     * If not NULL, standard output is redirected to this file, truncated before,
+     * instead of being captured in out
+     */
+    const char *outfile;
+
+    /**
+     * Exit status of the command, 128 + signal number if it was killed,
+     * -1 if it could not be started
+     */
+    int status;
+    /**
+     * Captured standard output and error, NUL terminated, allocated by do_exec_batch()
+     * and released with exec_cmd_free_output()
+     */
+    char *out;
+    size_t out_len;
+    char *err;
+    size_t err_len;
+};
+
+/**
+ * Runs the @param count commands in @param cmds, at most @param max_parallel at the same time.
+ * Output of all running commands is collected through pipes in a single epoll loop and exits
+ * are reaped through pidfds, so the caller does not block on any single command.
+ * @return true if all commands could be started and exited with status 0
+ */
+bool do_exec_batch(struct exec_cmd *cmds, size_t count, size_t max_parallel);
+
+/**
+ * Releases the output buffers of @param cmd
+ */
+void exec_cmd_free_output(struct exec_cmd *cmd);
+
+#endif /* EXEC_BATCH_H */
@@ -0,0 +1,131 @@
+/**
+ * @file systemcalls-bench.c
+ * @brief Compares process launch rates of the fork() and posix_spawn() paths
+ *
+ * The parent first allocates and touches a configurable amount of memory, since the cost of
+ * fork() grows with the page tables it has to copy.  Prints one JSON object per path, the
+ * last one for do_exec_batch() running one command per online CPU at a time.
+ *
+ * Usage: systemcalls-bench [rss_mb] [spawns] [command]
+ *
+ * @author Heiko Schmidt
+ * @date 2026-10-19
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "systemcalls.h"
+#include "exec-batch.h"
+
+#define DEFAULT_RSS_MB 1024UL
+#define DEFAULT_SPAWNS 1000UL
+#define DEFAULT_COMMAND "/bin/true"
+#define NSEC_PER_SEC 1000000000ULL
+
+typedef bool (*exec_fn_t)(const char *outfile, char *const command[]);
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + (unsigned long long)ts.tv_nsec;
+}
+
+static int bench_exec(const char *name, exec_fn_t fn, char *const command[], unsigned long rss_mb, unsigned long spawns)
+{
+    unsigned long failed = 0;
+
+    const unsigned long long start = now_ns();
+    for(unsigned long i = 0; i < spawns; i++) {
+        if(!fn(NULL, command))
+            failed++;
+    }
+    const unsigned long long elapsed = now_ns() - start;
+
+    printf("{\"bench\":\"%s\",\"rss_mb\":%lu,\"spawns\":%lu,\"failed\":%lu,"
+            "\"total_ns\":%llu,\"us_per_spawn\":%.3f,\"spawns_per_s\":%.1f}\n",
+            name, rss_mb, spawns, failed, elapsed, (double)elapsed / spawns / 1000.0,
+            elapsed > 0 ? (double)spawns * NSEC_PER_SEC / elapsed : 0.0);
+
+    return failed == 0 ? 0 : -1;
+}
+
+static int bench_batch(char *const command[], unsigned long rss_mb, unsigned long spawns)
+{
+    struct exec_cmd *cmds = (struct exec_cmd*)calloc(spawns, sizeof(struct exec_cmd));
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const size_t parallel = cpus > 0 ? (size_t)cpus : 1U;
+    unsigned long failed = 0;
+
+    if(cmds == NULL)
+        return -1;
+
+    for(unsigned long i = 0; i < spawns; i++)
+        cmds[i].argv = command;
+
+    const unsigned long long start = now_ns();
+    do_exec_batch(cmds, spawns, parallel);
+    const unsigned long long elapsed = now_ns() - start;
+
+    // every command is checked, not only the overall result
+    for(unsigned long i = 0; i < spawns; i++) {
+        if(cmds[i].status != 0)
+            failed++;
+        exec_cmd_free_output(&cmds[i]);
+    }
+    free(cmds);
+
+    printf("{\"bench\":\"exec_batch\",\"rss_mb\":%lu,\"spawns\":%lu,\"parallel\":%zu,\"failed\":%lu,"
+            "\"total_ns\":%llu,\"us_per_spawn\":%.3f,\"spawns_per_s\":%.1f}\n",
+            rss_mb, spawns, parallel, failed, elapsed, (double)elapsed / spawns / 1000.0,
+            elapsed > 0 ? (double)spawns * NSEC_PER_SEC / elapsed : 0.0);
+
+    return failed == 0 ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long rss_mb = DEFAULT_RSS_MB;
+    unsigned long spawns = DEFAULT_SPAWNS;
+    char *command[] = { DEFAULT_COMMAND, NULL };
+    int ret = EXIT_SUCCESS;
+
+    if(argc > 1)
+        rss_mb = strtoul(argv[1], NULL, 10);
+    if(argc > 2)
+        spawns = strtoul(argv[2], NULL, 10);
+    if(argc > 3)
+        command[0] = argv[3];
+
+    if(spawns == 0) {
+        fprintf(stderr, "Usage: %s [rss_mb] [spawns] [command]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // touch every page so it is really part of the resident set
+    char *ballast = NULL;
+    if(rss_mb > 0) {
+        ballast = (char*)malloc(rss_mb << 20);
+        if(ballast == NULL) {
+            fprintf(stderr, "Unable to allocate %lu MB\n", rss_mb);
+            return EXIT_FAILURE;
+        }
+        memset(ballast, 0x5a, rss_mb << 20);
+    }
+
+    if(bench_exec("fork_execv", do_exec_fork, command, rss_mb, spawns) < 0)
+        ret = EXIT_FAILURE;
+    if(bench_exec("posix_spawn", do_exec_spawn, command, rss_mb, spawns) < 0)
+        ret = EXIT_FAILURE;
+    if(bench_batch(command, rss_mb, spawns) < 0)
+        ret = EXIT_FAILURE;
+
+    free(ballast);
+
+    return ret;
+}
@@ -4,6 +4,9 @@
 #include <sys/wait.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <spawn.h>
+
+extern char **environ;
 
 /**
  * @param cmd the command to execute with system()
@@ -29,63 +32,109 @@ bool do_system(const char *cmd)
     return cmd == NULL ? ret > 0 : ret == 0;
 }
 
-bool do_exec_internal(const char * outfile, int count, va_list args)
+/**
+* @param outfile file to redirect standard output of the command to, truncated before, or NULL
+* @param command NULL terminated argument vector, command[0] being the absolute path to execute
+* @return true if the command was started using fork() and execv() and exited with status 0
+*/
+bool do_exec_fork(const char *outfile, char *const command[])
 {
-    char * command[count+1];
-    int i;
-    bool ret = false;
+    int child_ret;
 
-    for(i=0; i<count; i++)
-    {
-        command[i] = va_arg(args, char *);
-    }
-    command[count] = NULL;
-    // this line is to avoid a compile warning before your implementation is complete
-    // and may be removed
-    //command[count] = command[count];
+    if(command[0] == NULL)
+        return false;
 
     // create child process that will handle execv
     fflush(stdout);
     pid_t pid = fork();
-    int child_ret;
 
     if(pid < 0) {
         // error occured
-        goto out;
+        return false;
 
     } else if (pid == 0) {
+        // this is the child, it must never return into the caller
         if(outfile != NULL) {
             // get file descriptor for the output file to redirect standard output
             int fd = open(outfile, O_WRONLY | O_TRUNC | O_CREAT, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
             if (fd < 0)
-                goto out;
+                _exit(EXIT_FAILURE);
 
             // redirect standard output
             if(dup2(fd, 1) < 0) {
                 close(fd);
-                goto out;
+                _exit(EXIT_FAILURE);
             }
             close(fd);
         }
 
-        // this is the child
-        if(count <= 0)
-            goto out;
+        execv(command[0], command);
+        _exit(EXIT_FAILURE);
+    }
+
+    // this is the parent, reap exactly this child
+    if(waitpid(pid, &child_ret, 0) < 0)
+        return false;
+
+    return WIFEXITED(child_ret) && WEXITSTATUS(child_ret) == 0;
+}
+
+/**
+* Same as do_exec_fork(), but starts the command with posix_spawn(). glibc implements it with
+* clone(CLONE_VM | CLONE_VFORK), so the page tables of a large parent are not copied, and reports
+* failures of the redirect or execv() through its return value.
+*/
+bool do_exec_spawn(const char *outfile, char *const command[])
+{
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+    int child_ret;
+    int err;
+
+    if(command[0] == NULL)
+        return false;
+
+    if(posix_spawn_file_actions_init(&actions) != 0)
+        return false;
+
+    // redirect standard output inside the child
+    if(outfile != NULL) {
+        if(posix_spawn_file_actions_addopen(&actions, 1, outfile, O_WRONLY | O_TRUNC | O_CREAT,
+                    S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH) != 0) {
+            posix_spawn_file_actions_destroy(&actions);
+            return false;
+        }
+    }
+
+    fflush(stdout);
+    err = posix_spawn(&pid, command[0], outfile != NULL ? &actions : NULL, NULL, command, environ);
+    posix_spawn_file_actions_destroy(&actions);
 
-        if(execv(command[0], command) < 0)
-            exit(EXIT_FAILURE); 
+    if(err != 0)
+        return false;
 
-    } else {
-        // this is the parent
-        if(wait(&child_ret) < 0)
-            goto out;
+    // reap exactly this child
+    if(waitpid(pid, &child_ret, 0) < 0)
+        return false;
 
-        ret = WEXITSTATUS(child_ret) == 0 ? true : false;
-        goto out;
+    return WIFEXITED(child_ret) && WEXITSTATUS(child_ret) == 0;
+}
+
+bool do_exec_internal(const char * outfile, int count, va_list args)
+{
+    char * command[count+1];
+    int i;
+
+    if(count <= 0)
+        return false;
+
+    for(i=0; i<count; i++)
+    {
+        command[i] = va_arg(args, char *);
     }
+    command[count] = NULL;
 
-out:
-    return ret;
+    return do_exec_spawn(outfile, command);
 }
 
 /**
@@ -7,3 +7,7 @@ bool do_system(const char *command);
 bool do_exec(int count, ...);
 
 bool do_exec_redirect(const char *outputfile, int count, ...);
+
+bool do_exec_fork(const char *outfile, char *const command[]);
+
+bool do_exec_spawn(const char *outfile, char *const command[]);
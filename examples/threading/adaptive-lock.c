@@ -0,0 +1,101 @@
+#include "adaptive-lock.h"
+
+#include <limits.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+static void futex_wait(uint32_t *addr, uint32_t val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr, int count)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+void adaptive_lock_init(adaptive_lock_t *lock)
+{
+    __atomic_store_n(&lock->state, 0, __ATOMIC_RELAXED);
+}
+
+bool adaptive_trylock(adaptive_lock_t *lock)
+{
+    uint32_t expected = 0;
+
+    return __atomic_compare_exchange_n(&lock->state, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void adaptive_lock(adaptive_lock_t *lock)
+{
+    if(adaptive_trylock(lock))
+        return;
+
+    // spin on plain loads so the cache line is not bounced while the owner works
+    for(int i = 0; i < ADAPTIVE_LOCK_SPIN_COUNT; i++) {
+        cpu_relax();
+        if(__atomic_load_n(&lock->state, __ATOMIC_RELAXED) == 0 && adaptive_trylock(lock))
+            return;
+    }
+
+    // mark the lock as having waiters, sleep until the owner wakes us and retry
+    while(__atomic_exchange_n(&lock->state, 2, __ATOMIC_ACQUIRE) != 0)
+        futex_wait(&lock->state, 2);
+}
+
+void adaptive_unlock(adaptive_lock_t *lock)
+{
+    // only pay for the syscall if somebody may sleep
+    if(__atomic_exchange_n(&lock->state, 0, __ATOMIC_RELEASE) == 2)
+        futex_wake(&lock->state, 1);
+}
+
+void adaptive_ticket_lock_init(adaptive_ticket_lock_t *lock)
+{
+    __atomic_store_n(&lock->next, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&lock->serving, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&lock->sleepers, 0, __ATOMIC_RELAXED);
+}
+
+void adaptive_ticket_lock(adaptive_ticket_lock_t *lock)
+{
+    const uint32_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    uint32_t serving;
+
+    // only the next thread in line spins, the others would burn cycles for a whole critical section each
+    for(int i = 0; i < ADAPTIVE_LOCK_SPIN_COUNT; i++) {
+        serving = __atomic_load_n(&lock->serving, __ATOMIC_ACQUIRE);
+        if(serving == ticket)
+            return;
+        if(ticket - serving > 1)
+            break;
+        cpu_relax();
+    }
+
+    // every unlock changes serving, so sleeping on its current value cannot miss our turn
+    __atomic_fetch_add(&lock->sleepers, 1, __ATOMIC_SEQ_CST);
+    while((serving = __atomic_load_n(&lock->serving, __ATOMIC_ACQUIRE)) != ticket)
+        futex_wait(&lock->serving, serving);
+    __atomic_fetch_sub(&lock->sleepers, 1, __ATOMIC_RELAXED);
+}
+
+void adaptive_ticket_unlock(adaptive_ticket_lock_t *lock)
+{
+    __atomic_fetch_add(&lock->serving, 1, __ATOMIC_SEQ_CST);
+
+    // waiters sleep on the same word for different tickets, so all of them have to check
+    if(__atomic_load_n(&lock->sleepers, __ATOMIC_SEQ_CST) != 0)
+        futex_wake(&lock->serving, INT_MAX);
+}
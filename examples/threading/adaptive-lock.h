@@ -0,0 +1,54 @@
+#ifndef ADAPTIVE_LOCK_H
+#define ADAPTIVE_LOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Locks for short critical sections: a contended lock spins for a bounded number of
+ * rounds, assuming the owner releases it soon, before it sleeps on a futex.
+ * Compared to pthread_mutex_lock this avoids the sleep and wakeup latency whenever the
+ * critical section is shorter than the spin phase.
+ */
+
+/**
+ * Number of spin rounds before sleeping, each round executes one pause instruction
+ */
+#ifndef ADAPTIVE_LOCK_SPIN_COUNT
+#define ADAPTIVE_LOCK_SPIN_COUNT 200
+#endif
+
+/**
+ * Unfair lock, a newly arriving thread may overtake sleeping waiters
+ */
+typedef struct adaptive_lock{
+    // 0: unlocked, 1: locked, 2: locked and there may be sleeping waiters
+    uint32_t state;
+} adaptive_lock_t;
+
+#define ADAPTIVE_LOCK_INITIALIZER { 0 }
+
+void adaptive_lock_init(adaptive_lock_t *lock);
+void adaptive_lock(adaptive_lock_t *lock);
+bool adaptive_trylock(adaptive_lock_t *lock);
+void adaptive_unlock(adaptive_lock_t *lock);
+
+/**
+ * Fair FIFO variant, threads obtain the lock in the order they arrived.
+ * Each handover has to wait for exactly the next thread, so it degrades badly when there
+ * are more contending threads than CPUs and that thread is not running.
+ */
+typedef struct adaptive_ticket_lock{
+    uint32_t next;
+    uint32_t serving;
+    // number of threads sleeping on serving
+    uint32_t sleepers;
+} adaptive_ticket_lock_t;
+
+#define ADAPTIVE_TICKET_LOCK_INITIALIZER { 0, 0, 0 }
+
+void adaptive_ticket_lock_init(adaptive_ticket_lock_t *lock);
+void adaptive_ticket_lock(adaptive_ticket_lock_t *lock);
+void adaptive_ticket_unlock(adaptive_ticket_lock_t *lock);
+
+#endif /* ADAPTIVE_LOCK_H */
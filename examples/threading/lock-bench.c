@@ -0,0 +1,167 @@
+/**
+ * @file lock-bench.c
+ * @brief Compares pthread mutexes with the adaptive locks for short critical sections
+ *
+ * Threads are started like in start_thread_obtaining_mutex(), each thread then repeatedly
+ * formats a line and appends it to a shared buffer under the lock, mimicking the server
+ * appending received packets to its data file.  Prints one JSON object per lock type and
+ * thread count.
+ *
+ * Usage: lock-bench [iterations_per_thread]
+ *
+ * @author Heiko Schmidt
+ * @date 2026-10-19
+ *
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "adaptive-lock.h"
+
+#define DEFAULT_ITERATIONS 100000UL
+#define SHARED_BUF_SIZE 65536U
+#define LINE_BUF_SIZE 64U
+#define NSEC_PER_SEC 1000000000ULL
+
+enum lock_type { LOCK_PTHREAD, LOCK_ADAPTIVE, LOCK_TICKET };
+
+static const char *const lock_names[] = { "pthread_mutex", "adaptive", "adaptive_ticket" };
+static const unsigned int thread_counts[] = { 2, 4, 8, 16, 32, 64 };
+
+struct bench_shared{
+    enum lock_type type;
+    pthread_mutex_t mutex;
+    adaptive_lock_t adaptive;
+    adaptive_ticket_lock_t ticket;
+    char buf[SHARED_BUF_SIZE];
+    size_t pos;
+    unsigned long iterations;
+};
+
+struct bench_thread_data{
+    struct bench_shared *shared;
+    unsigned int id;
+};
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + (unsigned long long)ts.tv_nsec;
+}
+
+static void bench_lock(struct bench_shared *shared)
+{
+    switch(shared->type) {
+    case LOCK_PTHREAD: pthread_mutex_lock(&shared->mutex); break;
+    case LOCK_ADAPTIVE: adaptive_lock(&shared->adaptive); break;
+    case LOCK_TICKET: adaptive_ticket_lock(&shared->ticket); break;
+    }
+}
+
+static void bench_unlock(struct bench_shared *shared)
+{
+    switch(shared->type) {
+    case LOCK_PTHREAD: pthread_mutex_unlock(&shared->mutex); break;
+    case LOCK_ADAPTIVE: adaptive_unlock(&shared->adaptive); break;
+    case LOCK_TICKET: adaptive_ticket_unlock(&shared->ticket); break;
+    }
+}
+
+static void *bench_threadfunc(void *thread_param)
+{
+    struct bench_thread_data *data = (struct bench_thread_data*)thread_param;
+    struct bench_shared *shared = data->shared;
+    char line[LINE_BUF_SIZE];
+
+    for(unsigned long i = 0; i < shared->iterations; i++) {
+        const int len = snprintf(line, LINE_BUF_SIZE, "thread %u packet %lu\n", data->id, i);
+
+        // the critical section only appends one line
+        bench_lock(shared);
+        if(shared->pos + len > SHARED_BUF_SIZE)
+            shared->pos = 0;
+        memcpy(&shared->buf[shared->pos], line, len);
+        shared->pos += len;
+        bench_unlock(shared);
+    }
+
+    return thread_param;
+}
+
+static int run(struct bench_shared *shared, enum lock_type type, unsigned int threads)
+{
+    pthread_t ids[threads];
+    unsigned int started;
+
+    shared->type = type;
+    shared->pos = 0;
+
+    const unsigned long long start = now_ns();
+    for(started = 0; started < threads; started++) {
+        struct bench_thread_data *data = (struct bench_thread_data*)malloc(sizeof(struct bench_thread_data));
+        if(data == NULL)
+            break;
+
+        data->shared = shared;
+        data->id = started;
+        if(pthread_create(&ids[started], NULL, bench_threadfunc, data) != 0) {
+            free(data);
+            break;
+        }
+    }
+
+    for(unsigned int i = 0; i < started; i++) {
+        void *ret;
+        pthread_join(ids[i], &ret);
+        free(ret);
+    }
+    const unsigned long long elapsed = now_ns() - start;
+
+    if(started != threads) {
+        fprintf(stderr, "Unable to start %u threads\n", threads);
+        return -1;
+    }
+
+    const unsigned long long ops = (unsigned long long)threads * shared->iterations;
+    printf("{\"bench\":\"lock\",\"lock\":\"%s\",\"threads\":%u,\"ops\":%llu,"
+            "\"total_ns\":%llu,\"ns_per_op\":%.3f,\"ops_per_s\":%.0f}\n",
+            lock_names[type], threads, ops, elapsed, (double)elapsed / ops,
+            elapsed > 0 ? (double)ops * NSEC_PER_SEC / elapsed : 0.0);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static struct bench_shared shared;
+    int ret = EXIT_SUCCESS;
+
+    shared.iterations = DEFAULT_ITERATIONS;
+    if(argc > 1)
+        shared.iterations = strtoul(argv[1], NULL, 10);
+
+    if(shared.iterations == 0) {
+        fprintf(stderr, "Usage: %s [iterations_per_thread]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    pthread_mutex_init(&shared.mutex, NULL);
+    adaptive_lock_init(&shared.adaptive);
+    adaptive_ticket_lock_init(&shared.ticket);
+
+    for(size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++) {
+        for(int type = LOCK_PTHREAD; type <= LOCK_TICKET; type++) {
+            if(run(&shared, (enum lock_type)type, thread_counts[i]) < 0)
+                ret = EXIT_FAILURE;
+        }
+    }
+
+    pthread_mutex_destroy(&shared.mutex);
+
+    return ret;
+}
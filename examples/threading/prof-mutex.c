@@ -0,0 +1,170 @@
+#include "prof-mutex.h"
+
+#ifdef PROF_MUTEX
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+#define NSEC_PER_SEC 1000000000ULL
+
+// locks held by a thread at the same time, deeper nesting is not timed
+#define PROF_MUTEX_MAX_NESTING 8
+
+#define HIST_LINE_BUF_SIZE 512
+
+struct prof_mutex_held{
+    pthread_mutex_t *mutex;
+    struct prof_mutex_site *site;
+    uint64_t acquired_ns;
+};
+
+static __thread struct prof_mutex_held held[PROF_MUTEX_MAX_NESTING];
+static __thread size_t held_count;
+
+// list of all sites used so far, only ever prepended to
+static struct prof_mutex_site *sites;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+static unsigned int hist_bucket(uint64_t ns)
+{
+    unsigned int bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+
+    return bucket < PROF_MUTEX_HIST_BUCKETS ? bucket : PROF_MUTEX_HIST_BUCKETS - 1;
+}
+
+static void register_site(struct prof_mutex_site *site)
+{
+    if(__atomic_exchange_n(&site->registered, 1, __ATOMIC_ACQ_REL))
+        return;
+
+    site->next = __atomic_load_n(&sites, __ATOMIC_ACQUIRE);
+    while(!__atomic_compare_exchange_n(&sites, &site->next, site, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        ;
+}
+
+static void acquired(struct prof_mutex_site *site, pthread_mutex_t *mutex, uint64_t acquired_ns, uint64_t wait_ns, int contended)
+{
+    __atomic_add_fetch(&site->acquisitions, 1, __ATOMIC_RELAXED);
+    if(contended) {
+        __atomic_add_fetch(&site->contended, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&site->wait_ns, wait_ns, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&site->wait_hist[hist_bucket(wait_ns)], 1, __ATOMIC_RELAXED);
+
+    if(held_count < PROF_MUTEX_MAX_NESTING) {
+        held[held_count].mutex = mutex;
+        held[held_count].site = site;
+        held[held_count].acquired_ns = acquired_ns;
+        held_count++;
+    }
+}
+
+int prof_mutex_lock_site(struct prof_mutex_site *site, pthread_mutex_t *mutex)
+{
+    register_site(site);
+
+    // an uncontended acquisition costs one extra timestamp only
+    int ret = pthread_mutex_trylock(mutex);
+    if(ret == 0) {
+        acquired(site, mutex, now_ns(), 0, 0);
+        return 0;
+    }
+
+    if(ret != EBUSY)
+        return ret;
+
+    const uint64_t start = now_ns();
+    ret = pthread_mutex_lock(mutex);
+    if(ret != 0)
+        return ret;
+
+    const uint64_t end = now_ns();
+    acquired(site, mutex, end, end - start, 1);
+
+    return 0;
+}
+
+int prof_mutex_trylock_site(struct prof_mutex_site *site, pthread_mutex_t *mutex)
+{
+    register_site(site);
+
+    int ret = pthread_mutex_trylock(mutex);
+    if(ret == 0)
+        acquired(site, mutex, now_ns(), 0, 0);
+    else if(ret == EBUSY)
+        __atomic_add_fetch(&site->contended, 1, __ATOMIC_RELAXED);
+
+    return ret;
+}
+
+int prof_mutex_unlock_tracked(pthread_mutex_t *mutex)
+{
+    // attribute the hold time to the site which locked the mutex
+    for(size_t i = held_count; i > 0; i--) {
+        if(held[i - 1].mutex != mutex)
+            continue;
+
+        struct prof_mutex_site *site = held[i - 1].site;
+        const uint64_t hold = now_ns() - held[i - 1].acquired_ns;
+
+        __atomic_add_fetch(&site->hold_ns, hold, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&site->hold_hist[hist_bucket(hold)], 1, __ATOMIC_RELAXED);
+
+        held[i - 1] = held[held_count - 1];
+        held_count--;
+        break;
+    }
+
+    return pthread_mutex_unlock(mutex);
+}
+
+static void format_hist(char *buf, size_t len, const uint64_t *hist)
+{
+    size_t pos = 0;
+
+    buf[0] = '\0';
+    for(unsigned int i = 0; i < PROF_MUTEX_HIST_BUCKETS && pos < len; i++) {
+        const uint64_t cnt = __atomic_load_n(&hist[i], __ATOMIC_RELAXED);
+        if(cnt == 0)
+            continue;
+
+        int n = snprintf(&buf[pos], len - pos, " 2^%u:%llu", i, (unsigned long long)cnt);
+        if(n < 0)
+            break;
+        pos += n;
+    }
+}
+
+void prof_mutex_dump(void)
+{
+    char hist[HIST_LINE_BUF_SIZE];
+
+    for(struct prof_mutex_site *site = __atomic_load_n(&sites, __ATOMIC_ACQUIRE); site != NULL; site = site->next) {
+        const unsigned long long acq = __atomic_load_n(&site->acquisitions, __ATOMIC_RELAXED);
+        const unsigned long long contended = __atomic_load_n(&site->contended, __ATOMIC_RELAXED);
+        const unsigned long long wait_ns = __atomic_load_n(&site->wait_ns, __ATOMIC_RELAXED);
+        const unsigned long long hold_ns = __atomic_load_n(&site->hold_ns, __ATOMIC_RELAXED);
+
+        syslog(LOG_INFO, "mutex %s:%d (%s): acquisitions=%llu contended=%llu wait_ns=%llu hold_ns=%llu",
+                site->file, site->line, site->func, acq, contended, wait_ns, hold_ns);
+
+        format_hist(hist, sizeof(hist), site->wait_hist);
+        syslog(LOG_INFO, "mutex %s:%d wait histogram:%s", site->file, site->line, hist);
+
+        format_hist(hist, sizeof(hist), site->hold_hist);
+        syslog(LOG_INFO, "mutex %s:%d hold histogram:%s", site->file, site->line, hist);
+    }
+}
+
+#endif /* PROF_MUTEX */
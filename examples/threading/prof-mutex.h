@@ -0,0 +1,69 @@
+#ifndef PROF_MUTEX_H
+#define PROF_MUTEX_H
+
+#include <pthread.h>
+
+/**
+ * Drop-in replacements for pthread_mutex_lock/trylock/unlock which record, per call site,
+ * the number of acquisitions, how many of them were contended, and log2 histograms of the
+ * time spent waiting for and holding the mutex.  Results are written to syslog with
+ * prof_mutex_dump().
+ *
+ * Instrumentation is only compiled in if PROF_MUTEX is defined, otherwise the macros map
+ * directly to the pthread functions and add no cost.  The mutex type stays pthread_mutex_t
+ * in both cases.
+ */
+#ifdef PROF_MUTEX
+
+#include <stdint.h>
+
+#define PROF_MUTEX_HIST_BUCKETS 40
+
+/**
+ * Statistics of one lock call site, statically allocated by PROF_MUTEX_LOCK
+ */
+struct prof_mutex_site{
+    const char *file;
+    int line;
+    const char *func;
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t wait_ns;
+    uint64_t hold_ns;
+    // bucket i counts durations in [2^i, 2^(i+1)) ns, bucket 0 also counts 0
+    uint64_t wait_hist[PROF_MUTEX_HIST_BUCKETS];
+    uint64_t hold_hist[PROF_MUTEX_HIST_BUCKETS];
+    struct prof_mutex_site *next;
+    int registered;
+};
+
+int prof_mutex_lock_site(struct prof_mutex_site *site, pthread_mutex_t *mutex);
+int prof_mutex_trylock_site(struct prof_mutex_site *site, pthread_mutex_t *mutex);
+int prof_mutex_unlock_tracked(pthread_mutex_t *mutex);
+void prof_mutex_dump(void);
+
+#define PROF_MUTEX_SITE_INIT { __FILE__, __LINE__, __func__, 0, 0, 0, 0, {0}, {0}, NULL, 0 }
+
+#define PROF_MUTEX_LOCK(mutex) \
+    ({ static struct prof_mutex_site prof_site_ = PROF_MUTEX_SITE_INIT; \
+       prof_mutex_lock_site(&prof_site_, (mutex)); })
+
+#define PROF_MUTEX_TRYLOCK(mutex) \
+    ({ static struct prof_mutex_site prof_site_ = PROF_MUTEX_SITE_INIT; \
+       prof_mutex_trylock_site(&prof_site_, (mutex)); })
+
+#define PROF_MUTEX_UNLOCK(mutex) prof_mutex_unlock_tracked(mutex)
+
+#else
+
+#define PROF_MUTEX_LOCK(mutex) pthread_mutex_lock(mutex)
+#define PROF_MUTEX_TRYLOCK(mutex) pthread_mutex_trylock(mutex)
+#define PROF_MUTEX_UNLOCK(mutex) pthread_mutex_unlock(mutex)
+
+static inline void prof_mutex_dump(void)
+{
+}
+
+#endif /* PROF_MUTEX */
+
+#endif /* PROF_MUTEX_H */
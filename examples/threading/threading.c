@@ -1,4 +1,5 @@
 #include "threading.h"
+#include "prof-mutex.h"
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -22,14 +23,14 @@ void* threadfunc(void* thread_param)
         data->thread_complete_success = false;
     } else {
         // obtain mutex
-        if(pthread_mutex_lock(data->mutex) != 0) {
+        if(PROF_MUTEX_LOCK(data->mutex) != 0) {
             data->thread_complete_success = false;
         } else {
             // wait after lock and unlock again
             if(usleep(data->wait_to_release_ms * 1000) != 0)
                 data->thread_complete_success = false;
 
-            if(pthread_mutex_unlock(data->mutex) != 0)
+            if(PROF_MUTEX_UNLOCK(data->mutex) != 0)
                 data->thread_complete_success = false;
         }
     }
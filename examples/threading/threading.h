@@ -1,3 +1,6 @@
+#ifndef THREADING_H
+#define THREADING_H
+
 #include <stdbool.h>
 #include <pthread.h>
 #include <stdint.h>
@@ -42,3 +45,5 @@ struct thread_data{
 * @return true if the thread could be started, false if a failure occurred.
 */
 bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex,int wait_to_obtain_ms, int wait_to_release_ms);
+
+#endif /* THREADING_H */
@@ -0,0 +1,412 @@
+#include "threadpool.h"
+#include "prof-mutex.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+
+#define NSEC_PER_SEC 1000000000L
+#define NSEC_PER_MSEC 1000000L
+
+/*
+ * Bounded deque, the owning worker pushes and pops at the bottom, thieves take from the top
+ */
+struct threadpool_deque{
+    pthread_mutex_t lock;
+    struct threadpool_task **tasks;
+    size_t capacity;
+    size_t head;
+    size_t count;
+};
+
+struct threadpool_worker{
+    pthread_t thread;
+    struct threadpool *pool;
+    struct threadpool_deque deque;
+    size_t index;
+};
+
+struct threadpool{
+    struct threadpool_worker *workers;
+    size_t worker_count;
+    atomic_size_t next_worker;
+
+    // number of tasks in all deques, checked by idle workers before sleeping
+    atomic_size_t queued;
+
+    // protects the delayed list and the stop flag, idle workers wait on cond
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct threadpool_task *delayed;
+    bool stop;
+};
+
+static __thread struct threadpool_worker *current_worker;
+
+static bool deque_push(struct threadpool_deque *deque, struct threadpool_task *task)
+{
+    bool ret = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if(deque->count < deque->capacity) {
+        deque->tasks[(deque->head + deque->count) % deque->capacity] = task;
+        deque->count++;
+        ret = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return ret;
+}
+
+static struct threadpool_task *deque_pop(struct threadpool_deque *deque)
+{
+    struct threadpool_task *task = NULL;
+
+    pthread_mutex_lock(&deque->lock);
+    if(deque->count > 0) {
+        deque->count--;
+        task = deque->tasks[(deque->head + deque->count) % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return task;
+}
+
+static struct threadpool_task *deque_steal(struct threadpool_deque *deque)
+{
+    struct threadpool_task *task = NULL;
+
+    pthread_mutex_lock(&deque->lock);
+    if(deque->count > 0) {
+        task = deque->tasks[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+        deque->count--;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return task;
+}
+
+static bool timespec_before(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static bool enqueue(struct threadpool *pool, struct threadpool_task *task)
+{
+    bool queued = false;
+
+    // keep work local to the submitting worker, otherwise distribute
+    if(current_worker != NULL && current_worker->pool == pool)
+        queued = deque_push(&current_worker->deque, task);
+
+    for(size_t i = 0; !queued && i < pool->worker_count; i++) {
+        const size_t idx = atomic_fetch_add(&pool->next_worker, 1) % pool->worker_count;
+        queued = deque_push(&pool->workers[idx].deque, task);
+    }
+
+    if(queued)
+        atomic_fetch_add(&pool->queued, 1);
+
+    return queued;
+}
+
+static struct threadpool_task *take_task(struct threadpool_worker *worker)
+{
+    struct threadpool *pool = worker->pool;
+    struct threadpool_task *task = deque_pop(&worker->deque);
+
+    for(size_t i = 1; task == NULL && i < pool->worker_count; i++)
+        task = deque_steal(&pool->workers[(worker->index + i) % pool->worker_count].deque);
+
+    if(task != NULL)
+        atomic_fetch_sub(&pool->queued, 1);
+
+    return task;
+}
+
+static void run_task(struct threadpool_task *task)
+{
+    // the task may be reused by its function, so take everything needed first
+    struct threadpool_future *future = task->future;
+    const bool success = task->fn(task->arg);
+
+    if(future != NULL) {
+        pthread_mutex_lock(&future->lock);
+        future->thread_complete_success = success;
+        future->done = true;
+        pthread_cond_broadcast(&future->cond);
+        pthread_mutex_unlock(&future->lock);
+    }
+}
+
+/*
+ * Moves due delayed tasks to the deques, caller must hold pool->lock
+ */
+static void release_delayed(struct threadpool *pool, const struct timespec *now)
+{
+    while(pool->delayed != NULL && !timespec_before(now, &pool->delayed->not_before)) {
+        struct threadpool_task *task = pool->delayed;
+
+        if(!enqueue(pool, task))
+            break;
+
+        pool->delayed = task->next;
+    }
+}
+
+static void *worker_func(void *arg)
+{
+    struct threadpool_worker *worker = (struct threadpool_worker*)arg;
+    struct threadpool *pool = worker->pool;
+
+    current_worker = worker;
+
+    for(;;) {
+        struct threadpool_task *task = take_task(worker);
+        if(task != NULL) {
+            run_task(task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        release_delayed(pool, &now);
+
+        if(atomic_load(&pool->queued) == 0) {
+            if(pool->stop && pool->delayed == NULL) {
+                pthread_mutex_unlock(&pool->lock);
+                break;
+            }
+
+            // sleep until new work arrives or the next delayed task is due
+            if(pool->delayed != NULL)
+                pthread_cond_timedwait(&pool->cond, &pool->lock, &pool->delayed->not_before);
+            else
+                pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+struct threadpool *threadpool_create(size_t workers, size_t deque_capacity)
+{
+    pthread_condattr_t attr;
+    size_t started = 0;
+
+    if(workers == 0 || deque_capacity == 0)
+        return NULL;
+
+    struct threadpool *pool = (struct threadpool*)calloc(1, sizeof(struct threadpool));
+    if(pool == NULL)
+        return NULL;
+
+    pool->workers = (struct threadpool_worker*)calloc(workers, sizeof(struct threadpool_worker));
+    if(pool->workers == NULL)
+        goto err_pool;
+
+    pool->worker_count = workers;
+    atomic_init(&pool->next_worker, 0);
+    atomic_init(&pool->queued, 0);
+
+    // delayed tasks use CLOCK_MONOTONIC deadlines
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pool->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    for(size_t i = 0; i < workers; i++) {
+        struct threadpool_worker *worker = &pool->workers[i];
+
+        worker->pool = pool;
+        worker->index = i;
+        worker->deque.capacity = deque_capacity;
+        worker->deque.tasks = (struct threadpool_task**)calloc(deque_capacity, sizeof(struct threadpool_task*));
+        pthread_mutex_init(&worker->deque.lock, NULL);
+
+        if(worker->deque.tasks == NULL)
+            goto err_workers;
+    }
+
+    for(started = 0; started < workers; started++) {
+        if(pthread_create(&pool->workers[started].thread, NULL, worker_func, &pool->workers[started]) != 0)
+            goto err_workers;
+    }
+
+    return pool;
+
+err_workers:
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(size_t i = 0; i < started; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    for(size_t i = 0; i < workers; i++) {
+        free(pool->workers[i].deque.tasks);
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+    }
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+err_pool:
+    free(pool);
+    return NULL;
+}
+
+bool threadpool_submit(struct threadpool *pool, struct threadpool_task *task)
+{
+    if(pool == NULL || task == NULL || task->fn == NULL)
+        return false;
+
+    if(!enqueue(pool, task))
+        return false;
+
+    // taking the lock orders the wakeup after an idle worker checked queued
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    return true;
+}
+
+bool threadpool_submit_after(struct threadpool *pool, struct threadpool_task *task, unsigned int delay_ms)
+{
+    struct threadpool_task **pos;
+
+    if(pool == NULL || task == NULL || task->fn == NULL)
+        return false;
+
+    if(delay_ms == 0)
+        return threadpool_submit(pool, task);
+
+    clock_gettime(CLOCK_MONOTONIC, &task->not_before);
+    task->not_before.tv_sec += delay_ms / 1000;
+    task->not_before.tv_nsec += (long)(delay_ms % 1000) * NSEC_PER_MSEC;
+    if(task->not_before.tv_nsec >= NSEC_PER_SEC) {
+        task->not_before.tv_sec++;
+        task->not_before.tv_nsec -= NSEC_PER_SEC;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    // keep the list sorted by deadline
+    for(pos = &pool->delayed; *pos != NULL && !timespec_before(&task->not_before, &(*pos)->not_before); pos = &(*pos)->next)
+        ;
+    task->next = *pos;
+    *pos = task;
+
+    // an earlier deadline needs a sleeping worker to recompute its timeout
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    return true;
+}
+
+void threadpool_destroy(struct threadpool *pool)
+{
+    if(pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(size_t i = 0; i < pool->worker_count; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    for(size_t i = 0; i < pool->worker_count; i++) {
+        free(pool->workers[i].deque.tasks);
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+    }
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+void threadpool_future_init(struct threadpool_future *future)
+{
+    pthread_mutex_init(&future->lock, NULL);
+    pthread_cond_init(&future->cond, NULL);
+    future->done = false;
+    future->thread_complete_success = false;
+}
+
+bool threadpool_future_wait(struct threadpool_future *future)
+{
+    bool success;
+
+    pthread_mutex_lock(&future->lock);
+    while(!future->done)
+        pthread_cond_wait(&future->cond, &future->lock);
+    success = future->thread_complete_success;
+    pthread_mutex_unlock(&future->lock);
+
+    return success;
+}
+
+void threadpool_future_destroy(struct threadpool_future *future)
+{
+    pthread_cond_destroy(&future->cond);
+    pthread_mutex_destroy(&future->lock);
+}
+
+static bool mutex_job_func(void *arg)
+{
+    struct thread_data *data = (struct thread_data*)arg;
+    struct timespec hold;
+
+    data->thread_complete_success = false;
+
+    // the wait to obtain already passed as the task delay
+    if(PROF_MUTEX_LOCK(data->mutex) != 0)
+        return false;
+
+    hold.tv_sec = data->wait_to_release_ms / 1000;
+    hold.tv_nsec = (long)(data->wait_to_release_ms % 1000) * NSEC_PER_MSEC;
+
+    data->thread_complete_success = true;
+    if(clock_nanosleep(CLOCK_MONOTONIC, 0, &hold, NULL) != 0)
+        data->thread_complete_success = false;
+
+    if(PROF_MUTEX_UNLOCK(data->mutex) != 0)
+        data->thread_complete_success = false;
+
+    return data->thread_complete_success;
+}
+
+bool threadpool_start_obtaining_mutex(struct threadpool *pool, struct threadpool_mutex_job *job,
+        pthread_mutex_t *mutex, int wait_to_obtain_ms, int wait_to_release_ms)
+{
+    if(job == NULL)
+        return false;
+
+    // initialized first, so the caller can destroy it whether the job was queued or not
+    threadpool_future_init(&job->future);
+
+    if(mutex == NULL || wait_to_obtain_ms < 0 || wait_to_release_ms < 0)
+        return false;
+
+    job->data.mutex = mutex;
+    job->data.wait_to_obtain_ms = wait_to_obtain_ms;
+    job->data.wait_to_release_ms = wait_to_release_ms;
+    job->data.thread_complete_success = false;
+
+    job->task.fn = mutex_job_func;
+    job->task.arg = &job->data;
+    job->task.future = &job->future;
+
+    return threadpool_submit_after(pool, &job->task, (unsigned int)wait_to_obtain_ms);
+}
@@ -0,0 +1,109 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "threading.h"
+
+/**
+ * Task function run by a pool worker, the return value is stored as
+ * thread_complete_success in the future of the task.
+ */
+typedef bool (*threadpool_fn_t)(void *arg);
+
+/**
+ * Completion state of a task, to be waited for with threadpool_future_wait().
+ */
+struct threadpool_future{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool done;
+
+    /**
+     * Set to true if the task completed with success, false
+     * if an error occurred.
+     */
+    bool thread_complete_success;
+};
+
+/**
+ * A unit of work.  The memory is owned by the caller and must stay valid until the task
+ * has run, so submitting does not allocate.
+ */
+struct threadpool_task{
+    threadpool_fn_t fn;
+    void *arg;
+    /**
+     * Optional future completed after fn returned, may be NULL
+     */
+    struct threadpool_future *future;
+
+    /*
+     * Used by the pool for delayed tasks
+     */
+    struct timespec not_before;
+    struct threadpool_task *next;
+};
+
+struct threadpool;
+
+/**
+* Starts a pool with @param workers threads, each owning a work-stealing deque of
+* @param deque_capacity tasks.
+* @return the pool, or NULL if it could not be created
+*/
+struct threadpool *threadpool_create(size_t workers, size_t deque_capacity);
+
+/**
+* Queues @param task for execution.  Tasks submitted from a worker are queued on its own deque,
+* others are distributed round robin.  Idle workers steal from the others.
+* @return false if all deques are full
+*/
+bool threadpool_submit(struct threadpool *pool, struct threadpool_task *task);
+
+/**
+* Queues @param task for execution after @param delay_ms milliseconds.  No worker is blocked
+* while the task is waiting.
+*/
+bool threadpool_submit_after(struct threadpool *pool, struct threadpool_task *task, unsigned int delay_ms);
+
+/**
+* Runs all queued and delayed tasks to completion, then stops the workers and frees @param pool.
+*/
+void threadpool_destroy(struct threadpool *pool);
+
+void threadpool_future_init(struct threadpool_future *future);
+
+/**
+* Blocks until the task of @param future has run.
+* @return thread_complete_success of the task
+*/
+bool threadpool_future_wait(struct threadpool_future *future);
+
+void threadpool_future_destroy(struct threadpool_future *future);
+
+/**
+ * Pool based equivalent of the thread started by start_thread_obtaining_mutex(),
+ * allocated by the caller and reusable once its future completed and was destroyed.
+ */
+struct threadpool_mutex_job{
+    struct thread_data data;
+    struct threadpool_task task;
+    struct threadpool_future future;
+};
+
+/**
+* Same behaviour as start_thread_obtaining_mutex(), but runs on @param pool: the wait before
+* obtaining the mutex is a delayed task instead of a sleeping thread, and no memory is allocated.
+* Initializes job->future, wait for completion with threadpool_future_wait(&job->future) and
+* release it with threadpool_future_destroy(&job->future) afterwards.  Unless @param job is
+* NULL the future is initialized even if the job could not be queued.
+* @return true if the job could be queued
+*/
+bool threadpool_start_obtaining_mutex(struct threadpool *pool, struct threadpool_mutex_job *job,
+        pthread_mutex_t *mutex, int wait_to_obtain_ms, int wait_to_release_ms);
+
+#endif /* THREADPOOL_H */
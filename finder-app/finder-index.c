@@ -0,0 +1,548 @@
+/*
+ * Persistent index of the native finder
+ *
+ * The index file starts with a magic and the root directory, followed by one record per
+ * file: path, size, mtime and the number of matching lines for each search string it was
+ * searched for.  Integers are stored in host byte order, the index is a cache for the
+ * local machine only.  The file is mapped on open, records still valid at save time are
+ * copied over verbatim and only searched files are serialized again.
+ * Author: Heiko Schmidt
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "finder-index.h"
+
+#define INDEX_MAGIC "FNDIDX02"
+#define INDEX_MAGIC_LEN 8U
+// stored instead of a line count for a binary file containing the pattern
+#define BINARY_MATCH UINT64_MAX
+
+// key joining all patterns with newlines, which patterns cannot contain
+#define KEY_SEPARATOR '\n'
+
+struct index_record
+{
+    // serialized record within the mapping
+    const uint8_t *raw;
+    size_t raw_len;
+
+    const char *path;
+    uint32_t path_len;
+    uint64_t size;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t key_count;
+    const uint8_t *keys;
+
+    // still valid, copied into the saved index
+    bool keep;
+};
+
+struct index_update
+{
+    struct index_update *next;
+    size_t len;
+    uint8_t data[];
+};
+
+struct index_key
+{
+    const char *str;
+    uint32_t len;
+};
+
+struct finder_index
+{
+    char *index_path;
+    char *root;
+    uint32_t root_len;
+
+    // keys of this run, one per pattern and the joined one for lines matching any of them
+    struct index_key *keys;
+    size_t pattern_count;
+    size_t key_count;
+    char *joined_key;
+
+    void *map;
+    size_t map_len;
+
+    struct index_record *records;
+    size_t record_count;
+    // open addressing table of record indices plus one, 0 marks empty slots
+    uint32_t *slots;
+    size_t slot_mask;
+
+    _Atomic(struct index_update*) updates;
+};
+
+/*
+ * Unaligned accessors for the serialized format
+ */
+struct reader
+{
+    const uint8_t *pos;
+    const uint8_t *end;
+};
+
+static bool read_bytes(struct reader *r, void *dst, size_t len)
+{
+    if((size_t)(r->end - r->pos) < len)
+        return false;
+    memcpy(dst, r->pos, len);
+    r->pos += len;
+    return true;
+}
+
+static bool skip_bytes(struct reader *r, const uint8_t **start, size_t len)
+{
+    if((size_t)(r->end - r->pos) < len)
+        return false;
+    *start = r->pos;
+    r->pos += len;
+    return true;
+}
+
+static uint8_t *put_bytes(uint8_t *dst, const void *src, size_t len)
+{
+    memcpy(dst, src, len);
+    return dst + len;
+}
+
+static uint64_t hash_path(const char *path, size_t len)
+{
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for(size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)path[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+static struct index_record *find_record(const struct finder_index *index, const char *path)
+{
+    const size_t len = strlen(path);
+
+    if(index->slots == NULL)
+        return NULL;
+
+    for(size_t slot = hash_path(path, len) & index->slot_mask; index->slots[slot] != 0;
+            slot = (slot + 1) & index->slot_mask) {
+        struct index_record *rec = &index->records[index->slots[slot] - 1];
+
+        if(rec->path_len == len && memcmp(rec->path, path, len) == 0)
+            return rec;
+    }
+
+    return NULL;
+}
+
+static bool record_is_current(const struct index_record *rec, const struct stat *st)
+{
+    return rec->size == (uint64_t)st->st_size &&
+            rec->mtime_sec == (int64_t)st->st_mtim.tv_sec &&
+            rec->mtime_nsec == (uint32_t)st->st_mtim.tv_nsec;
+}
+
+/**
+ * Searches the keys of @param rec for @param key
+ * @return true and the line count in @param lines if found
+ */
+static bool record_get_key(const struct index_record *rec, const struct index_key *key, uint64_t *lines)
+{
+    const uint8_t *pos = rec->keys;
+
+    // lengths were validated on load
+    for(uint32_t i = 0; i < rec->key_count; i++) {
+        uint32_t len;
+
+        memcpy(&len, pos, sizeof(len));
+        pos += sizeof(len);
+        if(len == key->len && memcmp(pos, key->str, len) == 0) {
+            memcpy(lines, pos + len, sizeof(*lines));
+            return true;
+        }
+        pos += len + sizeof(uint64_t);
+    }
+
+    return false;
+}
+
+static bool parse_record(struct reader *r, struct index_record *rec)
+{
+    const uint8_t *start = r->pos;
+    const uint8_t *path;
+
+    if(!read_bytes(r, &rec->path_len, sizeof(rec->path_len)) ||
+            !skip_bytes(r, &path, rec->path_len) ||
+            !read_bytes(r, &rec->size, sizeof(rec->size)) ||
+            !read_bytes(r, &rec->mtime_sec, sizeof(rec->mtime_sec)) ||
+            !read_bytes(r, &rec->mtime_nsec, sizeof(rec->mtime_nsec)) ||
+            !read_bytes(r, &rec->key_count, sizeof(rec->key_count)))
+        return false;
+
+    rec->path = (const char*)path;
+    rec->keys = r->pos;
+
+    for(uint32_t i = 0; i < rec->key_count; i++) {
+        uint32_t len;
+        const uint8_t *unused;
+
+        if(!read_bytes(r, &len, sizeof(len)) || !skip_bytes(r, &unused, (size_t)len + sizeof(uint64_t)))
+            return false;
+    }
+
+    rec->raw = start;
+    rec->raw_len = (size_t)(r->pos - start);
+    rec->keep = false;
+
+    return true;
+}
+
+/**
+ * Maps the index file and builds the lookup table.  Anything not matching the expected
+ * format leaves the index empty, it is only a cache.
+ */
+static void load_index(struct finder_index *index)
+{
+    struct stat st;
+    struct reader r;
+    size_t capacity = 0;
+    char magic[INDEX_MAGIC_LEN];
+    uint32_t root_len;
+    const uint8_t *root;
+
+    int fd = open(index->index_path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return;
+
+    if(fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+
+    index->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(index->map == MAP_FAILED) {
+        index->map = NULL;
+        return;
+    }
+    index->map_len = st.st_size;
+
+    r.pos = (const uint8_t*)index->map;
+    r.end = r.pos + index->map_len;
+
+    if(!read_bytes(&r, magic, sizeof(magic)) || memcmp(magic, INDEX_MAGIC, INDEX_MAGIC_LEN) != 0 ||
+            !read_bytes(&r, &root_len, sizeof(root_len)) || !skip_bytes(&r, &root, root_len) ||
+            root_len != index->root_len || memcmp(root, index->root, root_len) != 0)
+        goto discard;
+
+    while(r.pos < r.end) {
+        if(index->record_count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            struct index_record *records = (struct index_record*)realloc(index->records,
+                    capacity * sizeof(*records));
+            if(records == NULL)
+                goto discard;
+            index->records = records;
+        }
+
+        if(!parse_record(&r, &index->records[index->record_count]))
+            goto discard;
+        index->record_count++;
+    }
+
+    if(index->record_count >= UINT32_MAX / 2)
+        goto discard;
+
+    // nothing to look up, keep the mapping for the empty table
+    if(index->record_count == 0)
+        return;
+
+    // load factor of at most one half
+    size_t slot_count = 2;
+    while(slot_count < index->record_count * 2)
+        slot_count *= 2;
+
+    index->slots = (uint32_t*)calloc(slot_count, sizeof(*index->slots));
+    if(index->slots == NULL)
+        goto discard;
+    index->slot_mask = slot_count - 1;
+
+    for(size_t i = 0; i < index->record_count; i++) {
+        const struct index_record *rec = &index->records[i];
+        size_t slot = hash_path(rec->path, rec->path_len) & index->slot_mask;
+
+        while(index->slots[slot] != 0)
+            slot = (slot + 1) & index->slot_mask;
+        index->slots[slot] = (uint32_t)(i + 1);
+    }
+
+    return;
+
+discard:
+    fprintf(stderr, "finder: ignoring index %s\n", index->index_path);
+    free(index->records);
+    index->records = NULL;
+    index->record_count = 0;
+    munmap(index->map, index->map_len);
+    index->map = NULL;
+    index->map_len = 0;
+}
+
+struct finder_index *finder_index_open(const char *index_path, const char *root,
+        const char *const *patterns, size_t count)
+{
+    struct finder_index *index = (struct finder_index*)calloc(1, sizeof(struct finder_index));
+    if(index == NULL)
+        return NULL;
+
+    atomic_init(&index->updates, NULL);
+
+    index->index_path = strdup(index_path);
+    index->root = strdup(root);
+    index->pattern_count = count;
+    index->key_count = count > 1 ? count + 1 : count;
+    index->keys = (struct index_key*)calloc(index->key_count, sizeof(struct index_key));
+    if(index->index_path == NULL || index->root == NULL || index->keys == NULL)
+        goto error;
+    index->root_len = (uint32_t)strlen(root);
+
+    size_t joined_len = 0;
+    for(size_t i = 0; i < count; i++) {
+        index->keys[i].str = patterns[i];
+        index->keys[i].len = (uint32_t)strlen(patterns[i]);
+        joined_len += index->keys[i].len + 1;
+    }
+
+    // a single pattern matches exactly the lines matching any pattern
+    if(count > 1) {
+        char *pos = index->joined_key = (char*)malloc(joined_len);
+        if(pos == NULL)
+            goto error;
+
+        for(size_t i = 0; i < count; i++) {
+            memcpy(pos, patterns[i], index->keys[i].len);
+            pos += index->keys[i].len;
+            *pos++ = KEY_SEPARATOR;
+        }
+        index->keys[count].str = index->joined_key;
+        index->keys[count].len = (uint32_t)joined_len;
+    }
+
+    load_index(index);
+
+    return index;
+
+error:
+    finder_index_close(index);
+    return NULL;
+}
+
+bool finder_index_lookup(struct finder_index *index, const char *path, const struct stat *st,
+        struct search_result *result)
+{
+    struct index_record *rec = find_record(index, path);
+    uint64_t lines;
+
+    if(rec == NULL || !record_is_current(rec, st))
+        return false;
+
+    memset(result, 0x0, sizeof(*result));
+
+    for(size_t i = 0; i < index->pattern_count; i++) {
+        if(!record_get_key(rec, &index->keys[i], &lines))
+            return false;
+
+        if(lines != 0)
+            result->found_mask |= 1ULL << i;
+        result->lines[i] = lines != BINARY_MATCH ? (unsigned long)lines : 0UL;
+    }
+
+    // with a single pattern this is its own key, which may mark a binary match
+    if(!record_get_key(rec, &index->keys[index->key_count - 1], &lines))
+        return false;
+    result->lines_any = lines != BINARY_MATCH ? (unsigned long)lines : 0UL;
+
+    // every record is looked up by a single job, so there is no race on keep
+    rec->keep = true;
+
+    return true;
+}
+
+/**
+ * Checks whether the serialized key at @param pos is one of the keys of this run
+ * @return true if so, the length of the serialized entry in @param entry_len
+ */
+static bool is_current_key(const struct finder_index *index, const uint8_t *pos, size_t *entry_len)
+{
+    uint32_t len;
+
+    memcpy(&len, pos, sizeof(len));
+    *entry_len = sizeof(len) + len + sizeof(uint64_t);
+
+    for(size_t k = 0; k < index->key_count; k++) {
+        if(index->keys[k].len == len && memcmp(index->keys[k].str, pos + sizeof(len), len) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+void finder_index_store(struct finder_index *index, const char *path, const struct stat *st,
+        const struct search_result *result)
+{
+    const uint32_t path_len = (uint32_t)strlen(path);
+    const uint64_t size = (uint64_t)st->st_size;
+    const int64_t mtime_sec = (int64_t)st->st_mtim.tv_sec;
+    const uint32_t mtime_nsec = (uint32_t)st->st_mtim.tv_nsec;
+    const struct index_record *old = find_record(index, path);
+    uint64_t lines[SEARCH_MAX_PATTERNS + 1];
+    // older keys carried over, as offsets and lengths within the old record
+    const uint8_t *old_keys[FINDER_INDEX_MAX_KEYS];
+    size_t old_lens[FINDER_INDEX_MAX_KEYS];
+    uint32_t old_count = 0;
+    size_t len;
+
+    for(size_t i = 0; i < index->pattern_count; i++) {
+        const bool found = (result->found_mask & (1ULL << i)) != 0;
+        lines[i] = found && result->lines[i] == 0 ? BINARY_MATCH : result->lines[i];
+    }
+    // a single pattern shares its key with the total, which then equals its count
+    if(index->key_count > index->pattern_count)
+        lines[index->key_count - 1] = result->lines_any;
+
+    len = sizeof(path_len) + path_len + sizeof(size) + sizeof(mtime_sec) + sizeof(mtime_nsec) + sizeof(uint32_t);
+    for(size_t i = 0; i < index->key_count; i++)
+        len += sizeof(uint32_t) + index->keys[i].len + sizeof(uint64_t);
+
+    // counts for older search strings stay valid as long as the file is unchanged
+    if(old != NULL && record_is_current(old, st)) {
+        const uint8_t *pos = old->keys;
+
+        for(uint32_t i = 0; i < old->key_count && old_count < FINDER_INDEX_MAX_KEYS; i++) {
+            size_t entry_len;
+
+            if(!is_current_key(index, pos, &entry_len)) {
+                old_keys[old_count] = pos;
+                old_lens[old_count] = entry_len;
+                old_count++;
+                len += entry_len;
+            }
+            pos += entry_len;
+        }
+    }
+
+    struct index_update *update = (struct index_update*)malloc(sizeof(struct index_update) + len);
+    if(update == NULL)
+        return;
+    update->len = len;
+
+    const uint32_t key_count = (uint32_t)index->key_count + old_count;
+    uint8_t *dst = update->data;
+
+    dst = put_bytes(dst, &path_len, sizeof(path_len));
+    dst = put_bytes(dst, path, path_len);
+    dst = put_bytes(dst, &size, sizeof(size));
+    dst = put_bytes(dst, &mtime_sec, sizeof(mtime_sec));
+    dst = put_bytes(dst, &mtime_nsec, sizeof(mtime_nsec));
+    dst = put_bytes(dst, &key_count, sizeof(key_count));
+
+    for(size_t i = 0; i < index->key_count; i++) {
+        dst = put_bytes(dst, &index->keys[i].len, sizeof(index->keys[i].len));
+        dst = put_bytes(dst, index->keys[i].str, index->keys[i].len);
+        dst = put_bytes(dst, &lines[i], sizeof(lines[i]));
+    }
+
+    for(uint32_t i = 0; i < old_count; i++)
+        dst = put_bytes(dst, old_keys[i], old_lens[i]);
+
+    update->next = atomic_load_explicit(&index->updates, memory_order_relaxed);
+    while(!atomic_compare_exchange_weak_explicit(&index->updates, &update->next, update,
+            memory_order_release, memory_order_relaxed))
+        ;
+}
+
+int finder_index_save(struct finder_index *index)
+{
+    const size_t path_len = strlen(index->index_path);
+    char *tmp_path = (char*)malloc(path_len + sizeof(".tmp"));
+    int rc = -1;
+
+    if(tmp_path == NULL)
+        return -1;
+    memcpy(tmp_path, index->index_path, path_len);
+    memcpy(&tmp_path[path_len], ".tmp", sizeof(".tmp"));
+
+    // written next to the index and renamed over it, readers never see a partial index
+    FILE *file = fopen(tmp_path, "we");
+    if(file == NULL)
+        goto out;
+
+    fwrite(INDEX_MAGIC, 1, INDEX_MAGIC_LEN, file);
+    fwrite(&index->root_len, sizeof(index->root_len), 1, file);
+    fwrite(index->root, 1, index->root_len, file);
+
+    for(size_t i = 0; i < index->record_count; i++) {
+        if(index->records[i].keep)
+            fwrite(index->records[i].raw, 1, index->records[i].raw_len, file);
+    }
+
+    for(struct index_update *u = atomic_load(&index->updates); u != NULL; u = u->next)
+        fwrite(u->data, 1, u->len, file);
+
+    if(ferror(file)) {
+        fclose(file);
+        errno = EIO;
+        goto unlink;
+    }
+    if(fclose(file) != 0)
+        goto unlink;
+
+    if(rename(tmp_path, index->index_path) == 0) {
+        rc = 0;
+        goto out;
+    }
+
+unlink:
+    {
+        int saved_errno = errno;
+        unlink(tmp_path);
+        errno = saved_errno;
+    }
+out:
+    free(tmp_path);
+    return rc;
+}
+
+void finder_index_close(struct finder_index *index)
+{
+    struct index_update *u = atomic_load(&index->updates);
+
+    while(u != NULL) {
+        struct index_update *next = u->next;
+        free(u);
+        u = next;
+    }
+
+    if(index->map != NULL)
+        munmap(index->map, index->map_len);
+    free(index->slots);
+    free(index->records);
+    free(index->joined_key);
+    free(index->keys);
+    free(index->root);
+    free(index->index_path);
+    free(index);
+}
@@ -0,0 +1,53 @@
+/*
+ * Persistent index of the native finder, caching the match counts of unchanged files
+ * Author: Heiko Schmidt
+ */
+#ifndef FINDER_INDEX_H
+#define FINDER_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "search.h"
+
+// old search strings kept per file in addition to those of the current run
+#define FINDER_INDEX_MAX_KEYS 16U
+
+struct finder_index;
+
+/**
+ * Loads the index at @param index_path for a search of @param count @param patterns below
+ * @param root.  A missing or unreadable index, or one built for a different root, starts
+ * out empty and is replaced by finder_index_save().
+ * @return the index or NULL on allocation failure
+ */
+extern struct finder_index *finder_index_open(const char *index_path, const char *root,
+        const char *const *patterns, size_t count);
+
+/**
+ * Looks up @param path, which must be unique within the run.  If size and mtime of the
+ * record still match @param st and it holds counts for all patterns, @param result is
+ * filled from it and the record is kept for the next run.
+ * @return true on a hit, false if the file has to be searched
+ */
+extern bool finder_index_lookup(struct finder_index *index, const char *path, const struct stat *st,
+        struct search_result *result);
+
+/**
+ * Records the @param result of searching @param path with attributes @param st, together
+ * with the counts of older search strings if the file did not change.  Thread safe.
+ */
+extern void finder_index_store(struct finder_index *index, const char *path, const struct stat *st,
+        const struct search_result *result);
+
+/**
+ * Replaces the index file with the kept and stored records, files not looked up in this
+ * run are dropped.  Must not race with lookups or stores.
+ * @return 0 on success, -1 with errno set otherwise
+ */
+extern int finder_index_save(struct finder_index *index);
+
+extern void finder_index_close(struct finder_index *index);
+
+#endif /* FINDER_INDEX_H */
@@ -26,6 +26,53 @@ else
 	WRITEDIR=/tmp/aeld-data/$3
 fi
 
+# compares the native finder against the find and grep pipelines of finder.sh,
+# optionally with an index as third argument
+check_native_finder()
+{
+	NATIVE_DIR=$1
+	NATIVE_STR=$2
+	NATIVE_FILES=$(find "$NATIVE_DIR" -type f | wc -l)
+	NATIVE_LINES=$(grep -rF -- "$NATIVE_STR" "$NATIVE_DIR" 2> /dev/null | wc -l)
+	NATIVE_EXPECTED="The number of files are $((NATIVE_FILES)) and the number of matching lines are $((NATIVE_LINES))"
+
+	if [ $# -gt 2 ]; then
+		NATIVE_OUTPUT=$(finder -i "$3" -- "$NATIVE_DIR" "$NATIVE_STR")
+	else
+		NATIVE_OUTPUT=$(finder -- "$NATIVE_DIR" "$NATIVE_STR")
+	fi
+
+	if [ "$NATIVE_OUTPUT" != "$NATIVE_EXPECTED" ]; then
+		echo "failed: native finder for '${NATIVE_STR}' reported ${NATIVE_OUTPUT}, expected ${NATIVE_EXPECTED}"
+		exit 1
+	fi
+}
+
+# compares the per search string counts of the native finder against grep -rlF and
+# grep -rF, which reports binary files as matching but counts none of their lines,
+# optionally with an index as fourth argument
+check_native_patterns()
+{
+	NATIVE_DIR=$1
+	if [ $# -gt 3 ]; then
+		NATIVE_OUTPUT=$(finder -i "$4" -- "$NATIVE_DIR" "$2" "$3")
+	else
+		NATIVE_OUTPUT=$(finder -- "$NATIVE_DIR" "$2" "$3")
+	fi
+
+	for NATIVE_STR in "$2" "$3"
+	do
+		NATIVE_FILES=$(grep -rlF -- "$NATIVE_STR" "$NATIVE_DIR" | wc -l)
+		NATIVE_LINES=$(grep -rF -- "$NATIVE_STR" "$NATIVE_DIR" 2> /dev/null | wc -l)
+		NATIVE_EXPECTED="${NATIVE_STR}: $((NATIVE_FILES)) files, $((NATIVE_LINES)) lines"
+
+		if ! echo "$NATIVE_OUTPUT" | grep -qxF -- "$NATIVE_EXPECTED"; then
+			echo "failed: native finder reported ${NATIVE_OUTPUT}, expected ${NATIVE_EXPECTED}"
+			exit 1
+		fi
+	done
+}
+
 MATCHSTR="The number of files are ${NUMFILES} and the number of matching lines are ${NUMFILES}"
 
 echo "Writing ${NUMFILES} files containing string ${WRITESTR} to ${WRITEDIR}"
@@ -54,10 +101,27 @@ fi
 #make clean
 #make
 
+# all files are written by a single writer process
 for i in $( seq 1 $NUMFILES)
 do
-	writer "$WRITEDIR/${username}$i.txt" "$WRITESTR"
+	printf '%s\0%s\0' "$WRITEDIR/${username}$i.txt" "$WRITESTR"
+done | writer -0 -
+
+# a path given several times keeps its last content, as with one writer call per pair
+REPEATDIR=/tmp/aeld-writer-repeated
+rm -rf "$REPEATDIR"
+for i in $(seq 1 2000)
+do
+	printf '%s/%d/file%d\t%d\n' "$REPEATDIR" $((i % 7)) $((i % 13)) "$i"
+done | writer -j 8 -
+for i in $(seq 1910 2000)
+do
+	if [ "$(cat "$REPEATDIR/$((i % 7))/file$((i % 13))")" != "$i" ]; then
+		echo "failed: writer did not keep the last content ${i} of a repeated path"
+		exit 1
+	fi
 done
+rm -rf "$REPEATDIR"
 
 OUTPUTSTRING=$(finder.sh "$WRITEDIR" "$WRITESTR")
 echo ${OUTPUTSTRING} > ${OUTPUT}
@@ -65,6 +129,56 @@ echo ${OUTPUTSTRING} > ${OUTPUT}
 # remove temporary directories
 rm -rf /tmp/aeld-data
 
+# the native finder must count like the pipelines it replaces, also for binary files,
+# files without trailing newline, empty search strings and with an index reused after
+# files changed
+if command -v finder > /dev/null 2>&1
+then
+	NATIVE_DIR=/tmp/aeld-finder-native
+	NATIVE_INDEX=/tmp/aeld-finder-native.idx
+	rm -rf "$NATIVE_DIR" "$NATIVE_INDEX"
+	mkdir -p "$NATIVE_DIR/a/b" "$NATIVE_DIR/c"
+
+	printf '%s\n%s and %s\nnothing\n' "$WRITESTR" "$WRITESTR" "$WRITESTR" > "$NATIVE_DIR/a/text.txt"
+	printf '%s\000binary\n%s again\n' "$WRITESTR" "$WRITESTR" > "$NATIVE_DIR/a/b/binary.dat"
+	printf 'no trailing newline %s' "$WRITESTR" > "$NATIVE_DIR/c/partial.txt"
+	printf '%s%s\n\n\n' "$WRITESTR" "$WRITESTR" > "$NATIVE_DIR/c/repeated.txt"
+	: > "$NATIVE_DIR/c/empty.txt"
+
+	check_native_finder "$NATIVE_DIR" "$WRITESTR"
+	check_native_finder "$NATIVE_DIR" ""
+	check_native_finder "$NATIVE_DIR" "not contained anywhere"
+	check_native_patterns "$NATIVE_DIR" "$WRITESTR" "binary"
+
+	# search strings looking like options are searched for, also through finder.sh
+	printf -- '-i %s\n' "$WRITESTR" > "$NATIVE_DIR/c/dash.txt"
+	check_native_finder "$NATIVE_DIR" "-i $WRITESTR"
+	if [ "$(finder.sh "$NATIVE_DIR" "-i $WRITESTR")" != "$(finder -- "$NATIVE_DIR" "-i $WRITESTR")" ]; then
+		echo "failed: finder.sh did not pass a search string starting with - to finder"
+		exit 1
+	fi
+
+	# first run fills the index, the second one answers from it
+	check_native_finder "$NATIVE_DIR" "$WRITESTR" "$NATIVE_INDEX"
+	check_native_finder "$NATIVE_DIR" "$WRITESTR" "$NATIVE_INDEX"
+	check_native_patterns "$NATIVE_DIR" "$WRITESTR" "binary" "$NATIVE_INDEX"
+	check_native_patterns "$NATIVE_DIR" "$WRITESTR" "binary" "$NATIVE_INDEX"
+
+	# change a file in size, one keeping its size, remove one and add one
+	echo "$WRITESTR appended" >> "$NATIVE_DIR/a/text.txt"
+	printf 'no trailing newline %s' "$(echo "$WRITESTR" | tr 'A-Za-z' 'a-zA-Z')" > "$NATIVE_DIR/c/partial.txt"
+	touch -d "2020-01-01 00:00:00" "$NATIVE_DIR/c/partial.txt"
+	rm "$NATIVE_DIR/c/repeated.txt"
+	echo "$WRITESTR new" > "$NATIVE_DIR/c/new.txt"
+
+	check_native_finder "$NATIVE_DIR" "$WRITESTR" "$NATIVE_INDEX"
+	check_native_finder "$NATIVE_DIR" "" "$NATIVE_INDEX"
+	check_native_finder "$NATIVE_DIR" "$WRITESTR" "$NATIVE_INDEX"
+
+	rm -rf "$NATIVE_DIR" "$NATIVE_INDEX"
+	echo "native finder matches find and grep"
+fi
+
 set +e
 echo ${OUTPUTSTRING} | grep "${MATCHSTR}"
 if [ $? -eq 0 ]; then
@@ -0,0 +1,303 @@
+/*
+ * Counts the files below a directory and the lines in them containing a search string,
+ * a single pass replacement for the find | wc and grep -rF pipelines of finder.sh.
+ * Directories are walked in parallel on a work-stealing thread pool and files are
+ * searched through mmap.
+ *
+ * Usage: finder [-i <index>] [--] <dir> <searchstr> [searchstr...]
+ * With several search strings, all of them are searched in the same pass and the number
+ * of files and lines is reported for each of them after the summary line.
+ * As with grep, a binary file, one containing NUL bytes, counts for the files of a search
+ * string it contains, like with grep -l, but none of its lines are counted.
+ * With -i, the counts of every file are cached in the given index file together with its
+ * size and mtime, and only new or changed files are searched on the next run.
+ * Author: Heiko Schmidt
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "threadpool.h"
+#include "search.h"
+#include "finder-index.h"
+
+#define DEQUE_CAPACITY 4096U
+
+typedef struct finder_s
+{
+    struct threadpool *pool;
+    struct search_set *set;
+    size_t pattern_count;
+    // optional, NULL without -i
+    struct finder_index *index;
+
+    atomic_ulong file_count;
+    atomic_ulong line_count;
+    // per pattern number of files and lines containing it
+    atomic_ulong pattern_files[SEARCH_MAX_PATTERNS];
+    atomic_ulong pattern_lines[SEARCH_MAX_PATTERNS];
+
+    // tasks not yet completed, main waits for it to drop to zero
+    atomic_ulong pending;
+    pthread_mutex_t done_mutex;
+    pthread_cond_t done_cond;
+} finder_t;
+
+typedef struct finder_job_s
+{
+    struct threadpool_task task;
+    finder_t *finder;
+    bool is_dir;
+    char path[];
+} finder_job_t;
+
+static finder_t finder;
+
+static void add_result(finder_t *f, const struct search_result *result)
+{
+    atomic_fetch_add(&f->line_count, result->lines_any);
+
+    for(size_t i = 0; i < f->pattern_count; i++) {
+        if(result->found_mask & (1ULL << i)) {
+            atomic_fetch_add(&f->pattern_files[i], 1);
+            atomic_fetch_add(&f->pattern_lines[i], result->lines[i]);
+        }
+    }
+}
+
+static void search_file(finder_t *f, const char *path)
+{
+    struct stat st;
+    struct search_result result;
+
+    atomic_fetch_add(&f->file_count, 1);
+
+    // unchanged files are answered from the index without opening them
+    if(f->index != NULL && stat(path, &st) == 0 && finder_index_lookup(f->index, path, &st, &result)) {
+        add_result(f, &result);
+        return;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    if(fstat(fd, &st) < 0) {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return;
+    }
+
+    if(st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED) {
+            fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+            close(fd);
+            return;
+        }
+
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+        search_buffer(f->set, (const char*)data, st.st_size, &result);
+        munmap(data, st.st_size);
+    } else {
+        memset(&result, 0x0, sizeof(result));
+    }
+
+    add_result(f, &result);
+
+    // stat was taken before reading, a file modified meanwhile is searched again next time
+    if(f->index != NULL)
+        finder_index_store(f->index, path, &st, &result);
+
+    close(fd);
+}
+
+static void job_done(finder_t *f)
+{
+    if(atomic_fetch_sub(&f->pending, 1) == 1) {
+        pthread_mutex_lock(&f->done_mutex);
+        pthread_cond_signal(&f->done_cond);
+        pthread_mutex_unlock(&f->done_mutex);
+    }
+}
+
+static bool run_job(void *arg);
+
+static void submit_job(finder_t *f, const char *dir, const char *name, bool is_dir)
+{
+    const size_t dir_len = strlen(dir);
+    const size_t name_len = strlen(name);
+
+    finder_job_t *job = (finder_job_t*)malloc(sizeof(finder_job_t) + dir_len + name_len + 2);
+    if(job == NULL) {
+        fprintf(stderr, "finder: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(job->path, dir, dir_len);
+    job->path[dir_len] = '/';
+    memcpy(&job->path[dir_len + 1], name, name_len + 1);
+
+    job->finder = f;
+    job->is_dir = is_dir;
+    memset(&job->task, 0x0, sizeof(job->task));
+    job->task.fn = run_job;
+    job->task.arg = job;
+
+    atomic_fetch_add(&f->pending, 1);
+
+    // all deques full, do the work on this thread
+    if(!threadpool_submit(f->pool, &job->task))
+        run_job(job);
+}
+
+static void walk_dir(finder_t *f, const char *path)
+{
+    DIR *dir = opendir(path);
+    struct dirent *e;
+
+    if(dir == NULL) {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    while((e = readdir(dir)) != NULL) {
+        unsigned char type = e->d_type;
+
+        if(strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+            continue;
+
+        // like find -type f and grep -r, symbolic links are not followed
+        if(type == DT_UNKNOWN) {
+            struct stat st;
+            if(fstatat(dirfd(dir), e->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+
+        if(type == DT_DIR)
+            submit_job(f, path, e->d_name, true);
+        else if(type == DT_REG)
+            submit_job(f, path, e->d_name, false);
+    }
+
+    closedir(dir);
+}
+
+static bool run_job(void *arg)
+{
+    finder_job_t *job = (finder_job_t*)arg;
+    finder_t *f = job->finder;
+
+    if(job->is_dir)
+        walk_dir(f, job->path);
+    else
+        search_file(f, job->path);
+
+    free(job);
+    job_done(f);
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    struct stat st;
+    const char *index_path = NULL;
+    int opt;
+
+    while((opt = getopt(argc, argv, "i:")) != -1) {
+        if(opt == 'i') {
+            index_path = optarg;
+        } else {
+            printf("Usage: %s [-i index] [--] <dir> <searchstr> [searchstr...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // check if sufficient parameters have been provided
+    if(argc - optind < 2) {
+        printf("Please provide path and string to search for\n");
+        return 1;
+    }
+
+    const char *filesdir = argv[optind];
+    char **patterns = &argv[optind + 1];
+
+    if(stat(filesdir, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        printf("%s is not a directory\n", filesdir);
+        return 1;
+    }
+
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if(workers < 1)
+        workers = 1;
+
+    finder.pattern_count = (size_t)(argc - optind - 1);
+    finder.set = search_set_create((const char *const *)patterns, finder.pattern_count);
+    if(finder.set == NULL) {
+        printf("Invalid search strings, at most %u without newlines are supported\n", SEARCH_MAX_PATTERNS);
+        return 1;
+    }
+
+    if(index_path != NULL) {
+        finder.index = finder_index_open(index_path, filesdir, (const char *const *)patterns, finder.pattern_count);
+        if(finder.index == NULL) {
+            printf("Failed to open index %s\n", index_path);
+            return 1;
+        }
+    }
+    pthread_mutex_init(&finder.done_mutex, NULL);
+    pthread_cond_init(&finder.done_cond, NULL);
+
+    finder.pool = threadpool_create((size_t)workers, DEQUE_CAPACITY);
+    if(finder.pool == NULL) {
+        printf("Failed to start worker threads\n");
+        return 1;
+    }
+
+    // the root directory is walked here, everything below by the pool
+    atomic_store(&finder.pending, 1);
+    walk_dir(&finder, filesdir);
+    job_done(&finder);
+
+    pthread_mutex_lock(&finder.done_mutex);
+    while(atomic_load(&finder.pending) != 0)
+        pthread_cond_wait(&finder.done_cond, &finder.done_mutex);
+    pthread_mutex_unlock(&finder.done_mutex);
+
+    threadpool_destroy(finder.pool);
+
+    // a failed save only costs the next run a full search
+    if(finder.index != NULL) {
+        if(finder_index_save(finder.index) < 0)
+            fprintf(stderr, "finder: %s: %s\n", index_path, strerror(errno));
+        finder_index_close(finder.index);
+    }
+
+    printf("The number of files are %lu and the number of matching lines are %lu\n",
+            atomic_load(&finder.file_count), atomic_load(&finder.line_count));
+
+    if(finder.pattern_count > 1) {
+        for(size_t i = 0; i < finder.pattern_count; i++)
+            printf("%s: %lu files, %lu lines\n", patterns[i],
+                    atomic_load(&finder.pattern_files[i]), atomic_load(&finder.pattern_lines[i]));
+    }
+
+    search_set_destroy(finder.set);
+
+    return 0;
+}
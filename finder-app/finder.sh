@@ -7,7 +7,7 @@ set -u
 
 # check if sufficient parameters have been provided
 if [ $# -lt 2 ]; then
-	echo "Please provide path and string to write"
+	echo "Please provide path and string to search for"
 	exit 1
 fi
 
@@ -20,6 +20,15 @@ if [ ! -d "$FILESDIR" ]; then
 	exit 1
 fi
 
+# prefer the native finder, which counts both in a single pass
+# and with FINDER_INDEX set only searches files changed since the last run
+if command -v finder > /dev/null 2>&1; then
+	if [ -n "${FINDER_INDEX:-}" ]; then
+		exec finder -i "$FINDER_INDEX" -- "$FILESDIR" "$SEARCHSTR"
+	fi
+	exec finder -- "$FILESDIR" "$SEARCHSTR"
+fi
+
 # get the number of files recursively using find and wc to count lines
 FILECOUNT=$(find "$FILESDIR" -type f | wc -l)
 if [ $? -ne 0 ]; then
@@ -28,7 +37,7 @@ if [ $? -ne 0 ]; then
 fi
 
 # recursively get files with matching string and count as above
-STRINGCOUNT=$(grep -rF "${SEARCHSTR}" "${FILESDIR}" | wc -l)
+STRINGCOUNT=$(grep -rF -- "${SEARCHSTR}" "${FILESDIR}" | wc -l)
 if [ $? -ne 0 ]; then
 	echo "Failed to grep files"
 	exit 1
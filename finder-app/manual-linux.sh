@@ -132,6 +132,7 @@ cp ${FINDER_APP_DIR}/conf ${TARGET} -r
 cp ${FINDER_APP_DIR}/conf/ ${ROOTFS} -r
 cp ${FINDER_APP_DIR}/finder.sh ${TARGET}
 cp ${FINDER_APP_DIR}/writer ${TARGET}
+cp ${FINDER_APP_DIR}/finder ${TARGET}
 cp ${FINDER_APP_DIR}/autorun-qemu.sh ${TARGET}
 
 # TODO: Chown the root directory
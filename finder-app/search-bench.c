@@ -0,0 +1,131 @@
+/*
+ * Throughput benchmark of the finder search kernel on a synthetic corpus
+ *
+ * Generates text lines of pseudo random words with some search strings mixed in and
+ * searches them with 1, 4 and 16 patterns for every supported prefilter implementation.
+ * Prints one JSON object per measurement.
+ *
+ * Usage: search-bench [corpus_mb] [rounds]
+ * Author: Heiko Schmidt
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "search.h"
+
+#define DEFAULT_CORPUS_MB 64UL
+#define DEFAULT_ROUNDS 5UL
+#define NSEC_PER_SEC 1000000000ULL
+#define WORDS_PER_LINE 10U
+#define NEEDLE_EVERY_LINES 1000U
+
+static const char *const words[] = {
+    "timestamp", "server", "socket", "packet", "thread", "buffer", "kernel", "driver",
+    "module", "device", "write", "read", "offset", "entry", "circular", "string",
+};
+
+static const char *const patterns[] = {
+    "AELD_IS_FUN", "segfault", "0xdeadbeef", "Oops", "panic", "BUG:", "warning", "refused",
+    "timeout", "overrun", "ENOMEM", "EAGAIN", "EPIPE", "unaligned", "zombie", "quux",
+};
+
+static const size_t pattern_counts[] = { 1, 4, 16 };
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + (unsigned long long)ts.tv_nsec;
+}
+
+static char *make_corpus(size_t size)
+{
+    char *corpus = (char*)malloc(size);
+    unsigned int seed = 42;
+    unsigned long line = 0;
+    size_t pos = 0;
+
+    if(corpus == NULL)
+        return NULL;
+
+    while(pos < size) {
+        char buf[256];
+        int len = 0;
+
+        for(unsigned int w = 0; w < WORDS_PER_LINE; w++) {
+            const char *word = words[rand_r(&seed) % (sizeof(words) / sizeof(words[0]))];
+            len += snprintf(&buf[len], sizeof(buf) - len, "%s ", word);
+        }
+
+        // make sure every pattern occurs now and then
+        if(++line % NEEDLE_EVERY_LINES == 0)
+            len += snprintf(&buf[len], sizeof(buf) - len, "%s",
+                    patterns[(line / NEEDLE_EVERY_LINES) % (sizeof(patterns) / sizeof(patterns[0]))]);
+        buf[len++] = '\n';
+
+        const size_t n = pos + len <= size ? (size_t)len : size - pos;
+        memcpy(&corpus[pos], buf, n);
+        pos += n;
+    }
+
+    return corpus;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *const impls[] = { "avx2", "sse2", "neon", "scalar" };
+    unsigned long corpus_mb = DEFAULT_CORPUS_MB;
+    unsigned long rounds = DEFAULT_ROUNDS;
+
+    if(argc > 1)
+        corpus_mb = strtoul(argv[1], NULL, 10);
+    if(argc > 2)
+        rounds = strtoul(argv[2], NULL, 10);
+
+    if(corpus_mb == 0 || rounds == 0) {
+        fprintf(stderr, "Usage: %s [corpus_mb] [rounds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const size_t size = corpus_mb << 20;
+    char *corpus = make_corpus(size);
+    if(corpus == NULL) {
+        fprintf(stderr, "Unable to allocate corpus\n");
+        return EXIT_FAILURE;
+    }
+
+    for(size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        const char *impl = search_select_impl(impls[i]);
+        if(impl == NULL)
+            continue;
+
+        for(size_t j = 0; j < sizeof(pattern_counts) / sizeof(pattern_counts[0]); j++) {
+            struct search_set *set = search_set_create(patterns, pattern_counts[j]);
+            struct search_result result;
+
+            if(set == NULL) {
+                fprintf(stderr, "Unable to compile patterns\n");
+                return EXIT_FAILURE;
+            }
+
+            const unsigned long long start = now_ns();
+            for(unsigned long r = 0; r < rounds; r++)
+                search_buffer(set, corpus, size, &result);
+            const unsigned long long elapsed = now_ns() - start;
+
+            printf("{\"bench\":\"search\",\"impl\":\"%s\",\"patterns\":%zu,\"bytes\":%zu,\"rounds\":%lu,"
+                    "\"lines\":%lu,\"total_ns\":%llu,\"gb_per_s\":%.3f}\n",
+                    impl, pattern_counts[j], size, rounds, result.lines_any, elapsed,
+                    elapsed > 0 ? (double)size * rounds / elapsed : 0.0);
+
+            search_set_destroy(set);
+        }
+    }
+
+    free(corpus);
+
+    return EXIT_SUCCESS;
+}
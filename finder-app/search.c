@@ -0,0 +1,409 @@
+/*
+ * Multi-pattern fixed string search used by the native finder
+ *
+ * The patterns are compiled into an Aho-Corasick DFA, so every byte is inspected once
+ * independent of the number of patterns.  While the automaton is in its root state, a
+ * SIMD prefilter skips ahead to the next position matching the first two bytes of a pattern.
+ * Author: Heiko Schmidt
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEARCH_HAVE_AVX2 1
+#endif
+
+#include "search.h"
+
+#define ALPHABET_SIZE 256U
+
+// prefixes compared by the vector prefilters, larger sets fall back to a table lookup
+#define PREFILTER_MAX_PREFIXES 16U
+
+#define ROOT_STATE 0U
+#define OUTPUT_FLAG 0x80000000U
+
+/*
+ * Set of two byte pattern prefixes.  A position is a candidate if its byte and the following
+ * one form one of the prefixes, which filters far better than the first byte alone.
+ * Single byte entries accept any second byte.
+ */
+struct prefix_set
+{
+    uint8_t first[PREFILTER_MAX_PREFIXES];
+    uint8_t second[PREFILTER_MAX_PREFIXES];
+    // 0xff if the second byte is not compared
+    uint8_t any_second[PREFILTER_MAX_PREFIXES];
+    unsigned int count;
+    // more prefixes than fit into the arrays, only the table is complete
+    bool overflow;
+    // bit b of table[a] is set for every prefix a, b, all bits for single byte entries
+    uint64_t table[ALPHABET_SIZE][ALPHABET_SIZE / 64];
+};
+
+typedef size_t (*skip_fn_t)(const uint8_t *data, size_t pos, size_t end, const struct prefix_set *set);
+
+struct search_set
+{
+    size_t pattern_count;
+    size_t state_count;
+    // bytes not used in any pattern share class 0, keeping the DFA small enough for the cache
+    uint8_t byte_class[ALPHABET_SIZE];
+    size_t class_count;
+    // DFA transitions, state_count * class_count entries.  Targets are stored as offsets of
+    // their row, with OUTPUT_FLAG set if patterns end in the target state.
+    uint32_t *next;
+    // patterns ending in each state, including those reached through failure links
+    uint64_t *out;
+    // patterns which are empty and match every line
+    uint64_t match_all;
+
+    bool use_prefilter;
+    struct prefix_set prefixes;
+    // same with the newline added, used once the current line matched
+    struct prefix_set prefixes_nl;
+};
+
+static skip_fn_t skip_impl;
+
+static size_t skip_scalar(const uint8_t *data, size_t pos, size_t end, const struct prefix_set *set)
+{
+    for(; pos + 1 < end; pos++) {
+        const uint8_t second = data[pos + 1];
+        if((set->table[data[pos]][second / 64] >> (second % 64)) & 1U)
+            return pos;
+    }
+
+    // the last byte has no successor, it is a candidate if any prefix starts with it
+    if(pos < end) {
+        const uint64_t *row = set->table[data[pos]];
+        if((row[0] | row[1] | row[2] | row[3]) == 0)
+            pos++;
+    }
+
+    return pos;
+}
+
+// 16 byte vectors, compiled to SSE2 on x86 and NEON on aarch64
+typedef uint8_t v16u8 __attribute__((vector_size(16), aligned(1)));
+typedef uint64_t v2u64 __attribute__((vector_size(16), aligned(1)));
+
+static size_t skip_vec128(const uint8_t *data, size_t pos, size_t end, const struct prefix_set *set)
+{
+    v16u8 first[PREFILTER_MAX_PREFIXES];
+    v16u8 second[PREFILTER_MAX_PREFIXES];
+    v16u8 any_second[PREFILTER_MAX_PREFIXES];
+
+    if(set->overflow)
+        return skip_scalar(data, pos, end, set);
+
+    for(unsigned int i = 0; i < set->count; i++) {
+        first[i] = (v16u8){0} + set->first[i];
+        second[i] = (v16u8){0} + set->second[i];
+        any_second[i] = (v16u8){0} + set->any_second[i];
+    }
+
+    for(; pos + 17 <= end; pos += 16) {
+        v16u8 block0;
+        v16u8 block1;
+        v16u8 eq = (v16u8){0};
+
+        memcpy(&block0, &data[pos], 16);
+        memcpy(&block1, &data[pos + 1], 16);
+        for(unsigned int i = 0; i < set->count; i++)
+            eq |= (v16u8)(block0 == first[i]) & ((v16u8)(block1 == second[i]) | any_second[i]);
+
+        const v2u64 any = (v2u64)eq;
+        if((any[0] | any[1]) == 0)
+            continue;
+
+        for(unsigned int lane = 0; lane < 16; lane++) {
+            if(eq[lane])
+                return pos + lane;
+        }
+    }
+
+    return skip_scalar(data, pos, end, set);
+}
+
+#ifdef SEARCH_HAVE_AVX2
+__attribute__((target("avx2")))
+static size_t skip_avx2(const uint8_t *data, size_t pos, size_t end, const struct prefix_set *set)
+{
+    __m256i first[PREFILTER_MAX_PREFIXES];
+    __m256i second[PREFILTER_MAX_PREFIXES];
+    __m256i any_second[PREFILTER_MAX_PREFIXES];
+
+    if(set->overflow)
+        return skip_scalar(data, pos, end, set);
+
+    for(unsigned int i = 0; i < set->count; i++) {
+        first[i] = _mm256_set1_epi8((char)set->first[i]);
+        second[i] = _mm256_set1_epi8((char)set->second[i]);
+        any_second[i] = _mm256_set1_epi8((char)set->any_second[i]);
+    }
+
+    for(; pos + 33 <= end; pos += 32) {
+        const __m256i block0 = _mm256_loadu_si256((const __m256i*)&data[pos]);
+        const __m256i block1 = _mm256_loadu_si256((const __m256i*)&data[pos + 1]);
+        __m256i eq = _mm256_setzero_si256();
+
+        for(unsigned int i = 0; i < set->count; i++) {
+            const __m256i match_second = _mm256_or_si256(_mm256_cmpeq_epi8(block1, second[i]), any_second[i]);
+            eq = _mm256_or_si256(eq, _mm256_and_si256(_mm256_cmpeq_epi8(block0, first[i]), match_second));
+        }
+
+        const uint32_t mask = (uint32_t)_mm256_movemask_epi8(eq);
+        if(mask != 0)
+            return pos + __builtin_ctz(mask);
+    }
+
+    return skip_vec128(data, pos, end, set);
+}
+#endif
+
+const char *search_select_impl(const char *name)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    const char *vec_name = "sse2";
+#else
+    const char *vec_name = "neon";
+#endif
+
+#ifdef SEARCH_HAVE_AVX2
+    if((name == NULL || strcmp(name, "avx2") == 0) && __builtin_cpu_supports("avx2")) {
+        skip_impl = skip_avx2;
+        return "avx2";
+    }
+#endif
+
+    if(name == NULL || strcmp(name, vec_name) == 0) {
+        skip_impl = skip_vec128;
+        return vec_name;
+    }
+
+    if(strcmp(name, "scalar") == 0) {
+        skip_impl = skip_scalar;
+        return "scalar";
+    }
+
+    return NULL;
+}
+
+/*
+ * Adds the prefix of @param pattern, which must not be empty, to @param set
+ */
+static void prefix_set_add(struct prefix_set *set, const uint8_t *pattern)
+{
+    const uint8_t a = pattern[0];
+    const uint8_t b = pattern[1];
+    const bool single = b == '\0';
+
+    for(unsigned int i = 0; i < set->count; i++) {
+        if(set->first[i] == a && (set->any_second[i] || (!single && set->second[i] == b)))
+            return;
+    }
+
+    if(single)
+        memset(set->table[a], 0xff, sizeof(set->table[a]));
+    else
+        set->table[a][b / 64] |= 1ULL << (b % 64);
+
+    if(set->count == PREFILTER_MAX_PREFIXES) {
+        set->overflow = true;
+        return;
+    }
+
+    set->first[set->count] = a;
+    set->second[set->count] = b;
+    set->any_second[set->count] = single ? 0xff : 0x00;
+    set->count++;
+}
+
+struct search_set *search_set_create(const char *const *patterns, size_t count)
+{
+    size_t max_states = 1;
+
+    if(count == 0 || count > SEARCH_MAX_PATTERNS)
+        return NULL;
+
+    for(size_t i = 0; i < count; i++) {
+        if(strchr(patterns[i], '\n') != NULL)
+            return NULL;
+        max_states += strlen(patterns[i]);
+    }
+
+    struct search_set *set = (struct search_set*)calloc(1, sizeof(struct search_set));
+    if(set == NULL)
+        return NULL;
+
+    set->pattern_count = count;
+
+    set->class_count = 1;
+    for(size_t i = 0; i < count; i++) {
+        for(const uint8_t *p = (const uint8_t*)patterns[i]; *p != '\0'; p++) {
+            if(set->byte_class[*p] == 0)
+                set->byte_class[*p] = (uint8_t)set->class_count++;
+        }
+    }
+
+    set->next = (uint32_t*)calloc(max_states * set->class_count, sizeof(uint32_t));
+    set->out = (uint64_t*)calloc(max_states, sizeof(uint64_t));
+    uint32_t *fail = (uint32_t*)calloc(max_states, sizeof(uint32_t));
+    uint32_t *queue = (uint32_t*)calloc(max_states, sizeof(uint32_t));
+
+    if(set->next == NULL || set->out == NULL || fail == NULL || queue == NULL) {
+        free(fail);
+        free(queue);
+        search_set_destroy(set);
+        return NULL;
+    }
+
+    // build the trie, 0 is used as "no edge" since no edge leads back to the root
+    set->state_count = 1;
+    for(size_t i = 0; i < count; i++) {
+        const uint8_t *p = (const uint8_t*)patterns[i];
+        uint32_t state = ROOT_STATE;
+
+        if(*p == '\0') {
+            set->match_all |= 1ULL << i;
+            continue;
+        }
+
+        prefix_set_add(&set->prefixes, p);
+
+        for(; *p != '\0'; p++) {
+            uint32_t *edge = &set->next[state * set->class_count + set->byte_class[*p]];
+            if(*edge == ROOT_STATE)
+                *edge = (uint32_t)set->state_count++;
+            state = *edge;
+        }
+        set->out[state] |= 1ULL << i;
+    }
+
+    // breadth first, turn the trie into a DFA by resolving missing edges through failure links
+    size_t head = 0;
+    size_t tail = 0;
+
+    for(size_t c = 0; c < set->class_count; c++) {
+        const uint32_t s = set->next[ROOT_STATE * set->class_count + c];
+        if(s != ROOT_STATE) {
+            fail[s] = ROOT_STATE;
+            queue[tail++] = s;
+        }
+    }
+
+    while(head < tail) {
+        const uint32_t state = queue[head++];
+
+        set->out[state] |= set->out[fail[state]];
+
+        for(size_t c = 0; c < set->class_count; c++) {
+            uint32_t *edge = &set->next[state * set->class_count + c];
+            const uint32_t fallback = set->next[fail[state] * set->class_count + c];
+
+            if(*edge == ROOT_STATE) {
+                *edge = fallback;
+            } else {
+                fail[*edge] = fallback;
+                queue[tail++] = *edge;
+            }
+        }
+    }
+
+    // convert to row offsets, which saves a multiplication per byte while searching
+    for(size_t i = 0; i < set->state_count * set->class_count; i++) {
+        const uint32_t target = set->next[i];
+        set->next[i] = (uint32_t)(target * set->class_count) | (set->out[target] != 0 ? OUTPUT_FLAG : 0U);
+    }
+
+    free(fail);
+    free(queue);
+
+    // lines which already matched also stop at the newline
+    set->use_prefilter = set->prefixes.count > 0;
+    set->prefixes_nl = set->prefixes;
+    prefix_set_add(&set->prefixes_nl, (const uint8_t*)"\n");
+
+    if(skip_impl == NULL)
+        search_select_impl(NULL);
+
+    return set;
+}
+
+void search_set_destroy(struct search_set *set)
+{
+    if(set == NULL)
+        return;
+
+    free(set->next);
+    free(set->out);
+    free(set);
+}
+
+static void flush_line(uint64_t line_mask, struct search_result *result)
+{
+    result->lines_any++;
+    result->found_mask |= line_mask;
+
+    while(line_mask != 0) {
+        result->lines[__builtin_ctzll(line_mask)]++;
+        line_mask &= line_mask - 1;
+    }
+}
+
+void search_buffer(const struct search_set *set, const char *data, size_t size, struct search_result *result)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    const uint8_t *const byte_class = set->byte_class;
+    const uint32_t *const next = set->next;
+    const uint64_t *const out = set->out;
+    const size_t class_count = set->class_count;
+    const bool use_prefilter = set->use_prefilter && set->match_all == 0;
+    uint64_t line_mask = set->match_all;
+    // row offset of the current state
+    uint32_t state = ROOT_STATE;
+    size_t pos = 0;
+
+    memset(result, 0x0, sizeof(struct search_result));
+
+    if(size == 0)
+        return;
+
+    // like grep, a binary file matches without any of its lines being counted
+    const bool binary = memchr(data, '\0', size) != NULL;
+
+    while(pos < size) {
+        // only bytes starting a pattern or ending a matched line are of interest in the root state
+        if(state == ROOT_STATE && use_prefilter) {
+            pos = skip_impl(p, pos, size, line_mask != 0 ? &set->prefixes_nl : &set->prefixes);
+            if(pos == size)
+                break;
+        }
+
+        const uint8_t c = p[pos++];
+
+        if(c == '\n') {
+            if(binary)
+                result->found_mask |= line_mask;
+            else if(line_mask != 0)
+                flush_line(line_mask, result);
+            line_mask = set->match_all;
+            state = ROOT_STATE;
+            continue;
+        }
+
+        const uint32_t target = next[state + byte_class[c]];
+        state = target & ~OUTPUT_FLAG;
+        if(target & OUTPUT_FLAG)
+            line_mask |= out[state / class_count];
+    }
+
+    // unterminated last line
+    if(binary)
+        result->found_mask |= line_mask;
+    else if(line_mask != 0 && p[size - 1] != '\n')
+        flush_line(line_mask, result);
+}
@@ -0,0 +1,58 @@
+/*
+ * Multi-pattern fixed string search used by the native finder
+ * Author: Heiko Schmidt
+ */
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// patterns are tracked in a 64 bit mask per line
+#define SEARCH_MAX_PATTERNS 64
+
+/**
+ * Per buffer counts, filled by search_buffer()
+ */
+struct search_result
+{
+    /**
+     * Lines containing at least one of the patterns
+     */
+    unsigned long lines_any;
+    /**
+     * Lines containing pattern i, each line is counted once per pattern
+     */
+    unsigned long lines[SEARCH_MAX_PATTERNS];
+    /**
+     * Bit i is set if pattern i was found anywhere in the buffer
+     */
+    uint64_t found_mask;
+};
+
+struct search_set;
+
+/**
+ * Compiles @param count patterns into an Aho-Corasick automaton.  Patterns must not contain
+ * newlines, an empty pattern matches every line like with grep -F.
+ * @return the compiled set or NULL on invalid patterns or allocation failure
+ */
+extern struct search_set *search_set_create(const char *const *patterns, size_t count);
+
+extern void search_set_destroy(struct search_set *set);
+
+/**
+ * Counts the lines of @param data matching the patterns of @param set.  Data containing
+ * NUL bytes is treated as binary like grep does: the patterns found are set in found_mask,
+ * but no lines are counted.
+ */
+extern void search_buffer(const struct search_set *set, const char *data, size_t size, struct search_result *result);
+
+/**
+ * Selects the prefilter implementation, "avx2", "sse2", "neon" or "scalar", if supported
+ * by the CPU.  NULL selects the best available one, which is also the default.
+ * @return the name of the selected implementation, NULL if @param name is not supported
+ */
+extern const char *search_select_impl(const char *name);
+
+#endif /* SEARCH_H */
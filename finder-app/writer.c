@@ -1,43 +1,145 @@
 /*
  * Writes the given string to a given file
+ *
+ * Usage: writer <file> <string>
+ *    or: writer [-0] [-j workers] [-s] [-d] [-m manifest | -]
+ * The second form is only used if the first argument is one of its options, or - on its
+ * own, so files and strings are written as before otherwise, even if the file name starts
+ * with - or further arguments follow.
+ * The second form writes many files in one process.  It reads path and content pairs from
+ * the manifest or, with -, streams them from stdin.  Each pair is a line of the form
+ * path<TAB>content, where the newline is not written.  With -0, path and content are
+ * NUL terminated instead, so content can contain any byte.  Missing parent directories
+ * are created.
+ * Pairs are collected in batches, which are written by a pool of workers.  Pairs for the
+ * same path always go to the same shard, whose batches are written one after another, so
+ * a path given several times ends up with its last content as with single writes.
+ *   -j  number of workers, defaults to the number of CPUs
+ *   -s  durable writes: the files of a batch are flushed with fdatasync() together,
+ *       along with their directories, before the batch is reported done.  Directories
+ *       created for them are synced along with their parents.
+ *   -d  write with O_DIRECT, bypassing the page cache, if the file system supports it
  * Author: Heiko Schmidt
  */
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <syslog.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
-int main(int argc, char **argv)
+#include "threadpool.h"
+
+// a batch is handed to a worker once either limit is reached
+#define BATCH_RECORDS 64U
+#define BATCH_BYTES (256U * 1024U)
+
+#define READ_CHUNK (64U * 1024U)
+#define DIRECT_ALIGN 4096U
+
+#define DEQUE_CAPACITY 64U
+
+#define BULK_OPTIONS "0j:sdm:"
+#define BULK_OPTION_CHARS "0jsdm"
+
+struct write_batch;
+
+/**
+ * Batches of the paths hashing to one shard, written in the order they were filled
+ */
+struct write_shard
+{
+    // batch being filled by the reader
+    struct write_batch *open;
+    // a batch of this shard is being written, the pending ones follow by the same task
+    bool busy;
+    struct write_batch *pending;
+    struct write_batch *pending_tail;
+};
+
+typedef struct writer_s
+{
+    struct threadpool *pool;
+    bool nul_separated;
+    bool durable;
+    bool direct;
+
+    // failed pairs, any failure makes the exit status 1
+    atomic_ulong failures;
+    atomic_bool direct_unsupported;
+
+    // batches not in use, reused so no memory is allocated per pair
+    pthread_mutex_t free_mutex;
+    pthread_cond_t free_cond;
+    struct write_batch *free_batches;
+    size_t batch_count;
+    size_t max_batches;
+
+    // protects busy and the pending lists of the shards
+    pthread_mutex_t shard_mutex;
+    struct write_shard *shards;
+    size_t shard_count;
+} writer_t;
+
+struct write_record
+{
+    size_t path;
+    size_t content;
+    size_t content_len;
+};
+
+struct write_batch
+{
+    struct threadpool_task task;
+    writer_t *writer;
+    // next batch on the free list or pending in the shard
+    struct write_batch *next;
+    size_t shard;
+
+    struct write_record records[BATCH_RECORDS];
+    size_t count;
+    // paths and contents of the records, paths are NUL terminated
+    char *data;
+    size_t used;
+    size_t capacity;
+
+    // aligned copy of the content for O_DIRECT
+    char *direct_buf;
+    size_t direct_capacity;
+
+    // files written but not yet flushed in durable mode, with their record
+    int fds[BATCH_RECORDS];
+    size_t fd_records[BATCH_RECORDS];
+    size_t fd_count;
+};
+
+static int write_single(const char *path, const char *str)
 {
     int ret = 0;
     FILE *f = NULL;
 
-    openlog(NULL, 0, LOG_USER);
-    
-    // ensure arguments are there
-    if (argc < 3) {
-        syslog(LOG_ERR, "Please provide path and string as parameters");
-        ret = 1;
-        goto cleanup;
-    }
-
     // debug parameter output to syslog
-    syslog(LOG_DEBUG, "Writing %s to %s", argv[2], argv[1]);
+    syslog(LOG_DEBUG, "Writing %s to %s", str, path);
 
     // open the file
-    f = fopen(argv[1], "w");
+    f = fopen(path, "w");
     if (f == NULL) {
         syslog(LOG_ERR, "Error opening file: %s", strerror(errno));
-        ret = 1;
-        goto cleanup;
+        return 1;
     }
 
     // write to file
-    if(fprintf(f, "%s", argv[2]) < 0) {
+    if(fprintf(f, "%s", str) < 0) {
         syslog(LOG_ERR, "Error writing to file: %s", strerror(errno));
         ret = 1;
-        goto cleanup;
     }
 
     // close the file
@@ -46,7 +148,651 @@ int main(int argc, char **argv)
         ret = 1;
     }
 
+    return ret;
+}
+
+/**
+ * Syncs the directory containing @param path
+ */
+static int sync_parent_dir(const char *path)
+{
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    const size_t dir_len = slash != NULL ? (size_t)(slash - path) : 0;
+
+    if(dir_len >= sizeof(dir)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if(dir_len > 0) {
+        memcpy(dir, path, dir_len);
+        dir[dir_len] = '\0';
+    } else {
+        strcpy(dir, slash != NULL ? "/" : ".");
+    }
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0)
+        return -1;
+
+    const int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+/**
+ * Creates the missing parent directories of @param path, like mkdir -p.  In durable mode
+ * the parent of each created directory is synced, so the new entries survive a crash.
+ */
+static int make_parents(const writer_t *w, const char *path)
+{
+    char dir[PATH_MAX];
+    const size_t len = strlen(path);
+
+    if(len >= sizeof(dir)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(dir, path, len + 1);
+
+    for(char *p = strchr(dir + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        if(mkdir(dir, 0755) == 0) {
+            // the entries of the new directory itself are synced with the next one, or
+            // with the file by flush_batch()
+            if(w->durable && sync_parent_dir(dir) < 0)
+                return -1;
+        } else if(errno != EEXIST) {
+            return -1;
+        }
+        *p = '/';
+    }
+
+    return 0;
+}
+
+static int open_target(writer_t *w, const char *path)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    if(w->direct && !atomic_load_explicit(&w->direct_unsupported, memory_order_relaxed))
+        flags |= O_DIRECT;
+
+    int fd = open(path, flags, 0644);
+    if(fd < 0 && errno == ENOENT && make_parents(w, path) == 0)
+        fd = open(path, flags, 0644);
+
+    // tmpfs and others reject O_DIRECT, fall back to buffered writes for the rest
+    if(fd < 0 && errno == EINVAL && (flags & O_DIRECT)) {
+        if(!atomic_exchange(&w->direct_unsupported, true))
+            syslog(LOG_WARNING, "O_DIRECT not supported for %s, using buffered writes", path);
+        fd = open(path, flags & ~O_DIRECT, 0644);
+    }
+
+    return fd;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while(len > 0) {
+        ssize_t rc = write(fd, buf, len);
+        if(rc < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += rc;
+        len -= (size_t)rc;
+    }
+
+    return 0;
+}
+
+/**
+ * Writes @param len bytes through the aligned buffer of @param batch.  The length is padded
+ * to the alignment O_DIRECT requires and the file truncated back afterwards.
+ */
+static int write_direct(struct write_batch *batch, int fd, const char *content, size_t len)
+{
+    const size_t padded = (len + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+
+    if(padded > batch->direct_capacity) {
+        void *buf;
+        if(posix_memalign(&buf, DIRECT_ALIGN, padded) != 0) {
+            errno = ENOMEM;
+            return -1;
+        }
+        free(batch->direct_buf);
+        batch->direct_buf = (char*)buf;
+        batch->direct_capacity = padded;
+    }
+
+    memcpy(batch->direct_buf, content, len);
+    memset(&batch->direct_buf[len], 0x0, padded - len);
+
+    if(write_all(fd, batch->direct_buf, padded) < 0)
+        return -1;
+
+    return padded != len ? ftruncate(fd, (off_t)len) : 0;
+}
+
+/**
+ * Flushes the files written so far by @param batch and the directories containing them.
+ * Consecutive files in the same directory sync it only once.
+ */
+static void flush_batch(struct write_batch *batch)
+{
+    writer_t *w = batch->writer;
+    const char *last_dir = NULL;
+    size_t last_dir_len = 0;
+
+    for(size_t i = 0; i < batch->fd_count; i++) {
+        if(fdatasync(batch->fds[i]) < 0) {
+            syslog(LOG_ERR, "Error syncing %s: %s", &batch->data[batch->records[batch->fd_records[i]].path],
+                    strerror(errno));
+            atomic_fetch_add(&w->failures, 1);
+        }
+        close(batch->fds[i]);
+    }
+
+    for(size_t i = 0; i < batch->fd_count; i++) {
+        const char *path = &batch->data[batch->records[batch->fd_records[i]].path];
+        const char *slash = strrchr(path, '/');
+        // up to and including the slash, so "x" and "/x" differ
+        const size_t dir_len = slash != NULL ? (size_t)(slash - path) + 1 : 0;
+
+        if(last_dir != NULL && dir_len == last_dir_len && memcmp(path, last_dir, dir_len) == 0)
+            continue;
+        last_dir = path;
+        last_dir_len = dir_len;
+
+        if(sync_parent_dir(path) < 0) {
+            syslog(LOG_ERR, "Error syncing the directory of %s: %s", path, strerror(errno));
+            atomic_fetch_add(&w->failures, 1);
+        }
+    }
+
+    batch->fd_count = 0;
+}
+
+static void write_record(struct write_batch *batch, size_t i)
+{
+    writer_t *w = batch->writer;
+    const struct write_record *rec = &batch->records[i];
+    const char *path = &batch->data[rec->path];
+    const char *content = &batch->data[rec->content];
+
+    int fd = open_target(w, path);
+    // out of descriptors while holding files for the durable flush, flush early
+    if(fd < 0 && errno == EMFILE && batch->fd_count > 0) {
+        flush_batch(batch);
+        fd = open_target(w, path);
+    }
+    if(fd < 0) {
+        syslog(LOG_ERR, "Error opening file %s: %s", path, strerror(errno));
+        atomic_fetch_add(&w->failures, 1);
+        return;
+    }
+
+    int rc;
+    if(rec->content_len > 0 && (fcntl(fd, F_GETFL) & O_DIRECT))
+        rc = write_direct(batch, fd, content, rec->content_len);
+    else
+        rc = write_all(fd, content, rec->content_len);
+
+    if(rc < 0) {
+        syslog(LOG_ERR, "Error writing to file %s: %s", path, strerror(errno));
+        atomic_fetch_add(&w->failures, 1);
+        close(fd);
+        return;
+    }
+
+    if(!w->durable) {
+        if(close(fd) != 0) {
+            syslog(LOG_ERR, "Error closing file %s: %s", path, strerror(errno));
+            atomic_fetch_add(&w->failures, 1);
+        }
+        return;
+    }
+
+    // start writeback now so the flush at the end of the batch mostly waits for it
+    sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+
+    batch->fds[batch->fd_count] = fd;
+    batch->fd_records[batch->fd_count] = i;
+    batch->fd_count++;
+}
+
+static void release_batch(struct write_batch *batch)
+{
+    writer_t *w = batch->writer;
+
+    batch->count = 0;
+    batch->used = 0;
+
+    pthread_mutex_lock(&w->free_mutex);
+    batch->next = w->free_batches;
+    w->free_batches = batch;
+    pthread_cond_broadcast(&w->free_cond);
+    pthread_mutex_unlock(&w->free_mutex);
+}
+
+/**
+ * Writes @param arg and then the batches queued behind it in its shard
+ */
+static bool run_batch(void *arg)
+{
+    struct write_batch *batch = (struct write_batch*)arg;
+    writer_t *w = batch->writer;
+
+    while(batch != NULL) {
+        struct write_shard *shard = &w->shards[batch->shard];
+        struct write_batch *next;
+
+        for(size_t i = 0; i < batch->count; i++)
+            write_record(batch, i);
+
+        if(batch->fd_count > 0)
+            flush_batch(batch);
+
+        pthread_mutex_lock(&w->shard_mutex);
+        next = shard->pending;
+        if(next != NULL) {
+            shard->pending = next->next;
+            if(shard->pending == NULL)
+                shard->pending_tail = NULL;
+        } else {
+            shard->busy = false;
+        }
+        pthread_mutex_unlock(&w->shard_mutex);
+
+        release_batch(batch);
+        batch = next;
+    }
+
+    return true;
+}
+
+static struct write_batch *get_batch(writer_t *w)
+{
+    struct write_batch *batch = NULL;
+
+    pthread_mutex_lock(&w->free_mutex);
+    while(w->free_batches == NULL && w->batch_count == w->max_batches)
+        pthread_cond_wait(&w->free_cond, &w->free_mutex);
+
+    if(w->free_batches != NULL) {
+        batch = w->free_batches;
+        w->free_batches = batch->next;
+    } else {
+        batch = (struct write_batch*)calloc(1, sizeof(struct write_batch));
+        if(batch != NULL) {
+            batch->writer = w;
+            w->batch_count++;
+        }
+    }
+    pthread_mutex_unlock(&w->free_mutex);
+
+    return batch;
+}
+
+static void submit_batch(writer_t *w, struct write_batch *batch)
+{
+    struct write_shard *shard = &w->shards[batch->shard];
+
+    // queued behind the batch of the shard being written, which runs it afterwards
+    pthread_mutex_lock(&w->shard_mutex);
+    if(shard->busy) {
+        batch->next = NULL;
+        if(shard->pending_tail != NULL)
+            shard->pending_tail->next = batch;
+        else
+            shard->pending = batch;
+        shard->pending_tail = batch;
+        pthread_mutex_unlock(&w->shard_mutex);
+        return;
+    }
+    shard->busy = true;
+    pthread_mutex_unlock(&w->shard_mutex);
+
+    memset(&batch->task, 0x0, sizeof(batch->task));
+    batch->task.fn = run_batch;
+    batch->task.arg = batch;
+
+    // all deques full, write on this thread
+    if(!threadpool_submit(w->pool, &batch->task))
+        run_batch(batch);
+}
+
+static bool batch_add(struct write_batch *batch, const char *path, size_t path_len,
+        const char *content, size_t content_len)
+{
+    const size_t needed = batch->used + path_len + 1 + content_len;
+
+    if(needed > batch->capacity) {
+        size_t capacity = batch->capacity ? batch->capacity : BATCH_BYTES;
+        while(capacity < needed)
+            capacity *= 2;
+
+        char *data = (char*)realloc(batch->data, capacity);
+        if(data == NULL)
+            return false;
+        batch->data = data;
+        batch->capacity = capacity;
+    }
+
+    struct write_record *rec = &batch->records[batch->count++];
+
+    rec->path = batch->used;
+    memcpy(&batch->data[batch->used], path, path_len);
+    batch->data[batch->used + path_len] = '\0';
+    batch->used += path_len + 1;
+
+    rec->content = batch->used;
+    rec->content_len = content_len;
+    memcpy(&batch->data[batch->used], content, content_len);
+    batch->used += content_len;
+
+    return true;
+}
+
+/**
+ * FNV-1a hash of @param path, selecting its shard
+ */
+static size_t hash_path(const char *path, size_t path_len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for(size_t i = 0; i < path_len; i++) {
+        hash ^= (unsigned char)path[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return (size_t)hash;
+}
+
+/**
+ * Splits the next pair off @param buf.  At @param eof an unterminated last pair is complete.
+ * @return bytes consumed, 0 if the pair is incomplete
+ */
+static size_t parse_pair(const writer_t *w, const char *buf, size_t len, bool eof,
+        const char **path, size_t *path_len, const char **content, size_t *content_len)
+{
+    const char *end;
+
+    if(w->nul_separated) {
+        const char *sep = (const char*)memchr(buf, '\0', len);
+        if(sep == NULL)
+            return 0;
+        end = (const char*)memchr(sep + 1, '\0', len - (size_t)(sep + 1 - buf));
+        if(end == NULL && !eof)
+            return 0;
+        if(end == NULL)
+            end = buf + len;
+        *path = buf;
+        *path_len = (size_t)(sep - buf);
+        *content = sep + 1;
+        *content_len = (size_t)(end - sep - 1);
+    } else {
+        end = (const char*)memchr(buf, '\n', len);
+        if(end == NULL && !eof)
+            return 0;
+        if(end == NULL)
+            end = buf + len;
+        const char *sep = (const char*)memchr(buf, '\t', (size_t)(end - buf));
+        *path = buf;
+        *path_len = sep != NULL ? (size_t)(sep - buf) : (size_t)(end - buf);
+        *content = sep != NULL ? sep + 1 : end;
+        *content_len = sep != NULL ? (size_t)(end - sep - 1) : 0;
+        // a line without tab has no content separator, reported as invalid below
+        if(sep == NULL && end != buf)
+            *content = NULL;
+    }
+
+    return end < buf + len ? (size_t)(end - buf) + 1 : len;
+}
+
+/**
+ * Streams the pairs read from @param fd into batches, submitting each one when full
+ * @return 0 if all input could be read
+ */
+static int read_pairs(writer_t *w, int fd)
+{
+    size_t capacity = READ_CHUNK;
+    size_t len = 0;
+    bool eof = false;
+    int ret = 0;
+    char *buf = (char*)malloc(capacity);
+
+    if(buf == NULL)
+        return -1;
+
+    while(!eof || len > 0) {
+        if(!eof) {
+            if(len == capacity) {
+                // a single pair larger than the buffer
+                char *grown = (char*)realloc(buf, capacity * 2);
+                if(grown == NULL) {
+                    ret = -1;
+                    break;
+                }
+                buf = grown;
+                capacity *= 2;
+            }
+
+            ssize_t rc = read(fd, &buf[len], capacity - len);
+            if(rc < 0) {
+                if(errno == EINTR)
+                    continue;
+                syslog(LOG_ERR, "Error reading input: %s", strerror(errno));
+                ret = -1;
+                break;
+            }
+            eof = rc == 0;
+            len += (size_t)rc;
+        }
+
+        size_t pos = 0;
+        for(;;) {
+            const char *path, *content;
+            size_t path_len, content_len;
+            size_t consumed = parse_pair(w, &buf[pos], len - pos, eof, &path, &path_len, &content, &content_len);
+
+            if(consumed == 0)
+                break;
+            pos += consumed;
+
+            // empty lines are skipped
+            if(path_len == 0 && content_len == 0 && content != NULL)
+                continue;
+            if(path_len == 0 || content == NULL) {
+                syslog(LOG_ERR, "Invalid input, expected path and content");
+                atomic_fetch_add(&w->failures, 1);
+                continue;
+            }
+
+            const size_t index = hash_path(path, path_len) % w->shard_count;
+            struct write_shard *shard = &w->shards[index];
+            if(shard->open == NULL) {
+                if((shard->open = get_batch(w)) == NULL) {
+                    ret = -1;
+                    break;
+                }
+                shard->open->shard = index;
+            }
+
+            struct write_batch *batch = shard->open;
+            if(!batch_add(batch, path, path_len, content, content_len)) {
+                syslog(LOG_ERR, "Out of memory for %.*s", (int)path_len, path);
+                atomic_fetch_add(&w->failures, 1);
+                continue;
+            }
+            if(batch->count == BATCH_RECORDS || batch->used >= BATCH_BYTES) {
+                submit_batch(w, batch);
+                shard->open = NULL;
+            }
+
+            if(pos == len)
+                break;
+        }
+
+        if(ret < 0)
+            break;
+        memmove(buf, &buf[pos], len - pos);
+        len -= pos;
+
+        // only a NUL separated path without content can be left over
+        if(eof && len > 0 && pos == 0) {
+            syslog(LOG_ERR, "Invalid input, expected path and content");
+            atomic_fetch_add(&w->failures, 1);
+            break;
+        }
+    }
+
+    for(size_t i = 0; i < w->shard_count; i++) {
+        struct write_batch *batch = w->shards[i].open;
+
+        w->shards[i].open = NULL;
+        if(batch == NULL)
+            continue;
+        if(batch->count > 0)
+            submit_batch(w, batch);
+        else
+            release_batch(batch);
+    }
+
+    free(buf);
+    return ret;
+}
+
+static int write_bulk(int argc, char **argv)
+{
+    writer_t w;
+    const char *manifest = NULL;
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    int fd = STDIN_FILENO;
+    int ret = 0;
+
+    memset(&w, 0x0, sizeof(w));
+
+    while((opt = getopt(argc, argv, BULK_OPTIONS)) != -1) {
+        switch(opt) {
+            case '0':
+                w.nul_separated = true;
+                break;
+            case 'j':
+                workers = strtol(optarg, NULL, 10);
+                break;
+            case 's':
+                w.durable = true;
+                break;
+            case 'd':
+                w.direct = true;
+                break;
+            case 'm':
+                manifest = optarg;
+                break;
+            default:
+                syslog(LOG_ERR, "Invalid option");
+                return 1;
+        }
+    }
+
+    if(manifest == NULL && !(optind < argc && strcmp(argv[optind], "-") == 0)) {
+        syslog(LOG_ERR, "Please provide path and string as parameters, or a manifest");
+        return 1;
+    }
+
+    if(manifest != NULL) {
+        fd = open(manifest, O_RDONLY | O_CLOEXEC);
+        if(fd < 0) {
+            syslog(LOG_ERR, "Error opening manifest %s: %s", manifest, strerror(errno));
+            return 1;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    if(workers < 1)
+        workers = 1;
+
+    atomic_init(&w.failures, 0);
+    atomic_init(&w.direct_unsupported, false);
+    pthread_mutex_init(&w.free_mutex, NULL);
+    pthread_cond_init(&w.free_cond, NULL);
+    pthread_mutex_init(&w.shard_mutex, NULL);
+    // enough for every shard to fill a batch while the others are written
+    w.shard_count = (size_t)workers;
+    w.max_batches = (size_t)workers * 2 + 1;
+
+    w.shards = (struct write_shard*)calloc(w.shard_count, sizeof(struct write_shard));
+    if(w.shards == NULL) {
+        syslog(LOG_ERR, "Out of memory for %zu shards", w.shard_count);
+        ret = 1;
+        goto cleanup;
+    }
+
+    w.pool = threadpool_create((size_t)workers, DEQUE_CAPACITY);
+    if(w.pool == NULL) {
+        syslog(LOG_ERR, "Failed to start worker threads");
+        ret = 1;
+        goto cleanup;
+    }
+
+    if(read_pairs(&w, fd) < 0)
+        ret = 1;
+
+    // runs the remaining batches, after which all of them are on the free list
+    threadpool_destroy(w.pool);
+
+    while(w.free_batches != NULL) {
+        struct write_batch *batch = w.free_batches;
+        w.free_batches = batch->next;
+        free(batch->data);
+        free(batch->direct_buf);
+        free(batch);
+    }
+
+    if(atomic_load(&w.failures) > 0) {
+        syslog(LOG_ERR, "Failed to write %lu files", atomic_load(&w.failures));
+        ret = 1;
+    }
+
 cleanup:
+    free(w.shards);
+    pthread_mutex_destroy(&w.shard_mutex);
+    pthread_cond_destroy(&w.free_cond);
+    pthread_mutex_destroy(&w.free_mutex);
+    if(fd != STDIN_FILENO)
+        close(fd);
+    return ret;
+}
+
+/**
+ * @return true if @param arg is one of the options of the bulk mode
+ */
+static bool is_bulk_option(const char *arg)
+{
+    return arg[0] == '-' && arg[1] != '\0' && strchr(BULK_OPTION_CHARS, arg[1]) != NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int ret = 0;
+
+    openlog(NULL, 0, LOG_USER);
+
+    // ensure arguments are there, only an explicit option selects the bulk mode
+    if((argc == 2 && strcmp(argv[1], "-") == 0) || (argc >= 2 && is_bulk_option(argv[1]))) {
+        ret = write_bulk(argc, argv);
+    } else if(argc < 3) {
+        syslog(LOG_ERR, "Please provide path and string as parameters");
+        ret = 1;
+    } else {
+        ret = write_single(argv[1], argv[2]);
+    }
+
     closelog();
     return ret;
-}
\ No newline at end of file
+}
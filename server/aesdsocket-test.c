@@ -0,0 +1,1260 @@
+/*
+ * End-to-end tests of the aesdsocket protocols
+ *
+ * Every test starts the server with its own configuration, talks to it like a client
+ * and stops it again.  Replies and pushed records are compared with the data file, so
+ * timestamps written meanwhile do not matter.  Prints PASS or FAIL with the reason per
+ * test and exits with 1 if any of them failed.
+ * Uses the port, data file and runtime directory of the server, so it must not run at
+ * the same time, and has to run as the user the server runs as.
+ *
+ * Usage: aesdsocket-test [aesdsocket]
+ * Author: Heiko Schmidt
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "frame.h"
+#include "shm-ring.h"
+
+#define DATAFILE "/var/tmp/aesdsocketdata"
+#define CONFIG_PATH "/tmp/aesdsocket-test.conf"
+#define PORT 9000
+#define TIMEOUT_MS 5000
+// a reply is complete once nothing more arrives for this long
+#define QUIET_MS 200
+#define SUBSCRIBE_COMMAND "AESD_SUBSCRIBE\n"
+#define LOCAL_SOCKET "/var/run/aesdsocket/local.sock"
+#define UPGRADE_SOCKET "/var/run/aesdsocket/upgrade.sock"
+
+struct buffer
+{
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+static const char *server_path = "./aesdsocket";
+static const char *current_test;
+
+static int fail(const char *fmt, ...)
+{
+    va_list ap;
+
+    printf("FAIL %s: ", current_test);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+
+    return -1;
+}
+
+static void sleep_ms(unsigned int ms)
+{
+    const struct timespec ts = { .tv_sec = ms / 1000U, .tv_nsec = (long)(ms % 1000U) * 1000000L };
+
+    nanosleep(&ts, NULL);
+}
+
+static void buffer_append(struct buffer *buf, const void *data, size_t len)
+{
+    if (buf->len + len + 1 > buf->size)
+    {
+        buf->size = (buf->len + len + 1) * 2;
+        buf->data = (char *)realloc(buf->data, buf->size);
+        if (buf->data == NULL)
+        {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memcpy(&buf->data[buf->len], data, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+}
+
+static void buffer_reset(struct buffer *buf)
+{
+    buf->len = 0;
+    if (buf->data != NULL)
+        buf->data[0] = '\0';
+}
+
+static void buffer_free(struct buffer *buf)
+{
+    free(buf->data);
+    memset(buf, 0x0, sizeof(*buf));
+}
+
+static bool ends_with(const struct buffer *buf, const char *suffix)
+{
+    const size_t len = strlen(suffix);
+
+    return buf->len >= len && memcmp(&buf->data[buf->len - len], suffix, len) == 0;
+}
+
+static int read_file(const char *path, struct buffer *buf)
+{
+    char chunk[65536];
+    ssize_t n;
+
+    buffer_reset(buf);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+        buffer_append(buf, chunk, (size_t)n);
+
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+/**
+ * Checks that @param received is what the server stored, records stored afterwards may
+ * follow in the data file
+ */
+static int check_prefix_of_file(const struct buffer *received, const char *what)
+{
+    struct buffer file = { 0 };
+    int ret = 0;
+
+    if (read_file(DATAFILE, &file) < 0)
+        ret = fail("%s: cannot read %s: %s", what, DATAFILE, strerror(errno));
+    else if (received->len > file.len || memcmp(received->data, file.data, received->len) != 0)
+        ret = fail("%s: %zu bytes received do not match the %zu bytes of the data file", what,
+                received->len, file.len);
+
+    buffer_free(&file);
+    return ret;
+}
+
+static int send_all(int fd, const void *data, size_t len)
+{
+    const char *pos = (const char *)data;
+
+    while (len > 0)
+    {
+        const ssize_t n = send(fd, pos, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        pos += n;
+        len -= (size_t)n;
+    }
+
+    return 0;
+}
+
+static int send_str(int fd, const char *str)
+{
+    return send_all(fd, str, strlen(str));
+}
+
+/**
+ * Receives into @param buf until nothing arrives for @param idle_ms, or until the
+ * connection is closed
+ * @return 0 once idle, 1 once closed, -1 on errors
+ */
+static int recv_idle(int fd, struct buffer *buf, int idle_ms)
+{
+    char chunk[65536];
+
+    for (;;)
+    {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+
+        const int rc = poll(&pfd, 1, idle_ms);
+        if (rc == 0)
+            return 0;
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        const ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n == 0)
+            return 1;
+        if (n < 0)
+            return errno == EINTR ? 0 : -1;
+        buffer_append(buf, chunk, (size_t)n);
+    }
+}
+
+/**
+ * Receives into @param buf until it ends with @param suffix and no more data follows
+ */
+static int recv_reply(int fd, struct buffer *buf, const char *suffix)
+{
+    struct timespec start, now;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (;;)
+    {
+        const int rc = recv_idle(fd, buf, QUIET_MS);
+        if (rc < 0)
+            return fail("receiving: %s", strerror(errno));
+        if (ends_with(buf, suffix))
+            return 0;
+        if (rc > 0)
+            return fail("connection closed before \"%s\" was received", suffix);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 > TIMEOUT_MS)
+            return fail("no reply ending in \"%s\" within %d ms", suffix, TIMEOUT_MS);
+    }
+}
+
+static int recv_exact(int fd, void *data, size_t len)
+{
+    char *pos = (char *)data;
+
+    while (len > 0)
+    {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+
+        if (poll(&pfd, 1, TIMEOUT_MS) <= 0)
+            return -1;
+
+        const ssize_t n = recv(fd, pos, len, 0);
+        if (n <= 0)
+            return -1;
+        pos += n;
+        len -= (size_t)n;
+    }
+
+    return 0;
+}
+
+static int connect_tcp(void)
+{
+    struct sockaddr_in addr;
+
+    memset(&addr, 0x0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Waits up to TIMEOUT_MS for @param pid to exit
+ * @return the exit status, 128 plus the signal if it was killed, -1 on timeout
+ */
+static int wait_server(pid_t pid)
+{
+    int status;
+
+    for (int waited = 0; waited < TIMEOUT_MS; waited += 10)
+    {
+        const pid_t rc = waitpid(pid, &status, WNOHANG);
+        if (rc == pid)
+            return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        if (rc < 0)
+            return -1;
+        sleep_ms(10);
+    }
+
+    return -1;
+}
+
+static int stop_server(pid_t pid, int sig)
+{
+    kill(pid, sig);
+
+    const int status = wait_server(pid);
+    if (status < 0)
+    {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+
+    return status;
+}
+
+static int write_config(const char *config)
+{
+    FILE *fp = fopen(CONFIG_PATH, "w");
+
+    if (fp == NULL)
+        return -1;
+    fputs(config, fp);
+    return fclose(fp);
+}
+
+/**
+ * Starts the server in the foreground with @param config as configuration file, taking
+ * over the running one with @param upgrade set.  Without, it waits until the server
+ * accepts connections.
+ * @return the pid of the server or -1
+ */
+static pid_t start_server(const char *config, bool upgrade)
+{
+    if (write_config(config) < 0)
+    {
+        fail("cannot write %s: %s", CONFIG_PATH, strerror(errno));
+        return -1;
+    }
+
+    const pid_t pid = fork();
+    if (pid < 0)
+    {
+        fail("fork: %s", strerror(errno));
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        if (upgrade)
+            execl(server_path, server_path, "-c", CONFIG_PATH, "-u", (char *)NULL);
+        else
+            execl(server_path, server_path, "-c", CONFIG_PATH, (char *)NULL);
+        _exit(127);
+    }
+
+    if (upgrade)
+        return pid;
+
+    for (int waited = 0; waited < TIMEOUT_MS; waited += 10)
+    {
+        const int fd = connect_tcp();
+        if (fd >= 0)
+        {
+            close(fd);
+            return pid;
+        }
+
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+            break;
+        sleep_ms(10);
+    }
+
+    fail("%s did not start accepting connections", server_path);
+    stop_server(pid, SIGKILL);
+    return -1;
+}
+
+static int send_frame(int fd, uint16_t type, uint64_t seq, const void *payload, uint32_t len)
+{
+    unsigned char buf[FRAME_HEADER_SIZE];
+    const struct frame_header header = { .len = len, .type = type, .flags = 0, .seq = seq };
+
+    frame_encode(&header, buf);
+    if (send_all(fd, buf, sizeof(buf)) < 0)
+        return -1;
+
+    return len > 0 ? send_all(fd, payload, len) : 0;
+}
+
+/**
+ * Receives a frame, its payload replaces the content of @param payload
+ */
+static int recv_frame(int fd, struct frame_header *header, struct buffer *payload)
+{
+    unsigned char buf[FRAME_HEADER_SIZE];
+
+    if (recv_exact(fd, buf, sizeof(buf)) < 0)
+        return -1;
+    frame_decode(buf, header);
+
+    buffer_reset(payload);
+    if (header->len > 0)
+    {
+        char *data = (char *)malloc(header->len);
+        if (data == NULL || recv_exact(fd, data, header->len) < 0)
+        {
+            free(data);
+            return -1;
+        }
+        buffer_append(payload, data, header->len);
+        free(data);
+    }
+
+    return 0;
+}
+
+/**
+ * Negotiates binary framing on a new connection
+ * @return the socket with the sequence number of the last stored record in @param seq
+ */
+static int connect_binary(uint64_t *seq)
+{
+    struct frame_header header;
+    struct buffer payload = { 0 };
+
+    int fd = connect_tcp();
+    if (fd < 0)
+        return -1;
+
+    if (send_str(fd, FRAME_NEGOTIATE_COMMAND) < 0 || recv_frame(fd, &header, &payload) < 0 ||
+            header.type != FRAME_ACK)
+    {
+        close(fd);
+        buffer_free(&payload);
+        return -1;
+    }
+
+    *seq = header.seq;
+    buffer_free(&payload);
+    return fd;
+}
+
+/**
+ * Waits for the acknowledgement of a burst, skipping older ones
+ */
+static int recv_ack(int fd, uint64_t min_seq, uint64_t *seq)
+{
+    struct frame_header header;
+    struct buffer payload = { 0 };
+
+    do
+    {
+        if (recv_frame(fd, &header, &payload) < 0 || header.type != FRAME_ACK)
+        {
+            buffer_free(&payload);
+            return -1;
+        }
+    }
+    while (header.seq < min_seq);
+
+    *seq = header.seq;
+    buffer_free(&payload);
+    return 0;
+}
+
+/**
+ * Replays the records from @param from on, collecting the payloads except timestamps in
+ * @param records
+ * @return 0 if the records arrived in sequence from @param from, followed by the ACK with
+ * the last stored sequence number in @param last_seq
+ */
+static int replay(int fd, uint64_t from, struct buffer *records, uint64_t *last_seq)
+{
+    struct frame_header header;
+    struct buffer payload = { 0 };
+    uint64_t expected = from;
+    int ret = 0;
+
+    if (send_frame(fd, FRAME_REPLAY, from, NULL, 0) < 0)
+        return fail("sending the replay request: %s", strerror(errno));
+
+    for (;;)
+    {
+        if (recv_frame(fd, &header, &payload) < 0)
+        {
+            ret = fail("replay from %llu ended early", (unsigned long long)from);
+            break;
+        }
+
+        if (header.type == FRAME_ACK)
+        {
+            *last_seq = header.seq;
+            break;
+        }
+
+        if (header.type != FRAME_RECORD || header.seq != expected)
+        {
+            ret = fail("expected record %llu, got type %u with %llu", (unsigned long long)expected,
+                    header.type, (unsigned long long)header.seq);
+            break;
+        }
+        expected++;
+
+        if (payload.len < 11 || memcmp(payload.data, "timestamp: ", 11) != 0)
+            buffer_append(records, payload.data, payload.len);
+    }
+
+    buffer_free(&payload);
+    return ret;
+}
+
+/**
+ * Text clients get the data file back after each complete line, also for lines split
+ * over several packets.  SIGTERM stores nothing more, removes the data file and exits
+ * with 0.  No local or upgrade socket exists without being configured.
+ */
+static int test_text(void)
+{
+    struct buffer reply = { 0 };
+    int ret = -1;
+
+    pid_t pid = start_server("", false);
+    if (pid < 0)
+        return -1;
+
+    int fd = connect_tcp();
+    if (fd < 0)
+    {
+        fail("connect: %s", strerror(errno));
+        goto out;
+    }
+
+    if (access(LOCAL_SOCKET, F_OK) == 0 || access(UPGRADE_SOCKET, F_OK) == 0)
+    {
+        fail("local or upgrade socket exists without configuration");
+        goto out;
+    }
+
+    if (send_str(fd, "first line\n") < 0 || recv_reply(fd, &reply, "first line\n") < 0 ||
+            check_prefix_of_file(&reply, "reply to the first line") < 0)
+        goto out;
+
+    buffer_reset(&reply);
+    if (send_str(fd, "second ") < 0)
+        goto out;
+    sleep_ms(50);
+    if (send_str(fd, "line\n") < 0 || recv_reply(fd, &reply, "second line\n") < 0 ||
+            check_prefix_of_file(&reply, "reply to the split line") < 0)
+        goto out;
+
+    if (strstr(reply.data, "first line\nsecond line\n") == NULL)
+    {
+        fail("split line not stored as one line");
+        goto out;
+    }
+
+    const int status = stop_server(pid, SIGTERM);
+    pid = -1;
+    if (status != 0)
+        fail("exited with %d on SIGTERM", status);
+    else if (access(DATAFILE, F_OK) == 0)
+        fail("%s left behind on SIGTERM", DATAFILE);
+    else
+        ret = 0;
+
+out:
+    if (pid > 0)
+        stop_server(pid, SIGTERM);
+    if (fd >= 0)
+        close(fd);
+    buffer_free(&reply);
+    return ret;
+}
+
+/**
+ * SIGHUP rereads the configuration, running connections use it for their next line.
+ * SIGINT shuts down like SIGTERM.
+ */
+static int test_reload(void)
+{
+    struct buffer reply = { 0 };
+    int ret = -1;
+
+    pid_t pid = start_server("replay_lines = 0\n", false);
+    if (pid < 0)
+        return -1;
+
+    int fd = connect_tcp();
+    if (fd < 0)
+    {
+        fail("connect: %s", strerror(errno));
+        goto out;
+    }
+
+    if (send_str(fd, "before reload\n") < 0 || recv_reply(fd, &reply, "before reload\n") < 0 ||
+            check_prefix_of_file(&reply, "reply before reload") < 0)
+        goto out;
+
+    if (write_config("replay_lines = 1\n") < 0)
+    {
+        fail("cannot write %s: %s", CONFIG_PATH, strerror(errno));
+        goto out;
+    }
+    kill(pid, SIGHUP);
+    sleep_ms(QUIET_MS);
+
+    buffer_reset(&reply);
+    if (send_str(fd, "after reload\n") < 0 || recv_reply(fd, &reply, "after reload\n") < 0)
+        goto out;
+
+    if (strcmp(reply.data, "after reload\n") != 0)
+    {
+        fail("replay_lines = 1 not applied, got %zu bytes back", reply.len);
+        goto out;
+    }
+
+    const int status = stop_server(pid, SIGINT);
+    pid = -1;
+    if (status != 0)
+        fail("exited with %d on SIGINT", status);
+    else if (access(DATAFILE, F_OK) == 0)
+        fail("%s left behind on SIGINT", DATAFILE);
+    else
+        ret = 0;
+
+out:
+    if (pid > 0)
+        stop_server(pid, SIGTERM);
+    if (fd >= 0)
+        close(fd);
+    buffer_free(&reply);
+    return ret;
+}
+
+/**
+ * A subscriber gets the stored records once and every record stored afterwards, without
+ * sending anything
+ */
+static int test_subscribe(void)
+{
+    struct buffer stream = { 0 };
+    struct buffer reply = { 0 };
+    int ret = -1;
+
+    const pid_t pid = start_server("", false);
+    if (pid < 0)
+        return -1;
+
+    const int writer = connect_tcp();
+    const int sub = connect_tcp();
+    if (writer < 0 || sub < 0)
+    {
+        fail("connect: %s", strerror(errno));
+        goto out;
+    }
+
+    if (send_str(writer, "stored before\n") < 0 || recv_reply(writer, &reply, "stored before\n") < 0)
+        goto out;
+
+    if (send_str(sub, SUBSCRIBE_COMMAND) < 0 || recv_reply(sub, &stream, "stored before\n") < 0 ||
+            check_prefix_of_file(&stream, "subscriber snapshot") < 0)
+        goto out;
+
+    for (int i = 0; i < 3; i++)
+    {
+        char line[32];
+
+        snprintf(line, sizeof(line), "pushed %d\n", i);
+        if (send_str(writer, line) < 0 || recv_reply(sub, &stream, line) < 0)
+            goto out;
+    }
+
+    if (check_prefix_of_file(&stream, "subscriber stream") == 0)
+        ret = 0;
+
+out:
+    if (stop_server(pid, SIGTERM) != 0 && ret == 0)
+        ret = fail("server did not exit cleanly");
+    if (writer >= 0)
+        close(writer);
+    if (sub >= 0)
+        close(sub);
+    buffer_free(&stream);
+    buffer_free(&reply);
+    return ret;
+}
+
+/**
+ * With coalesce_replies several lines received at once get a single reply
+ */
+static int test_coalesce(void)
+{
+    struct buffer reply = { 0 };
+    int ret = -1;
+
+    const pid_t pid = start_server("coalesce_replies = 1\n", false);
+    if (pid < 0)
+        return -1;
+
+    const int fd = connect_tcp();
+    if (fd < 0)
+    {
+        fail("connect: %s", strerror(errno));
+        goto out;
+    }
+
+    // one reply per line would repeat the file three times
+    if (send_str(fd, "a\nb\nc\n") < 0 || recv_reply(fd, &reply, "a\nb\nc\n") < 0 ||
+            check_prefix_of_file(&reply, "coalesced reply") < 0)
+        goto out;
+
+    ret = 0;
+
+out:
+    if (stop_server(pid, SIGTERM) != 0 && ret == 0)
+        ret = fail("server did not exit cleanly");
+    if (fd >= 0)
+        close(fd);
+    buffer_free(&reply);
+    return ret;
+}
+
+/**
+ * Replies above zerocopy_threshold are sent with MSG_ZEROCOPY and arrive unchanged
+ */
+static int test_zerocopy(void)
+{
+    struct buffer reply = { 0 };
+    struct buffer record = { 0 };
+    uint64_t seq, acked;
+    int text = -1;
+    int ret = -1;
+
+    const pid_t pid = start_server("zerocopy_threshold = 4096\n", false);
+    if (pid < 0)
+        return -1;
+
+    // fill the file through one binary record, a reply per line would take long
+    const int binary = connect_binary(&seq);
+    text = connect_tcp();
+    if (binary < 0 || text < 0)
+    {
+        fail("connect: %s", strerror(errno));
+        goto out;
+    }
+
+    for (int i = 0; i < 65536; i++)
+    {
+        char line[32];
+
+        const int len = snprintf(line, sizeof(line), "zerocopy %06d\n", i);
+        buffer_append(&record, line, (size_t)len);
+    }
+
+    if (send_frame(binary, FRAME_RECORD, 0, record.data, (uint32_t)record.len) < 0 ||
+            recv_ack(binary, seq + 1, &acked) < 0)
+    {
+        fail("%zu byte record not acknowledged", record.len);
+        goto out;
+    }
+
+    if (send_str(text, "end\n") < 0 || recv_reply(text, &reply, "zerocopy 065535\nend\n") < 0 ||
+            check_prefix_of_file(&reply, "zerocopy reply") < 0)
+        goto out;
+
+    if (reply.len <= record.len)
+    {
+        fail("reply of %zu bytes is shorter than the file", reply.len);
+        goto out;
+    }
+
+    ret = 0;
+
+out:
+    if (stop_server(pid, SIGTERM) != 0 && ret == 0)
+        ret = fail("server did not exit cleanly");
+    if (binary >= 0)
+        close(binary);
+    if (text >= 0)
+        close(text);
+    buffer_free(&reply);
+    buffer_free(&record);
+    return ret;
+}
+
+/**
+ * Binary clients store records with newlines and NUL bytes, get each burst acknowledged
+ * and resume on a new connection by replaying from a sequence number.  Invalid frames
+ * close the connection.
+ */
+static int test_binary(void)
+{
+    static const char expected[] = "one\nt\0o\nthree\n";
+    struct buffer records = { 0 };
+    struct buffer burst = { 0 };
+    struct buffer unused = { 0 };
+    uint64_t seq, acked, last;
+    int resumed = -1;
+    int ret = -1;
+
+    const pid_t pid = start_server("", false);
+    if (pid < 0)
+        return -1;
+
+    const int fd = connect_binary(&seq);
+    if (fd < 0)
+    {
+        fail("negotiating binary framing failed");
+        goto out;
+    }
+
+    // three records in one send form one burst
+    const char *payloads[] = { "one\n", "t\0o\n", "three\n" };
+    const uint32_t lens[] = { 4, 4, 6 };
+    for (size_t i = 0; i < 3; i++)
+    {
+        unsigned char buf[FRAME_HEADER_SIZE];
+        const struct frame_header header = { .len = lens[i], .type = FRAME_RECORD, .flags = 0, .seq = 0 };
+
+        frame_encode(&header, buf);
+        buffer_append(&burst, buf, sizeof(buf));
+        buffer_append(&burst, payloads[i], lens[i]);
+    }
+
+    if (send_all(fd, burst.data, burst.len) < 0 || recv_ack(fd, seq + 3, &acked) < 0)
+    {
+        fail("burst not acknowledged");
+        goto out;
+    }
+
+    if (replay(fd, seq + 1, &records, &last) < 0)
+        goto out;
+    if (records.len != sizeof(expected) - 1 || memcmp(records.data, expected, records.len) != 0 ||
+            last < acked)
+    {
+        fail("replay returned %zu bytes up to %llu instead of the burst", records.len,
+                (unsigned long long)last);
+        goto out;
+    }
+
+    // a client reconnecting after record seq + 1 replays the rest
+    resumed = connect_binary(&last);
+    if (resumed < 0 || last < acked)
+    {
+        fail("reconnecting did not report the stored records");
+        goto out;
+    }
+
+    buffer_reset(&records);
+    if (replay(resumed, seq + 2, &records, &last) < 0)
+        goto out;
+    if (records.len != sizeof(expected) - 5 || memcmp(records.data, &expected[4], records.len) != 0)
+    {
+        fail("resuming from %llu returned %zu bytes", (unsigned long long)(seq + 2), records.len);
+        goto out;
+    }
+
+    if (send_frame(resumed, 0x7f, 0, NULL, 0) < 0 || recv_idle(resumed, &unused, TIMEOUT_MS) != 1)
+    {
+        fail("connection not closed after an invalid frame");
+        goto out;
+    }
+
+    ret = 0;
+
+out:
+    if (stop_server(pid, SIGTERM) != 0 && ret == 0)
+        ret = fail("server did not exit cleanly");
+    if (fd >= 0)
+        close(fd);
+    if (resumed >= 0)
+        close(resumed);
+    buffer_free(&records);
+    buffer_free(&burst);
+    buffer_free(&unused);
+    return ret;
+}
+
+/**
+ * Local clients push records through the shared memory ring, also many more than fit at
+ * once, and they are stored in order
+ */
+static int test_local(void)
+{
+    struct sockaddr_un addr;
+    struct shm_ring ring;
+    struct buffer file = { 0 };
+    bool attached = false;
+    int ret = -1;
+
+    const pid_t pid = start_server("local_clients = 1\nlocal_ring_size = 4096\n", false);
+    if (pid < 0)
+        return -1;
+
+    memset(&addr, 0x0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, LOCAL_SOCKET, sizeof(addr.sun_path) - 1);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || shm_ring_receive(fd, &ring) < 0)
+    {
+        fail("attaching to %s: %s", LOCAL_SOCKET, strerror(errno));
+        goto out;
+    }
+    attached = true;
+
+    for (int i = 0; i < 1000; i++)
+    {
+        char line[32];
+
+        const int len = snprintf(line, sizeof(line), "local %04d\n", i);
+        while (!shm_ring_push(&ring, line, (uint32_t)len))
+        {
+            if (shm_ring_wait_space(&ring, fd, (uint32_t)len) < 0)
+            {
+                fail("waiting for space in the ring: %s", strerror(errno));
+                goto out;
+            }
+        }
+    }
+
+    // stored once the server freed the records
+    const uint64_t head = atomic_load_explicit(&ring.header->head, memory_order_relaxed);
+    for (int waited = 0; atomic_load_explicit(&ring.header->tail, memory_order_acquire) != head; waited += 10)
+    {
+        if (waited >= TIMEOUT_MS)
+        {
+            fail("ring not drained within %d ms", TIMEOUT_MS);
+            goto out;
+        }
+        sleep_ms(10);
+    }
+
+    if (read_file(DATAFILE, &file) < 0)
+    {
+        fail("cannot read %s: %s", DATAFILE, strerror(errno));
+        goto out;
+    }
+
+    const char *pos = file.data;
+    for (int i = 0; i < 1000; i++)
+    {
+        char line[32];
+
+        snprintf(line, sizeof(line), "local %04d\n", i);
+        pos = strstr(pos, line);
+        if (pos == NULL)
+        {
+            fail("record %d missing or out of order", i);
+            goto out;
+        }
+    }
+
+    ret = 0;
+
+out:
+    if (stop_server(pid, SIGTERM) != 0 && ret == 0)
+        ret = fail("server did not exit cleanly");
+    if (attached)
+        shm_ring_destroy(&ring);
+    if (fd >= 0)
+        close(fd);
+    buffer_free(&file);
+    return ret;
+}
+
+/**
+ * A local client can neither shrink nor grow the ring memory mapped by the server, which
+ * keeps serving everybody else
+ */
+static int test_local_resize(void)
+{
+    struct sockaddr_un addr;
+    struct shm_ring ring;
+    struct buffer reply = { 0 };
+    bool attached = false;
+    int text = -1;
+    int ret = -1;
+
+    const pid_t pid = start_server("local_clients = 1\n", false);
+    if (pid < 0)
+        return -1;
+
+    memset(&addr, 0x0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, LOCAL_SOCKET, sizeof(addr.sun_path) - 1);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || shm_ring_receive(fd, &ring) < 0)
+    {
+        fail("attaching to %s: %s", LOCAL_SOCKET, strerror(errno));
+        goto out;
+    }
+    attached = true;
+
+    if (!shm_ring_push(&ring, "local record\n", 13))
+    {
+        fail("pushing into the empty ring failed");
+        goto out;
+    }
+
+    if (ftruncate(ring.mem_fd, 0) == 0 || ftruncate(ring.mem_fd, (off_t)(SHM_RING_HEADER_SIZE + 2U * ring.size)) == 0)
+    {
+        fail("ring memory could be resized");
+        goto out;
+    }
+    sleep_ms(50);
+
+    text = connect_tcp();
+    if (text < 0)
+    {
+        fail("connect after resizing the ring: %s", strerror(errno));
+        goto out;
+    }
+
+    if (send_str(text, "still serving\n") < 0 || recv_reply(text, &reply, "still serving\n") < 0 ||
+            check_prefix_of_file(&reply, "reply after resizing the ring") < 0)
+        goto out;
+
+    if (strstr(reply.data, "local record\n") == NULL)
+    {
+        fail("local record missing");
+        goto out;
+    }
+
+    ret = 0;
+
+out:
+    if (stop_server(pid, SIGTERM) != 0 && ret == 0)
+        ret = fail("server did not exit cleanly");
+    if (attached)
+        shm_ring_destroy(&ring);
+    if (fd >= 0)
+        close(fd);
+    if (text >= 0)
+        close(text);
+    buffer_free(&reply);
+    return ret;
+}
+
+/**
+ * A new process takes over a server with subscribed, text and binary clients.  All of
+ * them keep working, partial lines and frames are completed, and the subscriber gets
+ * every record exactly once.
+ */
+static int test_upgrade(void)
+{
+    struct buffer sub_stream = { 0 };
+    struct buffer reply = { 0 };
+    int sub = -1, text = -1, writer = -1, binary = -1;
+    uint64_t seq, acked;
+    int ret = -1;
+
+    pid_t old_pid = start_server("hot_upgrade = 1\n", false);
+    if (old_pid < 0)
+        return -1;
+
+    writer = connect_tcp();
+    sub = connect_tcp();
+    text = connect_tcp();
+    binary = connect_binary(&seq);
+    if (writer < 0 || sub < 0 || text < 0 || binary < 0)
+    {
+        fail("connect: %s", strerror(errno));
+        goto out;
+    }
+
+    if (send_str(writer, "before upgrade\n") < 0 || recv_reply(writer, &reply, "before upgrade\n") < 0)
+        goto out;
+
+    // the subscriber got records before, which must not be sent again
+    if (send_str(sub, SUBSCRIBE_COMMAND) < 0 || recv_reply(sub, &sub_stream, "before upgrade\n") < 0)
+        goto out;
+
+    if (send_str(writer, "pushed before upgrade\n") < 0 || recv_reply(sub, &sub_stream, "pushed before upgrade\n") < 0)
+        goto out;
+
+    // a partial line and a partial frame are pending during the handoff
+    if (send_str(text, "partial ") < 0 || send_frame(binary, FRAME_RECORD, 0, "binary record\n", 14) < 0 ||
+            recv_ack(binary, seq + 1, &acked) < 0)
+    {
+        fail("binary record before upgrade not acknowledged");
+        goto out;
+    }
+
+    unsigned char half[FRAME_HEADER_SIZE];
+    const struct frame_header header = { .len = 12, .type = FRAME_RECORD, .flags = 0, .seq = 0 };
+    frame_encode(&header, half);
+    if (send_all(binary, half, sizeof(half)) < 0 || send_all(binary, "split ", 6) < 0)
+        goto out;
+    sleep_ms(50);
+
+    const pid_t new_pid = start_server("hot_upgrade = 1\n", true);
+    if (new_pid < 0)
+        goto out;
+
+    const int old_status = wait_server(old_pid);
+    old_pid = -1;
+    if (old_status != 0)
+    {
+        fail("old server exited with %d after the handoff", old_status);
+        stop_server(new_pid, SIGKILL);
+        goto out;
+    }
+    old_pid = new_pid;
+
+    buffer_reset(&reply);
+    if (send_str(text, "line\n") < 0 || recv_reply(text, &reply, "partial line\n") < 0 ||
+            check_prefix_of_file(&reply, "text reply after upgrade") < 0)
+        goto out;
+
+    if (send_all(binary, "frame\n", 6) < 0 || recv_ack(binary, acked + 1, &seq) < 0)
+    {
+        fail("split binary record not acknowledged after upgrade");
+        goto out;
+    }
+
+    buffer_reset(&reply);
+    if (send_str(writer, "after upgrade\n") < 0 || recv_reply(writer, &reply, "after upgrade\n") < 0)
+        goto out;
+
+    if (recv_reply(sub, &sub_stream, "after upgrade\n") < 0 ||
+            check_prefix_of_file(&sub_stream, "subscriber stream across the upgrade") < 0)
+        goto out;
+
+    if (strstr(sub_stream.data, "split frame\n") == NULL)
+    {
+        fail("split binary record missing");
+        goto out;
+    }
+
+    ret = 0;
+
+out:
+    if (old_pid > 0 && stop_server(old_pid, SIGTERM) != 0 && ret == 0)
+        ret = fail("server did not exit cleanly");
+
+    const int fds[] = { sub, text, writer, binary };
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+    {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+
+    buffer_free(&sub_stream);
+    buffer_free(&reply);
+    return ret;
+}
+
+/**
+ * A peer on the upgrade socket that never confirms the handoff only stops the server
+ * for a while, afterwards it serves again and can still be taken over
+ */
+static int test_upgrade_stalled(void)
+{
+    struct sockaddr_un addr;
+    struct buffer reply = { 0 };
+    int text = -1;
+    int ret = -1;
+
+    pid_t pid = start_server("hot_upgrade = 1\n", false);
+    if (pid < 0)
+        return -1;
+
+    memset(&addr, 0x0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, UPGRADE_SOCKET, sizeof(addr.sun_path) - 1);
+
+    const int peer = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (peer < 0 || connect(peer, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        fail("connecting to %s: %s", UPGRADE_SOCKET, strerror(errno));
+        goto out;
+    }
+
+    // the peer neither reads nor confirms, the handoff times out meanwhile
+    sleep_ms(3000);
+
+    text = connect_tcp();
+    if (text < 0)
+    {
+        fail("connect after the stalled handoff: %s", strerror(errno));
+        goto out;
+    }
+
+    if (send_str(text, "after stall\n") < 0 || recv_reply(text, &reply, "after stall\n") < 0 ||
+            check_prefix_of_file(&reply, "reply after the stalled handoff") < 0)
+        goto out;
+
+    const pid_t new_pid = start_server("hot_upgrade = 1\n", true);
+    if (new_pid < 0)
+        goto out;
+
+    const int old_status = wait_server(pid);
+    pid = new_pid;
+    if (old_status != 0)
+    {
+        fail("old server exited with %d after the handoff", old_status);
+        goto out;
+    }
+
+    buffer_reset(&reply);
+    if (send_str(text, "after upgrade\n") < 0 || recv_reply(text, &reply, "after upgrade\n") < 0)
+        goto out;
+
+    ret = 0;
+
+out:
+    if (stop_server(pid, SIGTERM) != 0 && ret == 0)
+        ret = fail("server did not exit cleanly");
+    if (peer >= 0)
+        close(peer);
+    if (text >= 0)
+        close(text);
+    buffer_free(&reply);
+    return ret;
+}
+
+struct test
+{
+    const char *name;
+    int (*fn)(void);
+};
+
+static const struct test tests[] = {
+    { "text", test_text },
+    { "reload", test_reload },
+    { "subscribe", test_subscribe },
+    { "coalesce", test_coalesce },
+    { "zerocopy", test_zerocopy },
+    { "binary", test_binary },
+    { "local", test_local },
+    { "local_resize", test_local_resize },
+    { "upgrade", test_upgrade },
+    { "upgrade_stalled", test_upgrade_stalled },
+};
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+
+    if (argc > 2)
+    {
+        fprintf(stderr, "Usage: %s [aesdsocket]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 1)
+        server_path = argv[1];
+
+    signal(SIGPIPE, SIG_IGN);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        current_test = tests[i].name;
+        if (tests[i].fn() < 0)
+            failed++;
+        else
+            printf("PASS %s\n", current_test);
+    }
+
+    unlink(CONFIG_PATH);
+
+    return failed > 0 ? 1 : 0;
+}
@@ -1,5 +1,10 @@
 /*
  * Acts as server for the aesd
+ *
+ * Usage: aesdsocket [-d] [-u] [-c config]
+ * SIGINT and SIGTERM shut the server down, SIGHUP reloads the configuration without
+ * dropping connections.  With -u the process takes over the sockets, data and
+ * connections of a running server started with hot_upgrade = 1, which then exits.
  * Author: Heiko Schmidt
  */
 #include <stdio.h>
@@ -8,6 +13,7 @@
 #include <stdint.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 
 #include <sys/types.h>
@@ -15,13 +21,54 @@
 
 #include "signal.h"
 #include "server.h"
+#include "config.h"
 
 static void run_as_daemon();
+static void reload_config(const char *path);
 
 int main(int argc, char **argv)
 {
+    struct server_config config;
+    char config_path[PATH_MAX];
+    bool daemon = false;
+    bool upgrade = false;
+    int opt;
+
     openlog("aesdsocket", 0, LOG_USER);
 
+    strcpy(config_path, CONFIG_DEFAULT_PATH);
+
+    while ((opt = getopt(argc, argv, "duc:")) != -1)
+    {
+        if (opt == 'd')
+        {
+            daemon = true;
+        }
+        else if (opt == 'u')
+        {
+            upgrade = true;
+        }
+        else if (opt == 'c')
+        {
+            // the daemon changes to /, keep the file reachable for reloads
+            if (realpath(optarg, config_path) == NULL)
+                snprintf(config_path, sizeof(config_path), "%s", optarg);
+        }
+        else
+        {
+            syslog(LOG_ERR, "Usage: %s [-d] [-u] [-c config]", argv[0]);
+            closelog();
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (config_load(config_path, &config) < 0)
+    {
+        closelog();
+        exit(EXIT_FAILURE);
+    }
+    configure_server(&config);
+
     // register signal handler
     if (register_sighandler() < 0)
     {
@@ -30,15 +77,15 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    // init server stage 1
-    if (init_server_stage1() < 0)
+    // init server stage 1, or take it over from the running process
+    if ((upgrade ? init_server_upgrade() : init_server_stage1()) < 0)
     {
         closelog();
         exit(EXIT_FAILURE);
     }
 
     // check if program shall run as daemon
-    if (argc == 2 && strcmp("-d", argv[1]) == 0)
+    if (daemon)
         run_as_daemon();
 
     // init server stage 2
@@ -50,8 +97,19 @@ int main(int argc, char **argv)
 
     while (is_app_running())
     {
-        if (process_server() < 0)
+        const int rc = process_server(get_signal_fd());
+
+        if (rc < 0)
             break;
+
+        if (rc == SERVER_HANDED_OFF)
+        {
+            syslog(LOG_INFO, "Handed off to new process, exiting");
+            break;
+        }
+
+        if (rc > 0 && (process_signals() & SIGNAL_EVENT_RELOAD) && is_app_running())
+            reload_config(config_path);
     }
 
     if (!is_app_running())
@@ -65,6 +123,24 @@ int main(int argc, char **argv)
     exit(EXIT_SUCCESS);
 }
 
+static void reload_config(const char *path)
+{
+    struct server_config config;
+
+    // an invalid file keeps the running configuration
+    if (config_load(path, &config) < 0)
+    {
+        syslog(LOG_ERR, "Keeping previous configuration");
+        return;
+    }
+
+    configure_server(&config);
+    syslog(LOG_INFO, "Reloaded configuration: recv_buffer_size %zu, max_workers %u, replay_lines %zu, "
+            "coalesce_replies %u, zerocopy_threshold %zu, local_ring_size %zu, local_spin_us %u",
+            config.recv_buffer_size, config.max_workers, config.replay_lines, config.coalesce_replies,
+            config.zerocopy_threshold, config.local_ring_size, config.local_spin_us);
+}
+
 static void run_as_daemon()
 {
     const pid_t pid = fork();
@@ -0,0 +1,126 @@
+/*
+ * Acts as server for the aesd
+ * Author: Heiko Schmidt
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <syslog.h>
+
+#include "config.h"
+#include "reply.h"
+#include "shm-ring.h"
+
+#define DEFAULT_RECV_BUFFER_SIZE 512U
+#define MAX_RECV_BUFFER_SIZE (1024U * 1024U)
+#define DEFAULT_LOCAL_SPIN_US 50U
+
+void config_defaults(struct server_config *config)
+{
+    config->recv_buffer_size = DEFAULT_RECV_BUFFER_SIZE;
+    config->max_workers = 0;
+    config->replay_lines = 0;
+    config->coalesce_replies = 0;
+    config->zerocopy_threshold = REPLY_ZEROCOPY_THRESHOLD;
+    config->local_ring_size = SHM_RING_DEFAULT_SIZE;
+    config->local_spin_us = DEFAULT_LOCAL_SPIN_US;
+    config->local_clients = 0;
+    config->hot_upgrade = 0;
+}
+
+static char *trim(char *s)
+{
+    while(isspace((unsigned char)*s))
+        s++;
+
+    char *end = s + strlen(s);
+    while(end > s && isspace((unsigned char)end[-1]))
+        end--;
+    *end = '\0';
+
+    return s;
+}
+
+static int parse_value(const char *value, unsigned long long max, unsigned long long *result)
+{
+    char *end;
+
+    errno = 0;
+    *result = strtoull(value, &end, 10);
+
+    return (errno != 0 || *end != '\0' || end == value || value[0] == '-' || *result > max) ? -1 : 0;
+}
+
+int config_load(const char *path, struct server_config *config)
+{
+    char *line = NULL;
+    size_t len = 0;
+    unsigned int line_no = 0;
+    int ret = 0;
+
+    config_defaults(config);
+
+    FILE *fp = fopen(path, "r");
+    if(fp == NULL) {
+        if(errno == ENOENT)
+            return 0;
+        syslog(LOG_ERR, "Error opening config %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    while(getline(&line, &len, fp) > 0) {
+        unsigned long long v;
+        line_no++;
+
+        char *key = trim(line);
+        if(*key == '\0' || *key == '#')
+            continue;
+
+        char *value = strchr(key, '=');
+        if(value == NULL) {
+            syslog(LOG_ERR, "%s:%u: expected key = value", path, line_no);
+            ret = -1;
+            continue;
+        }
+        *value++ = '\0';
+        key = trim(key);
+        value = trim(value);
+
+        if(strcmp(key, "recv_buffer_size") == 0 && parse_value(value, MAX_RECV_BUFFER_SIZE, &v) == 0 && v > 0) {
+            config->recv_buffer_size = (size_t)v;
+        } else if(strcmp(key, "max_workers") == 0 && parse_value(value, 65535U, &v) == 0) {
+            config->max_workers = (unsigned int)v;
+        } else if(strcmp(key, "replay_lines") == 0 && parse_value(value, 1000000U, &v) == 0) {
+            config->replay_lines = (size_t)v;
+        } else if(strcmp(key, "coalesce_replies") == 0 && parse_value(value, 1U, &v) == 0) {
+            config->coalesce_replies = (unsigned int)v;
+        } else if(strcmp(key, "zerocopy_threshold") == 0 && parse_value(value, SIZE_MAX, &v) == 0) {
+            config->zerocopy_threshold = (size_t)v;
+        } else if(strcmp(key, "local_ring_size") == 0 && parse_value(value, SHM_RING_MAX_SIZE, &v) == 0 &&
+                v >= SHM_RING_MIN_SIZE && (v & (v - 1U)) == 0U) {
+            config->local_ring_size = (size_t)v;
+        } else if(strcmp(key, "local_spin_us") == 0 && parse_value(value, 1000000U, &v) == 0) {
+            config->local_spin_us = (unsigned int)v;
+        } else if(strcmp(key, "local_clients") == 0 && parse_value(value, 1U, &v) == 0) {
+            config->local_clients = (unsigned int)v;
+        } else if(strcmp(key, "hot_upgrade") == 0 && parse_value(value, 1U, &v) == 0) {
+            config->hot_upgrade = (unsigned int)v;
+        } else {
+            syslog(LOG_ERR, "%s:%u: invalid setting %s", path, line_no, key);
+            ret = -1;
+        }
+    }
+
+    if(ferror(fp)) {
+        syslog(LOG_ERR, "Error reading config %s: %s", path, strerror(errno));
+        ret = -1;
+    }
+
+    free(line);
+    fclose(fp);
+
+    return ret;
+}
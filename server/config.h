@@ -0,0 +1,70 @@
+/*
+ * Acts as server for the aesd
+ * Author: Heiko Schmidt
+ */
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stddef.h>
+
+#define CONFIG_DEFAULT_PATH "/etc/aesdsocket.conf"
+
+/**
+ * Settings read from the configuration file, which can be reloaded with SIGHUP
+ */
+struct server_config
+{
+    /**
+     * Bytes received from a client per recv call
+     */
+    size_t recv_buffer_size;
+    /**
+     * Connections handled at the same time, further clients wait in the listen
+     * backlog.  0 for no limit.
+     */
+    unsigned int max_workers;
+    /**
+     * Number of most recent lines sent back to a client after each packet, 0 for all
+     */
+    size_t replay_lines;
+    /**
+     * Non zero to store all packets received in one burst with a single append and answer
+     * them with a single replay, which ends in the same state as one replay per packet
+     */
+    unsigned int coalesce_replies;
+    /**
+     * Replies of at least this many bytes are sent with MSG_ZEROCOPY, 0 disables it
+     */
+    size_t zerocopy_threshold;
+    /**
+     * Bytes of the shared memory ring handed to each local client, a power of two
+     */
+    size_t local_ring_size;
+    /**
+     * Microseconds the server keeps polling a ring for further records before it sleeps
+     * on the doorbell, 0 to sleep right away
+     */
+    unsigned int local_spin_us;
+    /**
+     * Non zero to accept clients on the same host for a shared memory ring.  Only read at
+     * start, the socket is only accessible to the user and group of the server.
+     */
+    unsigned int local_clients;
+    /**
+     * Non zero to let a new process started with -u take over the server.  Only read at
+     * start, the socket is only accessible to the user of the server.
+     */
+    unsigned int hot_upgrade;
+};
+
+extern void config_defaults(struct server_config *config);
+
+/**
+ * Reads the "key = value" lines of @param path into @param config, which is initialized
+ * to the defaults first.  Empty lines and lines starting with # are ignored, a missing
+ * file leaves the defaults.
+ * @return 0 on success, -1 on invalid content or read errors
+ */
+extern int config_load(const char *path, struct server_config *config);
+
+#endif /* CONFIG_H */
@@ -0,0 +1,76 @@
+/*
+ * Acts as server for the aesd
+ *
+ * Binary framing, negotiated by sending FRAME_NEGOTIATE_COMMAND as a text line.  The
+ * server answers with a FRAME_ACK and from then on both sides exchange frames of a
+ * header followed by len payload bytes.  Header fields are big endian.
+ *
+ * client                              server
+ * FRAME_RECORD, payload       ->      stores the payload as one record, which may contain
+ *                                     newlines and NUL bytes
+ * FRAME_REPLAY, seq           ->      FRAME_RECORD with seq and payload for each record
+ *                                     from seq on, 0 for all
+ *                             <-      FRAME_ACK with the sequence number of the last record
+ *                                     stored, after negotiation, each burst of records and
+ *                                     each replay
+ * Author: Heiko Schmidt
+ */
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <endian.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FRAME_NEGOTIATE_COMMAND "AESD_BINARY\n"
+#define FRAME_HEADER_SIZE 16U
+// records above are refused and end the connection
+#define FRAME_MAX_PAYLOAD (64U * 1024U * 1024U)
+
+enum frame_type
+{
+    FRAME_RECORD = 1,
+    FRAME_REPLAY = 2,
+    FRAME_ACK = 3,
+};
+
+struct frame_header
+{
+    uint32_t len;
+    uint16_t type;
+    uint16_t flags;
+    uint64_t seq;
+};
+
+static inline void frame_encode(const struct frame_header *header, unsigned char *buf)
+{
+    const uint32_t len = htobe32(header->len);
+    const uint16_t type = htobe16(header->type);
+    const uint16_t flags = htobe16(header->flags);
+    const uint64_t seq = htobe64(header->seq);
+
+    memcpy(&buf[0], &len, sizeof(len));
+    memcpy(&buf[4], &type, sizeof(type));
+    memcpy(&buf[6], &flags, sizeof(flags));
+    memcpy(&buf[8], &seq, sizeof(seq));
+}
+
+static inline void frame_decode(const unsigned char *buf, struct frame_header *header)
+{
+    uint32_t len;
+    uint16_t type;
+    uint16_t flags;
+    uint64_t seq;
+
+    memcpy(&len, &buf[0], sizeof(len));
+    memcpy(&type, &buf[4], sizeof(type));
+    memcpy(&flags, &buf[6], sizeof(flags));
+    memcpy(&seq, &buf[8], sizeof(seq));
+
+    header->len = be32toh(len);
+    header->type = be16toh(type);
+    header->flags = be16toh(flags);
+    header->seq = be64toh(seq);
+}
+
+#endif /* FRAME_H */
@@ -0,0 +1,126 @@
+/*
+ * Acts as server for the aesd
+ * Author: Heiko Schmidt
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "handoff.h"
+
+// bytes of a data message, well below the default socket buffer
+#define DATA_CHUNK (32U * 1024U)
+
+int handoff_send_msg(int sock, const void *msg, size_t len, const int *fds, int nfds)
+{
+    char control[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+    struct iovec iov = { .iov_base = (void *)msg, .iov_len = len };
+    struct msghdr msghdr;
+
+    memset(&msghdr, 0x0, sizeof(msghdr));
+    msghdr.msg_iov = &iov;
+    msghdr.msg_iovlen = 1;
+
+    if (nfds > 0)
+    {
+        memset(control, 0x0, sizeof(control));
+        msghdr.msg_control = control;
+        msghdr.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msghdr);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cm), fds, nfds * sizeof(int));
+    }
+
+    ssize_t rc;
+    do
+        rc = sendmsg(sock, &msghdr, MSG_NOSIGNAL);
+    while (rc < 0 && errno == EINTR);
+
+    return rc == (ssize_t)len ? 0 : -1;
+}
+
+int handoff_recv_msg(int sock, void *msg, size_t len, int *fds, int max_fds)
+{
+    char control[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+    struct iovec iov = { .iov_base = msg, .iov_len = len };
+    struct msghdr msghdr;
+    int received[HANDOFF_MAX_FDS];
+    int nfds = 0;
+
+    memset(&msghdr, 0x0, sizeof(msghdr));
+    msghdr.msg_iov = &iov;
+    msghdr.msg_iovlen = 1;
+    msghdr.msg_control = control;
+    msghdr.msg_controllen = sizeof(control);
+
+    ssize_t rc;
+    do
+        rc = recvmsg(sock, &msghdr, MSG_CMSG_CLOEXEC);
+    while (rc < 0 && errno == EINTR);
+
+    if (rc < 0)
+        return -1;
+
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msghdr); cm != NULL; cm = CMSG_NXTHDR(&msghdr, cm))
+    {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+        {
+            // the kernel closes the descriptors not fitting into the control buffer
+            nfds = (int)((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            memcpy(received, CMSG_DATA(cm), nfds * sizeof(int));
+        }
+    }
+
+    // a short or truncated message means the peer went away or does not match
+    if ((size_t)rc != len || nfds > max_fds || (msghdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+    {
+        for (int i = 0; i < nfds; i++)
+            close(received[i]);
+        errno = rc == 0 ? EPIPE : EPROTO;
+        return -1;
+    }
+
+    if (nfds > 0)
+        memcpy(fds, received, nfds * sizeof(int));
+
+    return nfds;
+}
+
+int handoff_send_data(int sock, const void *data, size_t len)
+{
+    const char *pos = (const char *)data;
+
+    while (len > 0)
+    {
+        const size_t chunk = len < DATA_CHUNK ? len : DATA_CHUNK;
+
+        if (handoff_send_msg(sock, pos, chunk, NULL, 0) < 0)
+            return -1;
+        pos += chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+int handoff_recv_data(int sock, void *data, size_t len)
+{
+    char *pos = (char *)data;
+
+    while (len > 0)
+    {
+        const size_t chunk = len < DATA_CHUNK ? len : DATA_CHUNK;
+
+        if (handoff_recv_msg(sock, pos, chunk, NULL, 0) < 0)
+            return -1;
+        pos += chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * Acts as server for the aesd
+ *
+ * Messages of a hot upgrade, exchanged over a SOCK_SEQPACKET UNIX socket.  The running
+ * server sends a handoff_state with the listening sockets and the data file, the end
+ * offsets of all records and a handoff_conn for each connection, followed by the bytes
+ * received from it but not processed yet.  The new process confirms with a single byte.
+ * Author: Heiko Schmidt
+ */
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define HANDOFF_MAGIC 0x41455355U
+#define HANDOFF_VERSION 1U
+// descriptors sent with a single message at most
+#define HANDOFF_MAX_FDS 4
+
+// handoff_state flag, the socket for local clients follows the other descriptors
+#define HANDOFF_HAS_LOCAL_SOCKET 0x1U
+
+struct handoff_state
+{
+    uint32_t magic;
+    uint32_t version;
+    // bytes in the data file
+    uint64_t data_size;
+    uint64_t records;
+    uint32_t connections;
+    uint32_t flags;
+};
+
+enum handoff_mode
+{
+    HANDOFF_NONE = 0,
+    HANDOFF_TEXT,
+    HANDOFF_SUBSCRIBED,
+    HANDOFF_BINARY,
+    HANDOFF_LOCAL,
+};
+
+struct handoff_conn
+{
+    uint32_t mode;
+    uint32_t reserved;
+    /**
+     * Last record sent to a subscriber, tail of the ring of a local client
+     */
+    uint64_t seq;
+    uint64_t ring_size;
+    /**
+     * Received bytes following the message, a partial line or frame
+     */
+    uint64_t data_len;
+    char client_ip[INET_ADDRSTRLEN];
+};
+
+/**
+ * Sends @param len bytes of @param msg with the @param nfds descriptors in @param fds
+ * @return 0 on success, -1 with errno set otherwise
+ */
+extern int handoff_send_msg(int sock, const void *msg, size_t len, const int *fds, int nfds);
+
+/**
+ * Receives a message of exactly @param len bytes with up to @param max_fds descriptors
+ * @return the number of descriptors received, -1 with errno set otherwise
+ */
+extern int handoff_recv_msg(int sock, void *msg, size_t len, int *fds, int max_fds);
+
+/**
+ * Sends or receives @param len bytes split into messages
+ */
+extern int handoff_send_data(int sock, const void *data, size_t len);
+extern int handoff_recv_data(int sock, void *data, size_t len);
+
+#endif /* HANDOFF_H */
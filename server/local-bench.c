@@ -0,0 +1,203 @@
+/*
+ * Per record latency of a running aesdsocket, over TCP and the local shared memory ring
+ *
+ *   tcp    one binary FRAME_RECORD to 127.0.0.1:9000, until its FRAME_ACK arrives
+ *   local  one record pushed into the ring, until the server advanced the tail past it
+ * Both measure the time until the record is stored.  Prints one JSON object per transport.
+ * The server has to run with local_clients = 1 in its configuration.
+ *
+ * Usage: local-bench [records] [record_size]
+ * Author: Heiko Schmidt
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "frame.h"
+#include "shm-ring.h"
+
+#define DEFAULT_RECORDS 20000UL
+#define DEFAULT_RECORD_SIZE 64UL
+#define WARMUP_RECORDS 1000UL
+#define NSEC_PER_SEC 1000000000ULL
+#define LOCAL_SOCKET "/var/run/aesdsocket/local.sock"
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + (unsigned long long)ts.tv_nsec;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+    const unsigned long long x = *(const unsigned long long *)a;
+    const unsigned long long y = *(const unsigned long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *transport, unsigned long long *samples, unsigned long count, size_t size)
+{
+    unsigned long long sum = 0;
+
+    for (unsigned long i = 0; i < count; i++)
+        sum += samples[i];
+    qsort(samples, count, sizeof(samples[0]), cmp_ull);
+
+    printf("{\"bench\": \"local\", \"transport\": \"%s\", \"records\": %lu, \"record_size\": %zu, "
+            "\"mean_us\": %.2f, \"p50_us\": %.2f, \"p99_us\": %.2f}\n", transport, count, size,
+            (double)sum / (double)count / 1e3, (double)samples[count / 2] / 1e3,
+            (double)samples[count * 99 / 100] / 1e3);
+}
+
+static int recv_all(int fd, void *buf, size_t len)
+{
+    char *pos = (char *)buf;
+
+    while (len > 0)
+    {
+        const ssize_t rc = recv(fd, pos, len, 0);
+        if (rc <= 0)
+            return -1;
+        pos += rc;
+        len -= (size_t)rc;
+    }
+
+    return 0;
+}
+
+static int bench_tcp(unsigned long records, size_t size, unsigned long long *samples)
+{
+    struct sockaddr_in addr;
+    unsigned char ack[FRAME_HEADER_SIZE];
+    int enable = 1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0x0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(9000);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("connect");
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    unsigned char *frame = (unsigned char *)malloc(FRAME_HEADER_SIZE + size);
+    const struct frame_header header = { .len = (uint32_t)size, .type = FRAME_RECORD, .flags = 0U, .seq = 0U };
+    frame_encode(&header, frame);
+    memset(&frame[FRAME_HEADER_SIZE], 'b', size);
+
+    if (send(fd, FRAME_NEGOTIATE_COMMAND, strlen(FRAME_NEGOTIATE_COMMAND), 0) < 0 ||
+            recv_all(fd, ack, sizeof(ack)) < 0)
+        goto err;
+
+    for (unsigned long i = 0; i < WARMUP_RECORDS + records; i++)
+    {
+        const unsigned long long t0 = now_ns();
+
+        if (send(fd, frame, FRAME_HEADER_SIZE + size, 0) < 0 || recv_all(fd, ack, sizeof(ack)) < 0)
+            goto err;
+
+        if (i >= WARMUP_RECORDS)
+            samples[i - WARMUP_RECORDS] = now_ns() - t0;
+    }
+
+    free(frame);
+    close(fd);
+    return 0;
+
+err:
+    perror("tcp");
+    free(frame);
+    close(fd);
+    return -1;
+}
+
+static int bench_local(unsigned long records, size_t size, unsigned long long *samples)
+{
+    struct sockaddr_un addr;
+    struct shm_ring ring;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0x0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, LOCAL_SOCKET, sizeof(addr.sun_path) - 1);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || shm_ring_receive(fd, &ring) < 0)
+    {
+        perror("local");
+        return -1;
+    }
+
+    char *record = (char *)malloc(size);
+    memset(record, 'l', size);
+
+    for (unsigned long i = 0; i < WARMUP_RECORDS + records; i++)
+    {
+        const unsigned long long t0 = now_ns();
+
+        while (!shm_ring_push(&ring, record, (uint32_t)size))
+        {
+            if (shm_ring_wait_space(&ring, fd, (uint32_t)size) < 0)
+            {
+                perror("local");
+                return -1;
+            }
+        }
+
+        // stored once the server freed the record
+        const uint64_t head = atomic_load_explicit(&ring.header->head, memory_order_relaxed);
+        while (atomic_load_explicit(&ring.header->tail, memory_order_acquire) != head)
+            sched_yield();
+
+        if (i >= WARMUP_RECORDS)
+            samples[i - WARMUP_RECORDS] = now_ns() - t0;
+    }
+
+    free(record);
+    shm_ring_destroy(&ring);
+    close(fd);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const unsigned long records = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_RECORDS;
+    const size_t size = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_RECORD_SIZE;
+
+    if (argc > 3 || records == 0 || size == 0 || size > FRAME_MAX_PAYLOAD)
+    {
+        fprintf(stderr, "Usage: %s [records] [record_size]\n", argv[0]);
+        return 1;
+    }
+
+    unsigned long long *samples = (unsigned long long *)malloc(records * sizeof(*samples));
+    if (samples == NULL)
+        return 1;
+
+    if (bench_tcp(records, size, samples) < 0)
+        return 1;
+    report("tcp", samples, records, size);
+
+    if (bench_local(records, size, samples) < 0)
+        return 1;
+    report("local", samples, records, size);
+
+    free(samples);
+
+    return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * Acts as server for the aesd
+ *
+ * The end offsets are stored in chunks that are allocated once and never reallocated,
+ * so a replay can look up records while new ones are added.
+ * Author: Heiko Schmidt
+ */
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "record-index.h"
+
+#define CHUNK_SHIFT 16U
+#define CHUNK_ENTRIES (1U << CHUNK_SHIFT)
+// 2^30 records at most
+#define MAX_CHUNKS 16384U
+
+static uint64_t *chunks[MAX_CHUNKS];
+static atomic_uint_fast64_t count = 0U;
+
+uint64_t record_index_add(uint64_t end)
+{
+    const uint64_t n = atomic_load_explicit(&count, memory_order_relaxed);
+    const uint64_t chunk = n >> CHUNK_SHIFT;
+
+    if (chunk >= MAX_CHUNKS)
+        return 0U;
+
+    if (chunks[chunk] == NULL)
+    {
+        chunks[chunk] = (uint64_t *)malloc(CHUNK_ENTRIES * sizeof(uint64_t));
+        if (chunks[chunk] == NULL)
+            return 0U;
+    }
+
+    chunks[chunk][n & (CHUNK_ENTRIES - 1U)] = end;
+    // publish the entry with the count
+    atomic_store_explicit(&count, n + 1U, memory_order_release);
+
+    return n + 1U;
+}
+
+uint64_t record_index_count(void)
+{
+    return atomic_load_explicit(&count, memory_order_acquire);
+}
+
+static uint64_t entry(uint64_t i)
+{
+    return chunks[i >> CHUNK_SHIFT][i & (CHUNK_ENTRIES - 1U)];
+}
+
+void record_index_range(uint64_t seq, uint64_t *start, uint64_t *end)
+{
+    *start = seq > 1U ? entry(seq - 2U) : 0U;
+    *end = entry(seq - 1U);
+}
+
+void record_index_free(void)
+{
+    for (unsigned int i = 0; i < MAX_CHUNKS && chunks[i] != NULL; i++)
+    {
+        free(chunks[i]);
+        chunks[i] = NULL;
+    }
+
+    atomic_store(&count, 0U);
+}
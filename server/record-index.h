@@ -0,0 +1,37 @@
+/*
+ * Acts as server for the aesd
+ * Author: Heiko Schmidt
+ */
+#ifndef RECORD_INDEX_H
+#define RECORD_INDEX_H
+
+#include <stdint.h>
+
+/**
+ * Sequence numbers of the records in the data file.  Record n, counting from 1, ends at
+ * the offset given to the n-th call of record_index_add().  Entries are never moved, so
+ * the ones below a count read under the file lock can be used after releasing it.
+ */
+
+/**
+ * Adds the next record ending at @param end, called with the file lock held
+ * @return the sequence number of the record, 0 if out of memory
+ */
+extern uint64_t record_index_add(uint64_t end);
+
+/**
+ * @return the sequence number of the last record, 0 if there is none
+ */
+extern uint64_t record_index_count(void);
+
+/**
+ * Gets the byte range of record @param seq, which must not be above a count returned before
+ */
+extern void record_index_range(uint64_t seq, uint64_t *start, uint64_t *end);
+
+/**
+ * Releases the index, no other function may be running
+ */
+extern void record_index_free(void);
+
+#endif /* RECORD_INDEX_H */
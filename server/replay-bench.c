@@ -0,0 +1,247 @@
+/*
+ * Loopback benchmark of the aesdsocket replay paths
+ *
+ * Replays a generated data file over a TCP loopback connection, drained by a receiver
+ * thread, and reports the CPU time the sending thread spends per replayed MB:
+ *   per-line       one send() per line, as replies were sent before
+ *   per-line-cork  the same with TCP_CORK around the reply
+ *   copy           a single send from the mapped file
+ *   zerocopy       a single MSG_ZEROCOPY send from the mapped file
+ * Prints one JSON object per mode.  On loopback the kernel has to copy zerocopy data
+ * for the receiver anyway, which is reported as "zerocopy_copied".
+ *
+ * Usage: replay-bench [file_mb] [rounds]
+ * Author: Heiko Schmidt
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "reply.h"
+
+#define DEFAULT_FILE_MB 16UL
+#define DEFAULT_ROUNDS 10UL
+#define NSEC_PER_SEC 1000000000ULL
+#define RECV_BUF_SIZE (1024U * 1024U)
+
+enum bench_mode
+{
+    MODE_PER_LINE,
+    MODE_PER_LINE_CORK,
+    MODE_COPY,
+    MODE_ZEROCOPY,
+};
+
+static const char *const mode_names[] = { "per-line", "per-line-cork", "copy", "zerocopy" };
+
+static unsigned long long now_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + (unsigned long long)ts.tv_nsec;
+}
+
+static void *drain(void *arg)
+{
+    const int fd = *(const int*)arg;
+    char *buf = (char*)malloc(RECV_BUF_SIZE);
+
+    if(buf == NULL)
+        return NULL;
+
+    while(recv(fd, buf, RECV_BUF_SIZE, 0) > 0)
+        ;
+
+    free(buf);
+    return NULL;
+}
+
+/**
+ * Fills a mapping with timestamp and text lines like the ones the server stores
+ */
+static char *make_data(size_t size)
+{
+    char *data = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    unsigned long line = 0;
+    size_t pos = 0;
+
+    if(data == MAP_FAILED)
+        return NULL;
+
+    while(pos < size) {
+        char buf[128];
+        int len = (line % 100 == 0) ?
+                snprintf(buf, sizeof(buf), "timestamp: Mon, 19 Oct 2026 12:00:%02lu +0000\n", line % 60) :
+                snprintf(buf, sizeof(buf), "packet %lu from a client of the aesd socket server\n", line);
+
+        if(pos + (size_t)len > size)
+            len = (int)(size - pos);
+        memcpy(&data[pos], buf, (size_t)len);
+        pos += (size_t)len;
+        line++;
+    }
+
+    if(size > 0)
+        data[size - 1] = '\n';
+
+    return data;
+}
+
+static int connect_loopback(int *send_fd, int *recv_fd)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int ret = -1;
+
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if(lfd < 0)
+        return -1;
+
+    memset(&addr, 0x0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if(bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(lfd, 1) < 0 ||
+            getsockname(lfd, (struct sockaddr*)&addr, &addr_len) < 0)
+        goto out;
+
+    *recv_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(*recv_fd < 0 || connect(*recv_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        goto out;
+
+    *send_fd = accept(lfd, NULL, NULL);
+    ret = *send_fd < 0 ? -1 : 0;
+
+out:
+    close(lfd);
+    return ret;
+}
+
+static int send_lines(int fd, const char *data, size_t size)
+{
+    size_t pos = 0;
+
+    while(pos < size) {
+        const char *nl = (const char*)memchr(&data[pos], '\n', size - pos);
+        const size_t len = nl != NULL ? (size_t)(nl - &data[pos]) + 1 : size - pos;
+
+        if(send(fd, &data[pos], len, MSG_NOSIGNAL) < 0)
+            return -1;
+        pos += len;
+    }
+
+    return 0;
+}
+
+static int run_mode(enum bench_mode mode, const char *data, size_t size, unsigned long rounds)
+{
+    int send_fd = -1, recv_fd = -1;
+    pthread_t receiver;
+    struct reply_sock reply;
+    struct rusage start, end;
+    bool copied = false;
+
+    if(connect_loopback(&send_fd, &recv_fd) < 0) {
+        perror("connect_loopback");
+        return -1;
+    }
+
+    reply_init(&reply, send_fd, mode == MODE_ZEROCOPY ? 1 : 0);
+
+    if(pthread_create(&receiver, NULL, drain, &recv_fd) != 0) {
+        close(send_fd);
+        close(recv_fd);
+        return -1;
+    }
+
+    getrusage(RUSAGE_THREAD, &start);
+    const unsigned long long t0 = now_ns(CLOCK_MONOTONIC);
+
+    for(unsigned long r = 0; r < rounds; r++) {
+        int rc;
+
+        switch(mode) {
+            case MODE_PER_LINE_CORK:
+                reply_cork(&reply, true);
+                rc = send_lines(send_fd, data, size);
+                reply_cork(&reply, false);
+                break;
+            case MODE_PER_LINE:
+                rc = send_lines(send_fd, data, size);
+                break;
+            default:
+                // measure the zerocopy path even after the kernel reported copying
+                if(mode == MODE_ZEROCOPY && !reply.zerocopy) {
+                    copied = true;
+                    reply.zerocopy = true;
+                }
+                rc = reply_send(&reply, data, size);
+                break;
+        }
+
+        if(rc < 0) {
+            perror("send");
+            break;
+        }
+    }
+
+    const unsigned long long wall = now_ns(CLOCK_MONOTONIC) - t0;
+    getrusage(RUSAGE_THREAD, &end);
+
+    if(mode == MODE_ZEROCOPY && !reply.zerocopy)
+        copied = true;
+
+    shutdown(send_fd, SHUT_WR);
+    pthread_join(receiver, NULL);
+    close(send_fd);
+    close(recv_fd);
+
+    const double cpu_ms = ((end.ru_utime.tv_sec - start.ru_utime.tv_sec) + (end.ru_stime.tv_sec - start.ru_stime.tv_sec)) * 1e3 +
+            ((end.ru_utime.tv_usec - start.ru_utime.tv_usec) + (end.ru_stime.tv_usec - start.ru_stime.tv_usec)) / 1e3;
+    const double mb = (double)size * (double)rounds / (1024.0 * 1024.0);
+
+    printf("{\"bench\": \"replay\", \"mode\": \"%s\", \"mb\": %.0f, \"cpu_ms_per_mb\": %.3f, \"gb_per_s\": %.3f",
+            mode_names[mode], mb, cpu_ms / mb, (double)size * (double)rounds / (double)wall);
+    if(mode == MODE_ZEROCOPY)
+        printf(", \"zerocopy_copied\": %s", copied ? "true" : "false");
+    printf("}\n");
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const unsigned long file_mb = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_FILE_MB;
+    const unsigned long rounds = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_ROUNDS;
+
+    if(argc > 3 || file_mb == 0 || rounds == 0) {
+        fprintf(stderr, "Usage: %s [file_mb] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    const size_t size = file_mb * 1024UL * 1024UL;
+    char *data = make_data(size);
+    if(data == NULL) {
+        fprintf(stderr, "Unable to allocate data\n");
+        return 1;
+    }
+
+    for(int mode = MODE_PER_LINE; mode <= MODE_ZEROCOPY; mode++) {
+        if(run_mode((enum bench_mode)mode, data, size, rounds) < 0)
+            return 1;
+    }
+
+    munmap(data, size);
+
+    return 0;
+}
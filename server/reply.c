@@ -0,0 +1,227 @@
+/*
+ * Acts as server for the aesd
+ *
+ * Large replies are sent with MSG_ZEROCOPY: the kernel references the pages instead of
+ * copying them into the socket buffer and reports on the error queue of the socket when
+ * they are released.  Below the threshold the page pinning and notification cost more
+ * than the copy.
+ * Author: Heiko Schmidt
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
+
+#include "reply.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+// zerocopy sends are split so the pages pinned at once stay bounded
+#define ZEROCOPY_CHUNK (1024U * 1024U)
+
+void reply_init(struct reply_sock *reply, int fd, size_t zerocopy_threshold)
+{
+    int enable = 1;
+
+    memset(reply, 0x0, sizeof(*reply));
+    reply->fd = fd;
+    reply->zerocopy_threshold = zerocopy_threshold;
+
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable)) < 0)
+        syslog(LOG_ERR, "Error setting TCP_NODELAY: %s", strerror(errno));
+
+    reply->zerocopy = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0;
+}
+
+void reply_cork(struct reply_sock *reply, bool cork)
+{
+    int value = cork ? 1 : 0;
+
+    if (reply->corked == cork)
+        return;
+
+    if (setsockopt(reply->fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value)) == 0)
+        reply->corked = cork;
+}
+
+/**
+ * Reads the zerocopy notifications from the error queue of the socket
+ * @return 0 if the queue is drained, -1 on errors
+ */
+static int reap_completions(struct reply_sock *reply)
+{
+    for (;;)
+    {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + CMSG_SPACE(sizeof(struct sockaddr_in6))];
+        struct msghdr msg;
+
+        memset(&msg, 0x0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(reply->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            const struct sock_extended_err *ee = (const struct sock_extended_err *)CMSG_DATA(cm);
+
+            if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            // the notification covers the range of send ids ee_info to ee_data
+            reply->zc_completed = ee->ee_data + 1;
+
+            // the data was copied after all, further zerocopy sends only add overhead
+            if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                reply->zerocopy = false;
+        }
+    }
+}
+
+/**
+ * Blocks until the kernel released all pages of earlier zerocopy sends
+ */
+static int wait_completions(struct reply_sock *reply)
+{
+    while (reply->zc_completed != reply->zc_sent)
+    {
+        // the error queue is signalled as POLLERR, which is reported without asking
+        struct pollfd pfd = { .fd = reply->fd, .events = 0, .revents = 0 };
+
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+            return -1;
+
+        if (reap_completions(reply) < 0)
+            return -1;
+
+        // a reset connection will not deliver the outstanding notifications anymore
+        if ((pfd.revents & (POLLHUP | POLLNVAL)) && reply->zc_completed != reply->zc_sent)
+        {
+            errno = EPIPE;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int reply_send(struct reply_sock *reply, const void *buf, size_t len)
+{
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+
+    return reply_sendv(reply, &iov, 1);
+}
+
+int reply_sendv(struct reply_sock *reply, struct iovec *iov, int iovcnt)
+{
+    size_t len = 0;
+    int ret = 0;
+
+    for (int i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+
+    const bool zerocopy = reply->zerocopy && reply->zerocopy_threshold > 0 && len >= reply->zerocopy_threshold;
+    // the chunks of a split reply are sent as full segments
+    const bool cork = ((zerocopy && len > ZEROCOPY_CHUNK) || iovcnt > IOV_MAX) && !reply->corked;
+
+    if (cork)
+        reply_cork(reply, true);
+
+    while (len > 0)
+    {
+        struct msghdr msg;
+        size_t chunk = 0;
+        int cnt = 0;
+
+        // skip the parts sent completely
+        while (iov->iov_len == 0)
+        {
+            iov++;
+            iovcnt--;
+        }
+
+        // zerocopy sends pin at most a chunk of pages at once
+        while (cnt < iovcnt && cnt < IOV_MAX && (!zerocopy || chunk < ZEROCOPY_CHUNK))
+            chunk += iov[cnt++].iov_len;
+
+        const size_t last_len = iov[cnt - 1].iov_len;
+        if (zerocopy && chunk > ZEROCOPY_CHUNK)
+            iov[cnt - 1].iov_len -= chunk - ZEROCOPY_CHUNK;
+
+        memset(&msg, 0x0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t)cnt;
+
+        ssize_t rc = sendmsg(reply->fd, &msg, MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+
+        iov[cnt - 1].iov_len = last_len;
+
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // out of optmem for the notifications, make room and retry
+            if (errno == ENOBUFS && zerocopy && reply->zc_sent != reply->zc_completed)
+            {
+                if (wait_completions(reply) < 0)
+                    return -1;
+                continue;
+            }
+            ret = -1;
+            break;
+        }
+
+        // every successful zerocopy send consumes one notification id
+        if (zerocopy)
+            reply->zc_sent++;
+
+        len -= (size_t)rc;
+
+        // advance behind the bytes sent, partially sent parts are continued
+        for (size_t left = (size_t)rc; left > 0; )
+        {
+            const size_t n = left < iov->iov_len ? left : iov->iov_len;
+
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+            left -= n;
+            if (iov->iov_len == 0 && left > 0)
+            {
+                iov++;
+                iovcnt--;
+            }
+        }
+    }
+
+    if (cork)
+        reply_cork(reply, false);
+
+    if (zerocopy)
+    {
+        const int saved_errno = errno;
+        if (wait_completions(reply) < 0)
+            return -1;
+        errno = saved_errno;
+    }
+
+    return ret;
+}
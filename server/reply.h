@@ -0,0 +1,66 @@
+/*
+ * Acts as server for the aesd
+ * Author: Heiko Schmidt
+ */
+#ifndef REPLY_H
+#define REPLY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+// default size from which replies are sent with MSG_ZEROCOPY
+#define REPLY_ZEROCOPY_THRESHOLD (64U * 1024U)
+
+/**
+ * Send side state of a client socket
+ */
+struct reply_sock
+{
+    int fd;
+    /**
+     * SO_ZEROCOPY is enabled and worth using, cleared when the kernel reports it had to
+     * copy anyway, e.g. on loopback
+     */
+    bool zerocopy;
+    /**
+     * Replies of at least this many bytes use MSG_ZEROCOPY, 0 disables it.  Can be
+     * changed between sends.
+     */
+    size_t zerocopy_threshold;
+    // ids of zerocopy sends issued and completed, as counted by the kernel
+    uint32_t zc_sent;
+    uint32_t zc_completed;
+    bool corked;
+};
+
+/**
+ * Sets TCP_NODELAY on @param fd, so small replies leave immediately, and enables
+ * SO_ZEROCOPY if supported.  Replies larger than @param zerocopy_threshold are sent
+ * with MSG_ZEROCOPY.
+ */
+extern void reply_init(struct reply_sock *reply, int fd, size_t zerocopy_threshold);
+
+/**
+ * Sends all @param len bytes of @param buf.  From the zerocopy threshold on, the pages are
+ * sent with MSG_ZEROCOPY and the call returns once the kernel has released them, so
+ * @param buf may be unmapped afterwards.
+ * @return 0 on success, -1 with errno set otherwise
+ */
+extern int reply_send(struct reply_sock *reply, const void *buf, size_t len);
+
+/**
+ * Sends the @param iovcnt parts of @param iov like reply_send() sends a single buffer,
+ * @param iov is consumed in the process
+ * @return 0 on success, -1 with errno set otherwise
+ */
+extern int reply_sendv(struct reply_sock *reply, struct iovec *iov, int iovcnt);
+
+/**
+ * Holds back partial segments while a reply is sent in several parts, uncorking flushes
+ * them.
+ */
+extern void reply_cork(struct reply_sock *reply, bool cork);
+
+#endif /* REPLY_H */
@@ -2,14 +2,24 @@
  * Acts as server for the aesd
  * Author: Heiko Schmidt
  */
+#define _GNU_SOURCE
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/un.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
+#include <poll.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <time.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <syslog.h>
@@ -18,11 +28,39 @@
 #include <stdio.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <sys/queue.h>
 #include <netinet/in.h>
 
+#include "prof-mutex.h"
+#include "config.h"
+#include "subscription.h"
+#include "reply.h"
+#include "record-index.h"
+#include "frame.h"
+#include "shm-ring.h"
+#include "handoff.h"
+#include "server.h"
+
 #define DATAFILE "/var/tmp/aesdsocketdata"
-#define LOCAL_LINE_BUF_SIZE 512
+// holds the UNIX sockets, created for and owned by the user running the server
+#define RUNTIME_DIR "/var/run/aesdsocket"
+// clients on the same host connect here for a shared memory ring, if enabled
+#define LOCAL_SOCKET RUNTIME_DIR "/local.sock"
+// a new process connects here to take over the server, if enabled
+#define HANDOFF_SOCKET RUNTIME_DIR "/upgrade.sock"
+// record end offsets per handoff message
+#define HANDOFF_INDEX_CHUNK 4096U
+// the old process resumes serving if the new one stalls for this long during a handoff
+#define HANDOFF_TIMEOUT_S 5
+// a line consisting of this turns the connection into a subscription, it is not stored
+#define SUBSCRIBE_COMMAND "AESD_SUBSCRIBE\n"
+// lines collected for a single append and reply at most when coalescing
+#define COALESCE_MAX_BYTES (1024U * 1024U)
+// receive buffer of a binary connection, grown for larger records
+#define FRAME_RX_BUFFER_SIZE (256U * 1024U)
+// records replayed with one send and drained from a ring per write at most, two parts each
+#define FRAME_BATCH_RECORDS (IOV_MAX / 2)
 #define TIME_FORMAT_BUF_SIZE 64
 
 #define TIMESTAMP_LOG_CYCLE_S 10U
@@ -37,9 +75,22 @@ typedef struct thread_data_s
     pthread_t id;
     pthread_mutex_t *mutex;
     int client_sock;
+    struct reply_sock reply;
     char client_ip[INET_ADDRSTRLEN];
-    volatile bool *stop_thread;
-    
+    atomic_bool *stop_thread;
+    // set by the connection thread before it exits, the thread is joined by the server loop
+    atomic_bool done;
+    // served by handle_local()
+    bool local;
+    // last record sent to a subscriber
+    uint64_t sent_seq;
+    /**
+     * State a connection thread stopped with for a handoff, or resumes from.  handoff_data
+     * holds the received bytes not processed yet, ring_fds the ring of a local client.
+     */
+    struct handoff_conn handoff;
+    char *handoff_data;
+    int ring_fds[3];
 } thread_data_t;
 
 typedef struct slist_data_s
@@ -49,21 +100,82 @@ typedef struct slist_data_s
 } slist_data_t;
 
 static int srv_sock = -1;
+static int local_sock = -1;
+static int handoff_sock = -1;
+
+// the data file, appended to and mapped for replays with the file lock held
+static int data_fd = -1;
 
 static SLIST_HEAD(slisthead, slist_data_s) list;
+// connections received from the previous process, started with the timer thread
+static struct slisthead resumed = SLIST_HEAD_INITIALIZER(resumed);
 
-static volatile bool stop_threads = false;
+static atomic_bool stop_threads = false;
 
 static pthread_t timer_thread;
 
 static pthread_mutex_t file_mutex;
 
+// written by exiting connection threads to wake up the server loop
+static int worker_exit_fd = -1;
+static unsigned int worker_count = 0U;
+
+// readable while the connection threads are asked to stop for a handoff
+static int handoff_fd = -1;
+static atomic_bool handoff_requested = false;
+// the sockets and the data file belong to a new process now
+static bool handed_off = false;
+
+// settings changed by configure_server(), picked up by running connections
+static atomic_size_t recv_buffer_size = 512U;
+static atomic_uint max_workers = 0U;
+static atomic_size_t replay_lines = 0U;
+static atomic_uint coalesce_replies = 0U;
+static atomic_size_t zerocopy_threshold = REPLY_ZEROCOPY_THRESHOLD;
+static atomic_size_t local_ring_size = SHM_RING_DEFAULT_SIZE;
+static atomic_uint local_spin_us = 0U;
+// polling a ring only pays off with a core left for the client
+static bool spin_allowed = false;
+// only read at start
+static bool local_clients = false;
+static bool hot_upgrade = false;
+
+// bytes in the data file, changed with the file lock held
+static uint64_t data_size = 0U;
+
 static void *handle_connection(void *data);
+static void *handle_local(void *data);
+static void worker_done(thread_data_t *thread_data);
 static void *log_timestamp(void *data);
 static void write_line_to_file(pthread_mutex_t *mutex, const char *const line);
-static void send_all_lines(pthread_mutex_t *mutex, const int sock);
-
-int init_server_stage1(void)
+static uint64_t append_records(pthread_mutex_t *mutex, const struct iovec *records, int count, bool lines);
+/**
+ * Snapshot of the lines to send back, mapped from the data file
+ */
+typedef struct replay_s
+{
+    void *map;
+    size_t map_len;
+    size_t start;
+    // sequence number of the last record mapped
+    uint64_t last_seq;
+} replay_t;
+
+static int send_all_lines(thread_data_t *thread_data);
+static int prepare_replay_locked(replay_t *replay);
+static int send_replay(thread_data_t *thread_data, replay_t *replay);
+static int subscribe_client(thread_data_t *thread_data, struct subscriber *sub, bool resume);
+static int send_subscribed(thread_data_t *thread_data, struct subscriber *sub);
+static int commit_lines(thread_data_t *thread_data, char *lines, size_t *len, bool reply);
+static void serve_binary(thread_data_t *thread_data, const char *data, size_t len, bool negotiated);
+static int send_binary_replay(thread_data_t *thread_data, uint64_t from_seq);
+static int send_ack(thread_data_t *thread_data, uint64_t seq);
+static int handoff_server(void);
+
+/**
+ * Sets up the state a started and an upgraded server have in common
+ */
+static void init_common(void)
 {
     // initialize list of threads
     SLIST_INIT(&list);
@@ -74,11 +186,113 @@ int init_server_stage1(void)
         exit(EXIT_FAILURE);
     }
 
+    spin_allowed = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+
+    worker_exit_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    handoff_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (worker_exit_fd < 0 || handoff_fd < 0)
+    {
+        syslog(LOG_ERR, "Error creating eventfd: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Creates a listening UNIX socket of @param type at @param path, replacing a stale one
+ * of a previous run
+ */
+static int listen_unix(const char *path, int type, mode_t mode)
+{
+    struct sockaddr_un addr;
+
+    memset(&addr, 0x0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    unlink(path);
+    int sock = socket(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || chmod(path, mode) < 0 ||
+            listen(sock, 100) < 0)
+    {
+        syslog(LOG_ERR, "Error setting up socket %s: %s", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    return sock;
+}
+
+/**
+ * Creates RUNTIME_DIR unless it exists, and makes sure only the user running the server
+ * can create or replace sockets in there
+ */
+static void create_runtime_dir(void)
+{
+    struct stat st;
+
+    if (mkdir(RUNTIME_DIR, 0755) < 0 && errno != EEXIST)
+    {
+        syslog(LOG_ERR, "Error creating %s: %s", RUNTIME_DIR, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (lstat(RUNTIME_DIR, &st) < 0 || !S_ISDIR(st.st_mode) || st.st_uid != geteuid() ||
+            (st.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+    {
+        syslog(LOG_ERR, "%s must be a directory only writable by uid %d", RUNTIME_DIR, (int)geteuid());
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Opens the UNIX sockets enabled in the configuration which are not open yet, and closes
+ * those taken over from a previous process which are disabled now
+ */
+static void setup_unix_sockets(void)
+{
+    if ((local_clients && local_sock < 0) || (hot_upgrade && handoff_sock < 0))
+        create_runtime_dir();
+
+    if (local_clients && local_sock < 0)
+    {
+        local_sock = listen_unix(LOCAL_SOCKET, SOCK_STREAM, 0660);
+    }
+    else if (!local_clients && local_sock >= 0)
+    {
+        close(local_sock);
+        local_sock = -1;
+        unlink(LOCAL_SOCKET);
+    }
+
+    if (hot_upgrade && handoff_sock < 0)
+    {
+        // whoever connects here takes over the server
+        handoff_sock = listen_unix(HANDOFF_SOCKET, SOCK_SEQPACKET, 0600);
+    }
+    else if (!hot_upgrade && handoff_sock >= 0)
+    {
+        close(handoff_sock);
+        handoff_sock = -1;
+        unlink(HANDOFF_SOCKET);
+    }
+}
+
+int init_server_stage1(void)
+{
+    init_common();
+
     // delete file
     remove(DATAFILE);
-    
+
+    data_fd = open(DATAFILE, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+    if (data_fd < 0)
+    {
+        syslog(LOG_ERR, "Error opening file: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
     // get the socket
-    srv_sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    srv_sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 
     if (srv_sock < 0)
     {
@@ -116,12 +330,13 @@ int init_server_stage1(void)
         exit(EXIT_FAILURE);
     }
 
+    setup_unix_sockets();
+
     return 0;
 }
 
-int init_server_stage2(void)
+static void start_timer(void)
 {
-    // start timer thread
     thread_data_t *data = (thread_data_t*)malloc(sizeof(thread_data_t));
     if(data == NULL) {
         syslog(LOG_ERR, "Error getting thread data: %s", strerror(errno));
@@ -136,53 +351,213 @@ int init_server_stage2(void)
         syslog(LOG_ERR, "Error creating timer thread");
         exit(EXIT_FAILURE);
     }
+}
+
+static void start_worker(slist_data_t *data);
+
+int init_server_stage2(void)
+{
+    start_timer();
+
+    // connections taken over from the previous process
+    while (!SLIST_EMPTY(&resumed))
+    {
+        slist_data_t *e = SLIST_FIRST(&resumed);
+        SLIST_REMOVE_HEAD(&resumed, entries);
+
+        start_worker(e);
+        SLIST_INSERT_HEAD(&list, e, entries);
+        worker_count++;
+    }
 
     return 0;
 }
 
-int process_server(void)
+void configure_server(const struct server_config *config)
+{
+    atomic_store(&recv_buffer_size, config->recv_buffer_size);
+    atomic_store(&max_workers, config->max_workers);
+    atomic_store(&replay_lines, config->replay_lines);
+    atomic_store(&coalesce_replies, config->coalesce_replies);
+    atomic_store(&zerocopy_threshold, config->zerocopy_threshold);
+    atomic_store(&local_ring_size, config->local_ring_size);
+    atomic_store(&local_spin_us, config->local_spin_us);
+    local_clients = config->local_clients != 0U;
+    hot_upgrade = config->hot_upgrade != 0U;
+}
+
+/**
+ * Closes the descriptors of a joined connection thread and frees its entry
+ */
+static void free_worker(slist_data_t *e)
+{
+    close(e->thread_data.client_sock);
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (e->thread_data.ring_fds[i] >= 0)
+            close(e->thread_data.ring_fds[i]);
+    }
+
+    free(e->thread_data.handoff_data);
+    free(e);
+}
+
+static void reap_workers(void)
+{
+    uint64_t count;
+
+    // reset the eventfd before looking at the flags, so no exit is missed
+    (void)read(worker_exit_fd, &count, sizeof(count));
+
+    slist_data_t *e = SLIST_FIRST(&list);
+    while(e != NULL) {
+        slist_data_t *next = SLIST_NEXT(e, entries);
+
+        if(atomic_load(&e->thread_data.done)) {
+            SLIST_REMOVE(&list, e, slist_data_s, entries);
+            pthread_join(e->thread_data.id, NULL);
+            free_worker(e);
+            worker_count--;
+        }
+
+        e = next;
+    }
+}
+
+static bool workers_available(void)
+{
+    const unsigned int limit = atomic_load(&max_workers);
+
+    return limit == 0U || worker_count < limit;
+}
+
+/**
+ * Allocates the list entry of a connection on @param client_sock
+ */
+static slist_data_t *new_worker(int client_sock, const char *client_ip, bool local)
+{
+    slist_data_t *data = (slist_data_t*)malloc(sizeof(slist_data_t));
+    if(data == NULL) {
+        syslog(LOG_ERR, "Unable to get data for slist entry: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    memset((void*)&data->thread_data, 0x0, sizeof(thread_data_t));
+    atomic_init(&data->thread_data.done, false);
+
+    snprintf(data->thread_data.client_ip, sizeof(data->thread_data.client_ip), "%s", client_ip);
+    data->thread_data.client_sock = client_sock;
+    data->thread_data.mutex = &file_mutex;
+    data->thread_data.stop_thread = &stop_threads;
+    data->thread_data.local = local;
+    for (int i = 0; i < 3; i++)
+        data->thread_data.ring_fds[i] = -1;
+
+    return data;
+}
+
+/**
+ * Starts the connection thread of @param data, which resumes from its handoff state
+ */
+static void start_worker(slist_data_t *data)
+{
+    void *(*handler)(void *) = data->thread_data.local ? handle_local : handle_connection;
+
+    atomic_store(&data->thread_data.done, false);
+
+    // spawn thread for socket
+    if(pthread_create(&(data->thread_data.id), NULL, handler, (void*)&data->thread_data) < 0) {
+        syslog(LOG_ERR, "Error creating client thread");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void spawn_worker(int client_sock, const char *client_ip, bool local)
 {
-    // wait for next client connection
-    struct sockaddr_in client_addr;
-    socklen_t l = sizeof(struct sockaddr);
+    slist_data_t *data = new_worker(client_sock, client_ip, local);
+
+    start_worker(data);
+
+    SLIST_INSERT_HEAD(&list, data, entries);
+    worker_count++;
+}
 
-    int client_sock = accept(srv_sock, (struct sockaddr *)&client_addr, &l);
-    if (client_sock < 0 && errno != EWOULDBLOCK && errno != EAGAIN)
+int process_server(int wake_fd)
+{
+    struct pollfd fds[5];
+
+    // at the worker limit, new clients stay in the backlog until a connection closes
+    fds[0].fd = srv_sock;
+    fds[0].events = workers_available() ? POLLIN : 0;
+    fds[1].fd = worker_exit_fd;
+    fds[1].events = POLLIN;
+    fds[2].fd = wake_fd;
+    fds[2].events = POLLIN;
+    fds[3].fd = local_sock;
+    fds[3].events = fds[0].events;
+    fds[4].fd = handoff_sock;
+    fds[4].events = POLLIN;
+
+    if (poll(fds, 5, -1) < 0)
     {
-        syslog(LOG_ERR, "Error on accept: %s", strerror(errno));
+        if (errno == EINTR)
+            return 0;
+        syslog(LOG_ERR, "Error on poll: %s", strerror(errno));
         return -1;
     }
-    
-    if(client_sock >= 0) {
-        // spawn thread for socket
-        slist_data_t *data = (slist_data_t*)malloc(sizeof(slist_data_t));
-        if(data == NULL) {
-            syslog(LOG_ERR, "Unable to get data for slist entry: %s", strerror(errno));
-            exit(EXIT_FAILURE);
+
+    if (fds[1].revents & POLLIN)
+        reap_workers();
+
+    while ((fds[0].revents & POLLIN) && workers_available())
+    {
+        // wait for next client connection
+        struct sockaddr_in client_addr;
+        socklen_t l = sizeof(struct sockaddr);
+        char client_ip[INET_ADDRSTRLEN];
+
+        int client_sock = accept4(srv_sock, (struct sockaddr *)&client_addr, &l, SOCK_CLOEXEC);
+        if (client_sock < 0)
+        {
+            if (errno == EWOULDBLOCK || errno == EAGAIN || errno == ECONNABORTED)
+                break;
+            syslog(LOG_ERR, "Error on accept: %s", strerror(errno));
+            return -1;
         }
-        memset((void*)&data->thread_data, 0x0, sizeof(thread_data_t));
-        
+
         // log new connection
-        if (inet_ntop(AF_INET, (const void *)&client_addr.sin_addr, data->thread_data.client_ip, INET_ADDRSTRLEN) == NULL)
+        if (inet_ntop(AF_INET, (const void *)&client_addr.sin_addr, client_ip, INET_ADDRSTRLEN) == NULL)
         {
             syslog(LOG_ERR, "Error getting IP string: %s", strerror(errno));
+            close(client_sock);
             return -1;
         }
-        syslog(LOG_INFO, "Accepted connection from %s", data->thread_data.client_ip);
+        syslog(LOG_INFO, "Accepted connection from %s", client_ip);
 
-        data->thread_data.client_sock = client_sock;
-        data->thread_data.mutex = &file_mutex;
-        data->thread_data.stop_thread = &stop_threads;
+        spawn_worker(client_sock, client_ip, false);
+    }
 
-        if(pthread_create(&(data->thread_data.id), NULL, &handle_connection, (void*)&data->thread_data) < 0) {
-            syslog(LOG_ERR, "Error creating client thread");
-            exit(EXIT_FAILURE);
+    while ((fds[3].revents & POLLIN) && workers_available())
+    {
+        int client_sock = accept4(local_sock, NULL, NULL, SOCK_CLOEXEC);
+        if (client_sock < 0)
+        {
+            if (errno == EWOULDBLOCK || errno == EAGAIN || errno == ECONNABORTED)
+                break;
+            syslog(LOG_ERR, "Error on accept: %s", strerror(errno));
+            return -1;
         }
+        syslog(LOG_INFO, "Accepted local connection");
 
-        SLIST_INSERT_HEAD(&list, data, entries);
+        spawn_worker(client_sock, "local", true);
     }
-    
-    return 0;
+
+    // the clients still in the backlog are accepted by the new process
+    if ((fds[4].revents & POLLIN) && handoff_server() == 0)
+        return SERVER_HANDED_OFF;
+
+    // the signalfd is left for the caller to read
+    return (fds[2].revents & POLLIN) ? 1 : 0;
 }
 
 void join_all_threads(void)
@@ -194,182 +569,1396 @@ void join_all_threads(void)
     if(data != NULL)
         free(data);
     
+    // wake up connection threads blocked in poll or send, their sockets are closed after the join
     slist_data_t *e = NULL;
     SLIST_FOREACH(e, &list, entries) {
-        if(e != NULL) {
-            pthread_join(e->thread_data.id, NULL);
-        }
+        shutdown(e->thread_data.client_sock, SHUT_RDWR);
+    }
+
+    SLIST_FOREACH(e, &list, entries) {
+        pthread_join(e->thread_data.id, NULL);
     }
     
     // delete list entries
     while (!SLIST_EMPTY(&list)) {
        e = SLIST_FIRST(&list);
        SLIST_REMOVE_HEAD(&list, entries);
-       free(e);
+       free_worker(e);
    }
+   worker_count = 0U;
 }
 
 void shutdown_server(void)
 {
-    stop_threads = true;
+    atomic_store(&stop_threads, true);
 
-    join_all_threads();
+    // after a handoff, all threads are joined already
+    if (!handed_off)
+        join_all_threads();
 
     // close server socket
     if (srv_sock >= 0)
         close(srv_sock);
 
-    // delete file
-    remove(DATAFILE);
-}
-
-static void* handle_connection(void *data)
-{
-    thread_data_t *thread_data = (thread_data_t*)data;
-    char *line_buf = NULL;
-    uint32_t cur_buf_len = 0;
-    
-    // set receive timeout on socket to avoid blocking infinitely
-    struct timeval tv;
-    tv.tv_sec = 0;
-    tv.tv_usec = 10000;
-    if(setsockopt(thread_data->client_sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv) < 0) {
-        syslog(LOG_ERR, "Error setting socket option: %s", strerror(errno));
-        goto clean;
+    // the socket files and the data file are used by the new process after a handoff
+    if (local_sock >= 0)
+    {
+        close(local_sock);
+        if (!handed_off)
+            unlink(LOCAL_SOCKET);
     }
-    
-    while(!(*thread_data->stop_thread)) {
 
-        char local_buf[LOCAL_LINE_BUF_SIZE + 1];
-        memset(&local_buf[0], 0x0, LOCAL_LINE_BUF_SIZE + 1);
+    if (handoff_sock >= 0)
+    {
+        close(handoff_sock);
+        if (!handed_off)
+            unlink(HANDOFF_SOCKET);
+    }
 
-        ssize_t recv_len = recv(thread_data->client_sock, &local_buf[0], LOCAL_LINE_BUF_SIZE, 0);
+    if (worker_exit_fd >= 0)
+        close(worker_exit_fd);
 
-        if (recv_len < 0)
-        {
-            if(errno != EAGAIN && errno != EWOULDBLOCK) {
-                syslog(LOG_ERR, "Error on recv call: %s", strerror(errno));
-                break;
-            }
-            
-            // timeout received
-            continue;
-        } else if (recv_len == 0) {
-            syslog(LOG_INFO, "Closed connection from %s", thread_data->client_ip);
-            break;
-        }
+    if (handoff_fd >= 0)
+        close(handoff_fd);
 
-        for (uint32_t local_start_pos = 0; local_start_pos < recv_len; ++local_start_pos)
-        {
-            // check for \n
-            uint32_t npos;
-            for (npos = 0; npos < recv_len; ++npos)
-                if (local_buf[npos] == '\n')
-                    break;
+    if (data_fd >= 0)
+        close(data_fd);
 
-            // resize line buffer
-            line_buf = (char *)realloc(line_buf, cur_buf_len + npos + 2);
+    // delete file
+    if (!handed_off)
+        remove(DATAFILE);
+    record_index_free();
 
-            if (line_buf == NULL)
-            {
-                syslog(LOG_ERR, "Error re-allocating memory: %s", strerror(errno));
-                goto clean;
-            }
+    // write lock statistics to syslog, no-op unless built with PROF_MUTEX
+    prof_mutex_dump();
+}
 
-            // zero newly allocated memory
-            memset(&line_buf[cur_buf_len], 0x0, npos + 2);
+/**
+ * Asks all connection threads to stop between packets and joins them.  The connections
+ * closed meanwhile are removed, the others are left with their handoff state.
+ */
+static void quiesce_workers(void)
+{
+    const uint64_t one = 1;
+    slist_data_t *e;
 
-            // copy line until \n inclusive
-            memcpy(&line_buf[cur_buf_len], local_buf, npos + 1);
+    atomic_store(&handoff_requested, true);
+    (void)write(handoff_fd, &one, sizeof(one));
 
-            // only if \n has been found, write to file and return
-            if (npos < recv_len)
-            {
-                write_line_to_file(thread_data->mutex, line_buf);
-                send_all_lines(thread_data->mutex, thread_data->client_sock);
+    for (;;)
+    {
+        struct pollfd pfd = { .fd = worker_exit_fd, .events = POLLIN, .revents = 0 };
+        uint64_t count;
+        bool all_done = true;
 
-                // reset the buffer
-                free(line_buf);
-                line_buf = NULL;
-                cur_buf_len = 0;
-            }
+        // reset the eventfd before looking at the flags, so no exit is missed
+        (void)read(worker_exit_fd, &count, sizeof(count));
 
-            local_start_pos += npos;
+        SLIST_FOREACH(e, &list, entries) {
+            all_done = all_done && atomic_load(&e->thread_data.done);
         }
+
+        if (all_done)
+            break;
+
+        (void)poll(&pfd, 1, -1);
     }
 
-clean:
-    if(thread_data->client_sock >= 0)
-        close(thread_data->client_sock);
+    e = SLIST_FIRST(&list);
+    while (e != NULL) {
+        slist_data_t *next = SLIST_NEXT(e, entries);
 
-    return NULL;
+        pthread_join(e->thread_data.id, NULL);
+        if (e->thread_data.handoff.mode == HANDOFF_NONE) {
+            SLIST_REMOVE(&list, e, slist_data_s, entries);
+            free_worker(e);
+            worker_count--;
+        }
+
+        e = next;
+    }
 }
 
-static void write_line_to_file(pthread_mutex_t *mutex, const char *const line)
+/**
+ * Restarts the threads stopped by quiesce_workers() after a failed handoff
+ */
+static void resume_workers(void)
 {
-    if(pthread_mutex_lock(mutex) < 0) {
-        syslog(LOG_ERR, "Error locking mutex");
-        exit(EXIT_FAILURE);
+    uint64_t count;
+    slist_data_t *e;
+
+    atomic_store(&handoff_requested, false);
+    (void)read(handoff_fd, &count, sizeof(count));
+
+    atomic_store(&stop_threads, false);
+    start_timer();
+
+    SLIST_FOREACH(e, &list, entries) {
+        start_worker(e);
     }
+}
+
+static int send_handoff(int sock)
+{
+    uint64_t ends[HANDOFF_INDEX_CHUNK];
+    slist_data_t *e;
+    struct handoff_state state;
+
+    memset(&state, 0x0, sizeof(state));
+    state.magic = HANDOFF_MAGIC;
+    state.version = HANDOFF_VERSION;
+    state.data_size = data_size;
+    state.records = record_index_count();
+    state.connections = worker_count;
+    state.flags = local_sock >= 0 ? HANDOFF_HAS_LOCAL_SOCKET : 0U;
+
+    const int fds[HANDOFF_MAX_FDS] = { srv_sock, handoff_sock, data_fd, local_sock };
+    if (handoff_send_msg(sock, &state, sizeof(state), fds, local_sock >= 0 ? 4 : 3) < 0)
+        return -1;
 
-    // open the socketdata file
-    FILE *fp = fopen(DATAFILE, "a+");
-    if (fp == NULL)
+    for (uint64_t seq = 1U; seq <= state.records; )
     {
-        syslog(LOG_ERR, "Error opening file: %s", strerror(errno));
-        exit(EXIT_FAILURE);
+        unsigned int n;
+
+        for (n = 0; n < HANDOFF_INDEX_CHUNK && seq <= state.records; n++, seq++)
+        {
+            uint64_t start;
+            record_index_range(seq, &start, &ends[n]);
+        }
+
+        if (handoff_send_data(sock, ends, n * sizeof(ends[0])) < 0)
+            return -1;
     }
 
-    if (fputs(line, fp) < 0)
-    {
-        syslog(LOG_ERR, "Eror writing to file: %s", strerror(errno));
-        exit(EXIT_FAILURE);
+    SLIST_FOREACH(e, &list, entries) {
+        thread_data_t *thread_data = &e->thread_data;
+        int conn_fds[HANDOFF_MAX_FDS] = { thread_data->client_sock, -1, -1, -1 };
+        const int nfds = thread_data->handoff.mode == HANDOFF_LOCAL ? 4 : 1;
+
+        memcpy(&conn_fds[1], thread_data->ring_fds, sizeof(thread_data->ring_fds));
+        memcpy(thread_data->handoff.client_ip, thread_data->client_ip, sizeof(thread_data->client_ip));
+
+        if (handoff_send_msg(sock, &thread_data->handoff, sizeof(thread_data->handoff), conn_fds, nfds) < 0 ||
+                handoff_send_data(sock, thread_data->handoff_data, thread_data->handoff.data_len) < 0)
+            return -1;
     }
 
-    fclose(fp);
+    // the new process confirms once it has taken everything over
+    char ack;
+    const ssize_t rc = recv(sock, &ack, sizeof(ack), 0);
+    if (rc != sizeof(ack))
+    {
+        // keep the timeout as reason
+        if (rc >= 0)
+            errno = EPIPE;
+        return -1;
+    }
 
-    pthread_mutex_unlock(mutex);
+    return 0;
 }
 
-static void send_all_lines(pthread_mutex_t *mutex, const int sock)
+/**
+ * Hands the listening sockets, the data file and the open connections to the process
+ * connecting to the upgrade socket.  The listening sockets stay open throughout, so
+ * clients connecting meanwhile wait in the backlog instead of being refused.
+ * @return 0 once handed off, -1 if this process keeps serving
+ */
+static int handoff_server(void)
 {
-    char *line = NULL;
-    size_t len = 0;
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
 
-    if(pthread_mutex_lock(mutex) < 0) {
-        syslog(LOG_ERR, "Error locking mutex");
-        exit(EXIT_FAILURE);
-    }
-
-    // open the socketdata file
-    FILE *fp = fopen(DATAFILE, "r");
+    int sock = accept4(handoff_sock, NULL, NULL, SOCK_CLOEXEC);
+    if (sock < 0)
+        return -1;
 
-    if (fp == NULL)
+    // only the user running the server may take it over
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0 || cred.uid != geteuid())
     {
-        syslog(LOG_ERR, "Error opening file: %s", strerror(errno));
-        exit(EXIT_FAILURE);
+        syslog(LOG_ERR, "Refusing handoff to uid %d", (int)cred.uid);
+        close(sock);
+        return -1;
     }
 
-    while (getline(&line, &len, fp) > 0)
+    // a peer that stops reading or never confirms must not keep the workers stopped
+    const struct timeval timeout = { .tv_sec = HANDOFF_TIMEOUT_S, .tv_usec = 0 };
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0 ||
+            setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0)
     {
-        if (send(sock, line, strlen(line), 0) < 0)
-        {
-            syslog(LOG_ERR, "Error sending line to client: %s", strerror(errno));
-            exit(EXIT_FAILURE);
-        }
+        syslog(LOG_ERR, "Error setting the handoff timeouts: %s", strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    syslog(LOG_INFO, "Handing off to process %d", (int)cred.pid);
 
-        free(line);
+    quiesce_workers();
+
+    // no record is appended from now on
+    thread_data_t *data;
+    atomic_store(&stop_threads, true);
+    pthread_join(timer_thread, (void**)&data);
+    free(data);
 
-        line = NULL;
-        len = 0;
+    if (send_handoff(sock) < 0)
+    {
+        syslog(LOG_ERR, "Error handing off, resuming: %s", strerror(errno));
+        close(sock);
+        resume_workers();
+        return -1;
     }
 
-    if(line != NULL)
-        free(line);
+    close(sock);
+
+    // the new process holds its own references to the descriptors
+    while (!SLIST_EMPTY(&list)) {
+        slist_data_t *e = SLIST_FIRST(&list);
+        SLIST_REMOVE_HEAD(&list, entries);
+        free_worker(e);
+    }
+    worker_count = 0U;
+    handed_off = true;
 
-    fclose(fp);
+    return 0;
+}
 
-    pthread_mutex_unlock(mutex);
+/**
+ * Receives the state of a running server over @param sock
+ */
+static int receive_handoff(int sock)
+{
+    uint64_t ends[HANDOFF_INDEX_CHUNK];
+    struct handoff_state state;
+    int fds[HANDOFF_MAX_FDS];
+    struct stat st;
+
+    const int nfds = handoff_recv_msg(sock, &state, sizeof(state), fds, HANDOFF_MAX_FDS);
+    if (nfds < 0)
+        return -1;
+
+    if (state.magic != HANDOFF_MAGIC || state.version != HANDOFF_VERSION ||
+            nfds != ((state.flags & HANDOFF_HAS_LOCAL_SOCKET) ? 4 : 3))
+    {
+        for (int i = 0; i < nfds; i++)
+            close(fds[i]);
+        errno = EPROTO;
+        return -1;
+    }
+
+    srv_sock = fds[0];
+    handoff_sock = fds[1];
+    data_fd = fds[2];
+    if (state.flags & HANDOFF_HAS_LOCAL_SOCKET)
+        local_sock = fds[3];
+    data_size = state.data_size;
+
+    if (fstat(data_fd, &st) < 0 || (uint64_t)st.st_size != data_size)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    for (uint64_t left = state.records; left > 0; )
+    {
+        const unsigned int n = left < HANDOFF_INDEX_CHUNK ? (unsigned int)left : HANDOFF_INDEX_CHUNK;
+
+        if (handoff_recv_data(sock, ends, n * sizeof(ends[0])) < 0)
+            return -1;
+
+        for (unsigned int i = 0; i < n; i++)
+        {
+            if (record_index_add(ends[i]) == 0U)
+            {
+                errno = ENOMEM;
+                return -1;
+            }
+        }
+        left -= n;
+    }
+
+    for (uint32_t i = 0; i < state.connections; i++)
+    {
+        struct handoff_conn conn;
+
+        const int nfds = handoff_recv_msg(sock, &conn, sizeof(conn), fds, HANDOFF_MAX_FDS);
+        if (nfds < 0)
+            return -1;
+
+        conn.client_ip[sizeof(conn.client_ip) - 1] = '\0';
+        slist_data_t *e = new_worker(fds[0], conn.client_ip, conn.mode == HANDOFF_LOCAL);
+        SLIST_INSERT_HEAD(&resumed, e, entries);
+
+        if (nfds != (conn.mode == HANDOFF_LOCAL ? 4 : 1) || conn.data_len > FRAME_MAX_PAYLOAD + FRAME_RX_BUFFER_SIZE)
+        {
+            errno = EPROTO;
+            return -1;
+        }
+
+        e->thread_data.handoff = conn;
+        if (conn.mode == HANDOFF_LOCAL)
+            memcpy(e->thread_data.ring_fds, &fds[1], sizeof(e->thread_data.ring_fds));
+
+        // kept NUL terminated for the line handling
+        e->thread_data.handoff_data = (char *)malloc(conn.data_len + 1);
+        if (e->thread_data.handoff_data == NULL ||
+                handoff_recv_data(sock, e->thread_data.handoff_data, conn.data_len) < 0)
+            return -1;
+        e->thread_data.handoff_data[conn.data_len] = '\0';
+    }
+
+    syslog(LOG_INFO, "Took over %" PRIu64 " records and %" PRIu32 " connections", state.records, state.connections);
+
+    const char ack = 1;
+    return send(sock, &ack, sizeof(ack), MSG_NOSIGNAL) == sizeof(ack) ? 0 : -1;
+}
+
+int init_server_upgrade(void)
+{
+    struct sockaddr_un addr;
+
+    init_common();
+
+    memset(&addr, 0x0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, HANDOFF_SOCKET, sizeof(addr.sun_path) - 1);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || receive_handoff(sock) < 0)
+    {
+        syslog(LOG_ERR, "Error taking over the running server: %s", strerror(errno));
+        if (sock >= 0)
+            close(sock);
+        return -1;
+    }
+
+    close(sock);
+
+    // the configuration of this process decides which UNIX sockets stay open
+    setup_unix_sockets();
+
+    return 0;
+}
+
+static void* handle_connection(void *data)
+{
+    thread_data_t *thread_data = (thread_data_t*)data;
+    char *line_buf = NULL;
+    uint32_t cur_buf_len = 0;
+    char *local_buf = NULL;
+    size_t local_buf_size = 0;
+    struct subscriber *sub = NULL;
+    // complete lines waiting for a single append when coalescing
+    char *batch_buf = NULL;
+    size_t batch_len = 0;
+    size_t batch_size = 0;
+
+    reply_init(&thread_data->reply, thread_data->client_sock, atomic_load(&zerocopy_threshold));
+
+    // continue a connection taken over, or stopped by a failed handoff
+    const enum handoff_mode resume = (enum handoff_mode)thread_data->handoff.mode;
+    char *resume_data = thread_data->handoff_data;
+    // a subscriber taken over only knows the last record it got from the handoff
+    if (resume == HANDOFF_SUBSCRIBED)
+        thread_data->sent_seq = thread_data->handoff.seq;
+    thread_data->handoff.mode = HANDOFF_NONE;
+    thread_data->handoff_data = NULL;
+
+    if (resume == HANDOFF_BINARY)
+    {
+        serve_binary(thread_data, resume_data, thread_data->handoff.data_len, true);
+        free(resume_data);
+        goto clean;
+    }
+    else if (resume != HANDOFF_NONE)
+    {
+        // the partial line, NUL terminated
+        line_buf = resume_data;
+        cur_buf_len = (uint32_t)thread_data->handoff.data_len;
+    }
+
+    if (resume == HANDOFF_SUBSCRIBED)
+    {
+        sub = (struct subscriber *)malloc(sizeof(struct subscriber));
+        if (sub == NULL || subscriber_init(sub) < 0)
+        {
+            syslog(LOG_ERR, "Error creating subscriber: %s", strerror(errno));
+            goto clean;
+        }
+        // the records not sent before the handoff come first
+        if (subscribe_client(thread_data, sub, true) < 0)
+        {
+            subscriber_destroy(sub);
+            free(sub);
+            sub = NULL;
+            goto clean;
+        }
+    }
+
+    // poll blocks until data arrives, shutdown_server() ends it with a shutdown of the socket
+    while(!atomic_load(thread_data->stop_thread)) {
+        struct pollfd fds[3];
+
+        // stop between packets, the new process continues with the partial line
+        if (atomic_load(&handoff_requested))
+        {
+            if (commit_lines(thread_data, batch_buf, &batch_len, sub == NULL) < 0)
+                break;
+
+            thread_data->handoff.mode = sub != NULL ? HANDOFF_SUBSCRIBED : HANDOFF_TEXT;
+            thread_data->handoff.seq = thread_data->sent_seq;
+            thread_data->handoff.data_len = cur_buf_len;
+            thread_data->handoff_data = line_buf;
+            line_buf = NULL;
+            break;
+        }
+
+        // once subscribed, new records are pushed to the client as well
+        fds[0].fd = thread_data->client_sock;
+        fds[0].events = POLLIN;
+        fds[1].fd = sub != NULL ? sub->event_fd : -1;
+        fds[1].events = POLLIN;
+        fds[2].fd = handoff_fd;
+        fds[2].events = POLLIN;
+
+        if (poll(fds, 3, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            syslog(LOG_ERR, "Error on poll: %s", strerror(errno));
+            break;
+        }
+
+        if ((fds[1].revents & POLLIN) && send_subscribed(thread_data, sub) < 0)
+            break;
+
+        if (fds[0].revents == 0)
+            continue;
+
+        // the buffer size can change with a reload of the configuration
+        const size_t buf_size = atomic_load(&recv_buffer_size);
+        if(buf_size != local_buf_size) {
+            char *buf = (char *)realloc(local_buf, buf_size + 1);
+            if(buf == NULL) {
+                syslog(LOG_ERR, "Error allocating receive buffer: %s", strerror(errno));
+                break;
+            }
+            local_buf = buf;
+            local_buf_size = buf_size;
+        }
+        memset(&local_buf[0], 0x0, local_buf_size + 1);
+
+        ssize_t recv_len = recv(thread_data->client_sock, &local_buf[0], local_buf_size, 0);
+
+        if (recv_len < 0)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                syslog(LOG_ERR, "Error on recv call: %s", strerror(errno));
+                break;
+            }
+            
+            // timeout received
+            continue;
+        } else if (recv_len == 0) {
+            syslog(LOG_INFO, "Closed connection from %s", thread_data->client_ip);
+            break;
+        }
+
+        const bool coalesce = atomic_load(&coalesce_replies) != 0U;
+
+        for (uint32_t local_start_pos = 0; local_start_pos < recv_len; )
+        {
+            // check for \n, starting behind the previous line of this packet
+            uint32_t npos;
+            for (npos = local_start_pos; npos < recv_len; ++npos)
+                if (local_buf[npos] == '\n')
+                    break;
+
+            // bytes to append to the line, the \n inclusive if found
+            const bool line_complete = npos < recv_len;
+            const uint32_t seg_len = npos - local_start_pos + (line_complete ? 1U : 0U);
+
+            // resize line buffer, lines can span several packets
+            char *buf = (char *)realloc(line_buf, cur_buf_len + seg_len + 1);
+
+            if (buf == NULL)
+            {
+                syslog(LOG_ERR, "Error re-allocating memory: %s", strerror(errno));
+                goto clean;
+            }
+            line_buf = buf;
+
+            memcpy(&line_buf[cur_buf_len], &local_buf[local_start_pos], seg_len);
+            cur_buf_len += seg_len;
+            line_buf[cur_buf_len] = '\0';
+
+            // only if \n has been found, write to file and return
+            if (line_complete && strcmp(line_buf, SUBSCRIBE_COMMAND) == 0)
+            {
+                // the lines before the command belong into the snapshot
+                if (commit_lines(thread_data, batch_buf, &batch_len, sub == NULL) < 0)
+                    goto clean;
+
+                if (sub == NULL)
+                {
+                    sub = (struct subscriber *)malloc(sizeof(struct subscriber));
+                    if (sub == NULL || subscriber_init(sub) < 0)
+                    {
+                        syslog(LOG_ERR, "Error creating subscriber: %s", strerror(errno));
+                        goto clean;
+                    }
+                    // a failed subscription is already removed again
+                    if (subscribe_client(thread_data, sub, false) < 0)
+                    {
+                        subscriber_destroy(sub);
+                        free(sub);
+                        sub = NULL;
+                        goto clean;
+                    }
+                    syslog(LOG_INFO, "Subscribed %s", thread_data->client_ip);
+                }
+
+                free(line_buf);
+                line_buf = NULL;
+                cur_buf_len = 0;
+            }
+            else if (line_complete && strcmp(line_buf, FRAME_NEGOTIATE_COMMAND) == 0)
+            {
+                if (commit_lines(thread_data, batch_buf, &batch_len, sub == NULL) < 0)
+                    goto clean;
+
+                if (sub != NULL)
+                {
+                    syslog(LOG_ERR, "Subscriber %s cannot switch to binary framing", thread_data->client_ip);
+                    goto clean;
+                }
+
+                // the rest of the packet is framed already
+                local_start_pos += seg_len;
+                serve_binary(thread_data, &local_buf[local_start_pos], recv_len - local_start_pos, false);
+                goto clean;
+            }
+            else if (line_complete && coalesce)
+            {
+                if (batch_len + cur_buf_len + 1 > batch_size)
+                {
+                    size_t size = batch_size ? batch_size : local_buf_size + 1;
+                    while (size < batch_len + cur_buf_len + 1)
+                        size *= 2;
+
+                    char *grown = (char *)realloc(batch_buf, size);
+                    if (grown == NULL)
+                    {
+                        syslog(LOG_ERR, "Error re-allocating memory: %s", strerror(errno));
+                        goto clean;
+                    }
+                    batch_buf = grown;
+                    batch_size = size;
+                }
+
+                memcpy(&batch_buf[batch_len], line_buf, cur_buf_len + 1);
+                batch_len += cur_buf_len;
+
+                // reset the buffer
+                free(line_buf);
+                line_buf = NULL;
+                cur_buf_len = 0;
+            }
+            else if (line_complete)
+            {
+                write_line_to_file(thread_data->mutex, line_buf);
+                // subscribers receive the line with the other new records instead of a replay
+                if (sub == NULL && send_all_lines(thread_data) < 0)
+                    goto clean;
+
+                // reset the buffer
+                free(line_buf);
+                line_buf = NULL;
+                cur_buf_len = 0;
+            }
+
+            local_start_pos += seg_len;
+        }
+
+        // packets already queued join the batch, the reply waits until the burst is read
+        int pending = 0;
+        if (batch_len > 0 && batch_len < COALESCE_MAX_BYTES &&
+                ioctl(thread_data->client_sock, FIONREAD, &pending) == 0 && pending > 0)
+            continue;
+
+        if (commit_lines(thread_data, batch_buf, &batch_len, sub == NULL) < 0)
+            break;
+    }
+
+clean:
+    free(batch_buf);
+    free(local_buf);
+    free(line_buf);
+
+    if (sub != NULL)
+    {
+        if (sub->event_fd >= 0)
+        {
+            if(PROF_MUTEX_LOCK(thread_data->mutex) == 0) {
+                subscription_remove(sub);
+                PROF_MUTEX_UNLOCK(thread_data->mutex);
+            }
+            subscriber_destroy(sub);
+        }
+        free(sub);
+    }
+
+    worker_done(thread_data);
+
+    return NULL;
+}
+
+/**
+ * Marks the connection thread of @param thread_data for joining by the server loop
+ */
+static void worker_done(thread_data_t *thread_data)
+{
+    // the socket stays open until the thread is joined, so its number cannot be reused
+    // while shutdown_server() may still shut it down
+    const uint64_t one = 1;
+    atomic_store(&thread_data->done, true);
+    (void)write(worker_exit_fd, &one, sizeof(one));
+}
+
+static void write_line_to_file(pthread_mutex_t *mutex, const char *const line)
+{
+    const struct iovec record = { .iov_base = (void *)line, .iov_len = strlen(line) };
+
+    (void)append_records(mutex, &record, 1, true);
+}
+
+/**
+ * Writes the @param count parts of @param records, continuing after short writes
+ */
+static int write_records(int fd, const struct iovec *records, int count)
+{
+    ssize_t rc;
+
+    // larger bursts take several calls, the caller holds the file lock across all of them
+    for (; count > IOV_MAX; records += IOV_MAX, count -= IOV_MAX)
+    {
+        if (write_records(fd, records, IOV_MAX) < 0)
+            return -1;
+    }
+
+    do
+        rc = writev(fd, records, count);
+    while (rc < 0 && errno == EINTR);
+
+    if (rc < 0)
+        return -1;
+
+    size_t skip = (size_t)rc;
+    for (int i = 0; i < count; i++)
+    {
+        const char *pos = (const char *)records[i].iov_base;
+        size_t len = records[i].iov_len;
+        const size_t n = skip < len ? skip : len;
+
+        pos += n;
+        len -= n;
+        skip -= n;
+
+        while (len > 0)
+        {
+            rc = write(fd, pos, len);
+            if (rc < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            pos += rc;
+            len -= (size_t)rc;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Appends the @param count @param records under a single hold of the file lock, so no
+ * other writer gets in between, and assigns them sequence numbers.  With @param lines set, every line of a record counts as a record of its own.
+ * @return the sequence number of the last record
+ */
+static uint64_t append_records(pthread_mutex_t *mutex, const struct iovec *records, int count, bool lines)
+{
+    uint64_t seq = 0U;
+
+    if(PROF_MUTEX_LOCK(mutex) != 0) {
+        syslog(LOG_ERR, "Error locking mutex");
+        exit(EXIT_FAILURE);
+    }
+
+    if (write_records(data_fd, records, count) < 0)
+    {
+        syslog(LOG_ERR, "Eror writing to file: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const char *data = (const char *)records[i].iov_base;
+        const size_t len = records[i].iov_len;
+
+        const uint64_t base = data_size;
+        bool indexed = true;
+
+        data_size += len;
+
+        if (lines)
+        {
+            // text behind the last newline forms a record as well
+            for (size_t pos = 0; pos < len && indexed; )
+            {
+                const char *nl = (const char *)memchr(&data[pos], '\n', len - pos);
+                pos = nl != NULL ? (size_t)(nl - data) + 1 : len;
+                seq = record_index_add(base + pos);
+                indexed = seq != 0U;
+            }
+        }
+        else
+        {
+            seq = record_index_add(data_size);
+            indexed = seq != 0U;
+        }
+
+        if (!indexed)
+        {
+            syslog(LOG_ERR, "Error indexing record: %s", strerror(ENOMEM));
+            exit(EXIT_FAILURE);
+        }
+
+        // under the file lock, so subscribers get the records in file order
+        if (len > 0)
+            subscription_publish(data, len, seq);
+    }
+
+    PROF_MUTEX_UNLOCK(mutex);
+
+    return seq;
+}
+
+static int send_all_lines(thread_data_t *thread_data)
+{
+    replay_t replay;
+
+    if(PROF_MUTEX_LOCK(thread_data->mutex) != 0) {
+        syslog(LOG_ERR, "Error locking mutex");
+        exit(EXIT_FAILURE);
+    }
+
+    const int rc = prepare_replay_locked(&replay);
+
+    PROF_MUTEX_UNLOCK(thread_data->mutex);
+
+    return rc < 0 ? rc : send_replay(thread_data, &replay);
+}
+
+/**
+ * Maps the data file for a replay, honoring the replay window.  The file is only ever
+ * appended to, so the mapped part stays valid once the lock is released.
+ */
+static int prepare_replay_locked(replay_t *replay)
+{
+    const size_t window = atomic_load(&replay_lines);
+
+    memset(replay, 0x0, sizeof(*replay));
+    replay->last_seq = record_index_count();
+
+    // nothing committed yet
+    if (data_size == 0U)
+        return 0;
+
+    replay->map = mmap(NULL, data_size, PROT_READ, MAP_SHARED, data_fd, 0);
+
+    if (replay->map == MAP_FAILED)
+    {
+        syslog(LOG_ERR, "Error mapping file: %s", strerror(errno));
+        replay->map = NULL;
+        return -1;
+    }
+    replay->map_len = data_size;
+
+    // with a replay window, start behind the newline preceding the most recent lines
+    if (window > 0)
+    {
+        const char *data = (const char *)replay->map;
+        size_t end = replay->map_len;
+
+        if (data[end - 1] == '\n')
+            end--;
+
+        for (size_t n = 0; n < window; n++)
+        {
+            const char *nl = (const char *)memrchr(data, '\n', end);
+            if (nl == NULL)
+            {
+                replay->start = 0;
+                break;
+            }
+            end = (size_t)(nl - data);
+            replay->start = end + 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Sends the mapped lines of @param replay with a single send and unmaps them
+ */
+static int send_replay(thread_data_t *thread_data, replay_t *replay)
+{
+    int ret = 0;
+
+    if (replay->map == NULL)
+        return 0;
+
+    // a client gone meanwhile only ends its own connection, without raising SIGPIPE
+    thread_data->reply.zerocopy_threshold = atomic_load(&zerocopy_threshold);
+    if (reply_send(&thread_data->reply, (const char *)replay->map + replay->start,
+            replay->map_len - replay->start) < 0)
+    {
+        syslog(LOG_ERR, "Error sending lines to client: %s", strerror(errno));
+        ret = -1;
+    }
+
+    munmap(replay->map, replay->map_len);
+    replay->map = NULL;
+
+    return ret;
+}
+
+/**
+ * Sends the current lines to the client and registers @param sub for the following ones.
+ * The snapshot is taken and the subscriber added under the file lock, so no record is
+ * missed or sent twice.  With @param resume set the client was taken over from a previous
+ * process and only gets the records after thread_data->sent_seq.
+ * @return 0 on success, -1 with @param sub not registered otherwise
+ */
+static int subscribe_client(thread_data_t *thread_data, struct subscriber *sub, bool resume)
+{
+    replay_t replay;
+
+    if(PROF_MUTEX_LOCK(thread_data->mutex) != 0) {
+        syslog(LOG_ERR, "Error locking mutex");
+        exit(EXIT_FAILURE);
+    }
+
+    const int rc = prepare_replay_locked(&replay);
+    if (rc == 0)
+        subscription_add(sub);
+
+    PROF_MUTEX_UNLOCK(thread_data->mutex);
+
+    if (rc < 0)
+        return -1;
+
+    // a subscriber taken over only gets the records it was not sent yet
+    if (resume && replay.map != NULL)
+    {
+        uint64_t end;
+
+        replay.start = replay.map_len;
+        if (thread_data->sent_seq < replay.last_seq)
+            record_index_range(thread_data->sent_seq + 1U, &replay.start, &end);
+    }
+    thread_data->sent_seq = replay.last_seq;
+
+    // records published meanwhile are queued and follow the snapshot
+    if (send_replay(thread_data, &replay) < 0)
+    {
+        if(PROF_MUTEX_LOCK(thread_data->mutex) == 0) {
+            subscription_remove(sub);
+            PROF_MUTEX_UNLOCK(thread_data->mutex);
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Appends the @param len bytes of complete @param lines with a single write and, if
+ * @param reply is set, answers them with one replay.  Resets @param len.
+ */
+static int commit_lines(thread_data_t *thread_data, char *lines, size_t *len, bool reply)
+{
+    if (*len == 0)
+        return 0;
+
+    *len = 0;
+    write_line_to_file(thread_data->mutex, lines);
+
+    return reply ? send_all_lines(thread_data) : 0;
+}
+
+/**
+ * Sends the records queued for @param sub, each shared with the other subscribers
+ */
+static int send_subscribed(thread_data_t *thread_data, struct subscriber *sub)
+{
+    struct shared_record *rec;
+    uint64_t count;
+
+    // reset before draining, a record queued meanwhile makes it readable again
+    (void)read(sub->event_fd, &count, sizeof(count));
+
+    if (atomic_load(&sub->lagged))
+    {
+        syslog(LOG_ERR, "Subscriber %s too slow, closing connection", thread_data->client_ip);
+        return -1;
+    }
+
+    thread_data->reply.zerocopy_threshold = atomic_load(&zerocopy_threshold);
+
+    while ((rec = subscriber_pop(sub)) != NULL)
+    {
+        // several records queued, send them as full segments
+        if (subscriber_has_pending(sub))
+            reply_cork(&thread_data->reply, true);
+
+        const int rc = reply_send(&thread_data->reply, rec->data, rec->len);
+        if (rc == 0)
+            thread_data->sent_seq = rec->seq;
+
+        shared_record_put(rec);
+
+        if (rc < 0)
+        {
+            syslog(LOG_ERR, "Error sending record to subscriber: %s", strerror(errno));
+            return -1;
+        }
+    }
+
+    reply_cork(&thread_data->reply, false);
+
+    return 0;
+}
+
+/**
+ * Serves a connection switched to binary framing until it is closed, starting with the
+ * @param len bytes in @param data received behind the negotiation.  All complete records
+ * in the receive buffer form a burst, which is stored from there under a single hold of
+ * the file lock and acknowledged once.
+ * A connection taken over is @param negotiated already and not acknowledged again.
+ */
+static void serve_binary(thread_data_t *thread_data, const char *data, size_t len, bool negotiated)
+{
+    size_t rx_size = len > FRAME_RX_BUFFER_SIZE ? len : FRAME_RX_BUFFER_SIZE;
+    size_t rx_len = len;
+    size_t records_size = FRAME_BATCH_RECORDS;
+
+    unsigned char *rx = (unsigned char *)malloc(rx_size);
+    struct iovec *records = (struct iovec *)malloc(records_size * sizeof(struct iovec));
+    if (rx == NULL || records == NULL)
+    {
+        syslog(LOG_ERR, "Error allocating receive buffer: %s", strerror(errno));
+        goto out;
+    }
+    memcpy(rx, data, len);
+
+    if (!negotiated)
+    {
+        // tells the client the position to resume from
+        if (send_ack(thread_data, record_index_count()) < 0)
+            goto out;
+
+        syslog(LOG_INFO, "Switched %s to binary framing", thread_data->client_ip);
+    }
+
+    while (!atomic_load(thread_data->stop_thread))
+    {
+        struct frame_header header;
+        uint64_t stored_seq = 0U;
+        size_t pos = 0;
+        size_t count = 0;
+
+        while (rx_len - pos >= FRAME_HEADER_SIZE)
+        {
+            frame_decode(&rx[pos], &header);
+
+            if (header.type == FRAME_RECORD && header.len <= FRAME_MAX_PAYLOAD)
+            {
+                // wait for the rest of the payload
+                if (rx_len - pos - FRAME_HEADER_SIZE < header.len)
+                    break;
+
+                if (count == records_size)
+                {
+                    struct iovec *grown = (struct iovec *)realloc(records, 2 * records_size * sizeof(struct iovec));
+                    if (grown == NULL)
+                    {
+                        syslog(LOG_ERR, "Error re-allocating memory: %s", strerror(errno));
+                        goto out;
+                    }
+                    records = grown;
+                    records_size *= 2;
+                }
+
+                records[count].iov_base = &rx[pos + FRAME_HEADER_SIZE];
+                records[count].iov_len = header.len;
+                pos += FRAME_HEADER_SIZE + header.len;
+                count++;
+            }
+            else if (header.type == FRAME_REPLAY && header.len == 0U)
+            {
+                // the records before belong into the replay
+                if (count > 0)
+                    append_records(thread_data->mutex, records, (int)count, false);
+                count = 0;
+                pos += FRAME_HEADER_SIZE;
+
+                // the replay ends with an acknowledgement covering the stored records
+                stored_seq = 0U;
+                if (send_binary_replay(thread_data, header.seq) < 0)
+                    goto out;
+            }
+            else
+            {
+                syslog(LOG_ERR, "Invalid frame type %u length %u from %s", header.type, header.len,
+                        thread_data->client_ip);
+                goto out;
+            }
+        }
+
+        if (count > 0)
+            stored_seq = append_records(thread_data->mutex, records, (int)count, false);
+
+        if (stored_seq != 0U && send_ack(thread_data, stored_seq) < 0)
+            goto out;
+
+        // keep the incomplete frame, the buffer grows to hold a large record at once
+        rx_len -= pos;
+        memmove(rx, &rx[pos], rx_len);
+
+        if (rx_len >= FRAME_HEADER_SIZE && FRAME_HEADER_SIZE + header.len > rx_size)
+        {
+            unsigned char *grown = (unsigned char *)realloc(rx, FRAME_HEADER_SIZE + header.len);
+            if (grown == NULL)
+            {
+                syslog(LOG_ERR, "Error re-allocating memory: %s", strerror(errno));
+                goto out;
+            }
+            rx = grown;
+            rx_size = FRAME_HEADER_SIZE + header.len;
+        }
+
+        // stop between frames, the new process continues with the incomplete one
+        if (atomic_load(&handoff_requested))
+        {
+            thread_data->handoff_data = (char *)malloc(rx_len + 1);
+            if (thread_data->handoff_data == NULL)
+            {
+                syslog(LOG_ERR, "Error allocating handoff data: %s", strerror(errno));
+                break;
+            }
+            memcpy(thread_data->handoff_data, rx, rx_len);
+            thread_data->handoff.mode = HANDOFF_BINARY;
+            thread_data->handoff.data_len = rx_len;
+            break;
+        }
+
+        const ssize_t recv_len = recv(thread_data->client_sock, &rx[rx_len], rx_size - rx_len, MSG_DONTWAIT);
+
+        if (recv_len < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                // only wait once nothing is queued, a stream of records needs no poll
+                struct pollfd fds[2] = {
+                    { .fd = thread_data->client_sock, .events = POLLIN, .revents = 0 },
+                    { .fd = handoff_fd, .events = POLLIN, .revents = 0 },
+                };
+                if (poll(fds, 2, -1) < 0 && errno != EINTR)
+                {
+                    syslog(LOG_ERR, "Error on poll: %s", strerror(errno));
+                    break;
+                }
+                continue;
+            }
+            if (errno == EINTR)
+                continue;
+            syslog(LOG_ERR, "Error on recv call: %s", strerror(errno));
+            break;
+        }
+        else if (recv_len == 0)
+        {
+            syslog(LOG_INFO, "Closed connection from %s", thread_data->client_ip);
+            break;
+        }
+
+        rx_len += (size_t)recv_len;
+    }
+
+out:
+    free(records);
+    free(rx);
+}
+
+/**
+ * Sends the records from @param from_seq on as frames carrying their sequence number,
+ * followed by an acknowledgement of the last one
+ */
+static int send_binary_replay(thread_data_t *thread_data, uint64_t from_seq)
+{
+    unsigned char headers[FRAME_BATCH_RECORDS][FRAME_HEADER_SIZE];
+    struct iovec iov[2 * FRAME_BATCH_RECORDS];
+    replay_t replay;
+    int ret = 0;
+
+    if(PROF_MUTEX_LOCK(thread_data->mutex) != 0) {
+        syslog(LOG_ERR, "Error locking mutex");
+        exit(EXIT_FAILURE);
+    }
+
+    const int rc = prepare_replay_locked(&replay);
+
+    PROF_MUTEX_UNLOCK(thread_data->mutex);
+
+    if (rc < 0)
+        return -1;
+
+    thread_data->reply.zerocopy_threshold = atomic_load(&zerocopy_threshold);
+
+    // the indexed records lie within the mapping, which ends with the last of them
+    uint64_t seq = from_seq > 0U ? from_seq : 1U;
+    if (seq <= replay.last_seq)
+        reply_cork(&thread_data->reply, true);
+
+    while (seq <= replay.last_seq)
+    {
+        int n;
+
+        for (n = 0; n < FRAME_BATCH_RECORDS && seq <= replay.last_seq; n++, seq++)
+        {
+            uint64_t start, end;
+            record_index_range(seq, &start, &end);
+
+            const struct frame_header header = { .len = (uint32_t)(end - start), .type = FRAME_RECORD,
+                    .flags = 0U, .seq = seq };
+            frame_encode(&header, headers[n]);
+
+            iov[2 * n].iov_base = headers[n];
+            iov[2 * n].iov_len = FRAME_HEADER_SIZE;
+            iov[2 * n + 1].iov_base = (char *)replay.map + start;
+            iov[2 * n + 1].iov_len = (size_t)(end - start);
+        }
+
+        if (reply_sendv(&thread_data->reply, iov, 2 * n) < 0)
+        {
+            syslog(LOG_ERR, "Error sending records to client: %s", strerror(errno));
+            ret = -1;
+            break;
+        }
+    }
+
+    if (ret == 0)
+        ret = send_ack(thread_data, replay.last_seq);
+
+    reply_cork(&thread_data->reply, false);
+
+    if (replay.map != NULL)
+        munmap(replay.map, replay.map_len);
+
+    return ret;
+}
+
+static int send_ack(thread_data_t *thread_data, uint64_t seq)
+{
+    const struct frame_header header = { .len = 0U, .type = FRAME_ACK, .flags = 0U, .seq = seq };
+    unsigned char buf[FRAME_HEADER_SIZE];
+
+    frame_encode(&header, buf);
+
+    if (reply_send(&thread_data->reply, buf, sizeof(buf)) < 0)
+    {
+        syslog(LOG_ERR, "Error sending acknowledgement to client: %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/**
+ * Stores the records queued in @param ring behind @param tail and frees their space,
+ * up to FRAME_BATCH_RECORDS with a single write
+ * @return 0 on success, -1 if the client wrote an invalid record
+ */
+static int ingest_ring(thread_data_t *thread_data, struct shm_ring *ring, uint64_t *tail)
+{
+    struct iovec records[FRAME_BATCH_RECORDS];
+    uint64_t head;
+
+    while ((head = atomic_load_explicit(&ring->header->head, memory_order_acquire)) != *tail)
+    {
+        uint64_t pos = *tail;
+        int count = 0;
+
+        // the client is not trusted, every record has to lie between tail and head
+        if (head - pos > ring->size)
+            goto invalid;
+
+        while (pos != head && count < FRAME_BATCH_RECORDS)
+        {
+            char *rec = &ring->data[pos & (ring->size - 1U)];
+            uint32_t len;
+
+            memcpy(&len, rec, sizeof(len));
+            if (SHM_RING_RECORD_SIZE(len) > head - pos)
+                goto invalid;
+
+            records[count].iov_base = rec + sizeof(len);
+            records[count].iov_len = len;
+            count++;
+            pos += SHM_RING_RECORD_SIZE(len);
+        }
+
+        (void)append_records(thread_data->mutex, records, count, false);
+
+        *tail = pos;
+        shm_ring_release(ring, pos);
+    }
+
+    return 0;
+
+invalid:
+    syslog(LOG_ERR, "Invalid record from local client at %" PRIu64, *tail);
+    return -1;
+}
+
+/**
+ * Polls @param ring for records behind @param tail for up to @param spin_ns
+ * @return true if records arrived
+ */
+static bool spin_ring(struct shm_ring *ring, uint64_t tail, uint64_t spin_ns)
+{
+    struct timespec start, now;
+
+    if (spin_ns == 0U || !spin_allowed)
+        return false;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    do {
+        for (unsigned int i = 0; i < 64U; i++)
+        {
+            if (atomic_load_explicit(&ring->header->head, memory_order_relaxed) != tail)
+                return true;
+            cpu_relax();
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((uint64_t)(now.tv_sec - start.tv_sec) * NSEC_PER_SEC + (uint64_t)now.tv_nsec -
+            (uint64_t)start.tv_nsec < spin_ns);
+
+    return false;
+}
+
+/**
+ * Serves a client on the local socket: hands it a shared memory ring and stores the
+ * records it writes there until it closes the socket
+ */
+static void *handle_local(void *data)
+{
+    thread_data_t *thread_data = (thread_data_t*)data;
+    struct shm_ring ring;
+    uint64_t tail = 0U;
+    int rc;
+
+    // a ring taken over continues behind the records stored before
+    if (thread_data->handoff.mode == HANDOFF_LOCAL)
+    {
+        thread_data->handoff.mode = HANDOFF_NONE;
+        tail = thread_data->handoff.seq;
+        rc = shm_ring_attach(&ring, thread_data->ring_fds[0], thread_data->ring_fds[1],
+                thread_data->ring_fds[2], thread_data->handoff.ring_size);
+        for (int i = 0; i < 3; i++)
+            thread_data->ring_fds[i] = -1;
+    }
+    else
+    {
+        rc = shm_ring_create(&ring, atomic_load(&local_ring_size));
+        if (rc == 0)
+            rc = shm_ring_send(thread_data->client_sock, &ring);
+    }
+
+    if (rc < 0)
+    {
+        syslog(LOG_ERR, "Error setting up ring for local client: %s", strerror(errno));
+        shm_ring_destroy(&ring);
+        worker_done(thread_data);
+        return NULL;
+    }
+
+    syslog(LOG_INFO, "Attached local client with a %" PRIu64 " byte ring", ring.size);
+
+    for (bool closed = false; ; )
+    {
+        // records left by a closed client are stored as well
+        if (ingest_ring(thread_data, &ring, &tail) < 0 || closed || atomic_load(thread_data->stop_thread))
+            break;
+
+        // the new process maps the same ring and continues at the tail
+        if (atomic_load(&handoff_requested))
+        {
+            thread_data->handoff.mode = HANDOFF_LOCAL;
+            thread_data->handoff.seq = tail;
+            thread_data->handoff.ring_size = ring.size;
+            thread_data->ring_fds[0] = ring.mem_fd;
+            thread_data->ring_fds[1] = ring.doorbell_fd;
+            thread_data->ring_fds[2] = ring.space_fd;
+            ring.mem_fd = ring.doorbell_fd = ring.space_fd = -1;
+            break;
+        }
+
+        // a client sending at a high rate finds the server polling and needs no doorbell
+        if (spin_ring(&ring, tail, (uint64_t)atomic_load(&local_spin_us) * 1000U) ||
+                !shm_ring_prepare_wait(&ring, tail))
+            continue;
+
+        // the client sends nothing on the socket, readable means it is gone
+        struct pollfd fds[3] = {
+            { .fd = thread_data->client_sock, .events = POLLIN, .revents = 0 },
+            { .fd = ring.doorbell_fd, .events = POLLIN, .revents = 0 },
+            { .fd = handoff_fd, .events = POLLIN, .revents = 0 },
+        };
+        uint64_t count;
+
+        if (poll(fds, 3, -1) < 0 && errno != EINTR)
+        {
+            syslog(LOG_ERR, "Error on poll: %s", strerror(errno));
+            break;
+        }
+
+        atomic_store_explicit(&ring.header->consumer_waiting, 0U, memory_order_relaxed);
+        (void)read(ring.doorbell_fd, &count, sizeof(count));
+
+        closed = fds[0].revents != 0;
+    }
+
+    if (thread_data->handoff.mode == HANDOFF_NONE)
+        syslog(LOG_INFO, "Closed local connection");
+
+    shm_ring_destroy(&ring);
+    worker_done(thread_data);
+
+    return NULL;
 }
 
 static void *log_timestamp(void *data)
@@ -2,7 +2,29 @@
  * Acts as server for the aesd
  * Author: Heiko Schmidt
  */
+#include "config.h"
+
+#define SERVER_HANDED_OFF 2
+
 extern int init_server_stage1(void);
+
+/**
+ * Replaces init_server_stage1() by taking over the listening sockets, the data file and
+ * the connections of a running server
+ * @return 0 on success, -1 on errors with the running server left serving
+ */
+extern int init_server_upgrade(void);
 extern int init_server_stage2(void);
-extern int process_server(void);
+
+/**
+ * Applies @param config, running connections use the new settings for their next packet
+ */
+extern void configure_server(const struct server_config *config);
+
+/**
+ * Waits for connections, and for @param wake_fd to become readable
+ * @return 1 if @param wake_fd is readable, SERVER_HANDED_OFF once a new process took over
+ * the server, 0 otherwise and -1 on errors
+ */
+extern int process_server(int wake_fd);
 extern void shutdown_server(void);
\ No newline at end of file
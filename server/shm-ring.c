@@ -0,0 +1,256 @@
+/*
+ * Acts as server for the aesd
+ * Author: Heiko Schmidt
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "shm-ring.h"
+
+#define RING_FDS 3
+// a client resizing the memory mapped by the server would crash it with SIGBUS
+#define RING_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+
+/**
+ * Maps the header and the data area twice behind each other
+ */
+static int map_ring(struct shm_ring *ring)
+{
+    char *base = (char *)mmap(NULL, SHM_RING_HEADER_SIZE + 2U * ring->size, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return -1;
+
+    // the fixed mappings replace the reservation
+    if (mmap(base, SHM_RING_HEADER_SIZE + ring->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                ring->mem_fd, 0) == MAP_FAILED ||
+            mmap(base + SHM_RING_HEADER_SIZE + ring->size, ring->size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, ring->mem_fd, SHM_RING_HEADER_SIZE) == MAP_FAILED)
+    {
+        const int saved_errno = errno;
+        munmap(base, SHM_RING_HEADER_SIZE + 2U * ring->size);
+        errno = saved_errno;
+        return -1;
+    }
+
+    ring->header = (struct shm_ring_header *)base;
+    ring->data = base + SHM_RING_HEADER_SIZE;
+
+    return 0;
+}
+
+static void init_ring(struct shm_ring *ring)
+{
+    memset(ring, 0x0, sizeof(*ring));
+    ring->mem_fd = -1;
+    ring->doorbell_fd = -1;
+    ring->space_fd = -1;
+}
+
+int shm_ring_create(struct shm_ring *ring, uint64_t size)
+{
+    init_ring(ring);
+
+    if (size < SHM_RING_MIN_SIZE || size > SHM_RING_MAX_SIZE || (size & (size - 1U)) != 0U)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    ring->size = size;
+
+    ring->mem_fd = memfd_create("aesdsocket-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (ring->mem_fd < 0 || ftruncate(ring->mem_fd, (off_t)(SHM_RING_HEADER_SIZE + size)) < 0 ||
+            fcntl(ring->mem_fd, F_ADD_SEALS, RING_SEALS) < 0 || map_ring(ring) < 0)
+        goto err;
+
+    ring->doorbell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ring->space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ring->doorbell_fd < 0 || ring->space_fd < 0)
+        goto err;
+
+    // the memfd starts zeroed, head and tail included
+    ring->header->magic = SHM_RING_MAGIC;
+    ring->header->version = SHM_RING_VERSION;
+    ring->header->size = size;
+
+    return 0;
+
+err:
+    shm_ring_destroy(ring);
+    return -1;
+}
+
+int shm_ring_send(int sock, const struct shm_ring *ring)
+{
+    const int fds[RING_FDS] = { ring->mem_fd, ring->doorbell_fd, ring->space_fd };
+    char control[CMSG_SPACE(sizeof(fds))];
+    uint64_t size = ring->size;
+    struct iovec iov = { .iov_base = &size, .iov_len = sizeof(size) };
+    struct msghdr msg;
+
+    memset(&msg, 0x0, sizeof(msg));
+    memset(control, 0x0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t)sizeof(size) ? 0 : -1;
+}
+
+int shm_ring_receive(int sock, struct shm_ring *ring)
+{
+    int fds[RING_FDS];
+    char control[CMSG_SPACE(sizeof(fds))];
+    uint64_t size;
+    struct iovec iov = { .iov_base = &size, .iov_len = sizeof(size) };
+    struct msghdr msg;
+
+    init_ring(ring);
+
+    memset(&msg, 0x0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL) != (ssize_t)sizeof(size))
+        return -1;
+
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    if (cm == NULL || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS ||
+            cm->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        errno = EPROTO;
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+
+    return shm_ring_attach(ring, fds[0], fds[1], fds[2], size);
+}
+
+int shm_ring_attach(struct shm_ring *ring, int mem_fd, int doorbell_fd, int space_fd, uint64_t size)
+{
+    struct stat st;
+
+    init_ring(ring);
+    ring->mem_fd = mem_fd;
+    ring->doorbell_fd = doorbell_fd;
+    ring->space_fd = space_fd;
+    ring->size = size;
+
+    if (size < SHM_RING_MIN_SIZE || size > SHM_RING_MAX_SIZE || (size & (size - 1U)) != 0U)
+    {
+        errno = EPROTO;
+        goto err;
+    }
+
+    // only map memory whose size nobody can change any more
+    const int seals = fcntl(mem_fd, F_GET_SEALS);
+    if (seals < 0 || (seals & RING_SEALS) != RING_SEALS || fstat(mem_fd, &st) < 0 ||
+            (uint64_t)st.st_size != SHM_RING_HEADER_SIZE + size)
+    {
+        errno = EPROTO;
+        goto err;
+    }
+
+    if (map_ring(ring) < 0)
+        goto err;
+
+    if (ring->header->magic != SHM_RING_MAGIC || ring->header->version != SHM_RING_VERSION ||
+            ring->header->size != size)
+    {
+        errno = EPROTO;
+        goto err;
+    }
+
+    return 0;
+
+err:
+    shm_ring_destroy(ring);
+    return -1;
+}
+
+void shm_ring_destroy(struct shm_ring *ring)
+{
+    if (ring->header != NULL)
+        munmap(ring->header, SHM_RING_HEADER_SIZE + 2U * ring->size);
+
+    if (ring->mem_fd >= 0)
+        close(ring->mem_fd);
+    if (ring->doorbell_fd >= 0)
+        close(ring->doorbell_fd);
+    if (ring->space_fd >= 0)
+        close(ring->space_fd);
+
+    init_ring(ring);
+}
+
+void shm_ring_notify(int fd)
+{
+    const uint64_t one = 1;
+
+    (void)write(fd, &one, sizeof(one));
+}
+
+int shm_ring_wait_space(struct shm_ring *ring, int sock, uint32_t len)
+{
+    struct shm_ring_header *header = ring->header;
+    const uint64_t need = SHM_RING_RECORD_SIZE(len);
+    const uint64_t head = atomic_load_explicit(&header->head, memory_order_relaxed);
+    int ret = 0;
+
+    if (need > ring->size)
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    atomic_store_explicit(&header->producer_waiting, 1U, memory_order_seq_cst);
+
+    while (need > ring->size - (head - atomic_load_explicit(&header->tail, memory_order_seq_cst)))
+    {
+        struct pollfd fds[2] = {
+            { .fd = ring->space_fd, .events = POLLIN, .revents = 0 },
+            { .fd = sock, .events = POLLIN, .revents = 0 },
+        };
+        uint64_t count;
+
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            ret = -1;
+            break;
+        }
+
+        // the server does not send anything on the socket, readable means closed
+        if (fds[1].revents != 0)
+        {
+            errno = EPIPE;
+            ret = -1;
+            break;
+        }
+
+        (void)read(ring->space_fd, &count, sizeof(count));
+    }
+
+    atomic_store_explicit(&header->producer_waiting, 0U, memory_order_relaxed);
+
+    return ret;
+}
@@ -0,0 +1,159 @@
+/*
+ * Acts as server for the aesd
+ *
+ * Shared memory ring for clients on the same host.  A client connects to the local
+ * socket and receives a memfd with the ring and two eventfds.  It copies records into the
+ * ring and only rings the doorbell while the server sleeps, the server stores them and
+ * advances the tail, so the tail passing a record confirms it is stored.
+ *
+ * The data area is mapped twice in a row, so records crossing its end are contiguous.
+ * Records are a 32 bit length and the payload, padded to SHM_RING_ALIGN.
+ * Author: Heiko Schmidt
+ */
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SHM_RING_MAGIC 0x41455344U
+#define SHM_RING_VERSION 1U
+#define SHM_RING_HEADER_SIZE 4096U
+#define SHM_RING_ALIGN 8U
+#define SHM_RING_MIN_SIZE 4096U
+#define SHM_RING_MAX_SIZE (1024U * 1024U * 1024U)
+#define SHM_RING_DEFAULT_SIZE (1024U * 1024U)
+
+#define SHM_RING_RECORD_SIZE(len) (((uint64_t)(len) + 4U + SHM_RING_ALIGN - 1U) & ~(uint64_t)(SHM_RING_ALIGN - 1U))
+
+/**
+ * Start of the memfd, the fields written by each side share a cache line
+ */
+struct shm_ring_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+
+    // written by the client
+    alignas(64) atomic_uint_fast64_t head;
+    atomic_uint producer_waiting;
+
+    // written by the server
+    alignas(64) atomic_uint_fast64_t tail;
+    atomic_uint consumer_waiting;
+};
+
+/**
+ * Mapping of a ring in one process
+ */
+struct shm_ring
+{
+    struct shm_ring_header *header;
+    char *data;
+    uint64_t size;
+    int mem_fd;
+    // written by the client while the server waits for records
+    int doorbell_fd;
+    // written by the server while the client waits for space
+    int space_fd;
+};
+
+/**
+ * Creates a ring with @param size bytes of data, a power of two from SHM_RING_MIN_SIZE.
+ * The memory is sealed against resizing.
+ * @return 0 on success, -1 with errno set otherwise
+ */
+extern int shm_ring_create(struct shm_ring *ring, uint64_t size);
+
+/**
+ * Sends the descriptors of @param ring over the UNIX socket @param sock
+ */
+extern int shm_ring_send(int sock, const struct shm_ring *ring);
+
+/**
+ * Receives and maps the ring sent over @param sock
+ */
+extern int shm_ring_receive(int sock, struct shm_ring *ring);
+
+/**
+ * Maps the ring of @param size bytes in @param mem_fd, which takes over the descriptors,
+ * closing them on errors as well.  Fails with EPROTO unless the memory is sealed against
+ * resizing.
+ */
+extern int shm_ring_attach(struct shm_ring *ring, int mem_fd, int doorbell_fd, int space_fd, uint64_t size);
+
+extern void shm_ring_destroy(struct shm_ring *ring);
+
+/**
+ * Wakes the other side with @param fd
+ */
+extern void shm_ring_notify(int fd);
+
+/**
+ * Copies a record into the ring and rings the doorbell if the server sleeps
+ * @return true on success, false if the record does not fit at the moment
+ */
+static inline bool shm_ring_push(struct shm_ring *ring, const void *data, uint32_t len)
+{
+    struct shm_ring_header *header = ring->header;
+    const uint64_t head = atomic_load_explicit(&header->head, memory_order_relaxed);
+    const uint64_t tail = atomic_load_explicit(&header->tail, memory_order_acquire);
+    const uint64_t need = SHM_RING_RECORD_SIZE(len);
+
+    if (need > ring->size - (head - tail))
+        return false;
+
+    char *pos = &ring->data[head & (ring->size - 1U)];
+    memcpy(pos, &len, sizeof(len));
+    memcpy(pos + 4, data, len);
+
+    // pairs with the server announcing it sleeps and checking head once more
+    atomic_store_explicit(&header->head, head + need, memory_order_seq_cst);
+    if (atomic_load_explicit(&header->consumer_waiting, memory_order_seq_cst))
+        shm_ring_notify(ring->doorbell_fd);
+
+    return true;
+}
+
+/**
+ * Blocks until a record of @param len bytes fits into the ring, called by the client.
+ * Returns early if the server closes the local socket @param sock.
+ * @return 0 on success, -1 with errno set otherwise
+ */
+extern int shm_ring_wait_space(struct shm_ring *ring, int sock, uint32_t len);
+
+/**
+ * Frees the ring up to @param tail once the records before are stored, called by the
+ * server
+ */
+static inline void shm_ring_release(struct shm_ring *ring, uint64_t tail)
+{
+    // pairs with the client announcing it waits for space and checking tail once more
+    atomic_store_explicit(&ring->header->tail, tail, memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->header->producer_waiting, memory_order_seq_cst))
+        shm_ring_notify(ring->space_fd);
+}
+
+/**
+ * Announces the server is about to sleep on the doorbell, unless records arrived behind
+ * @param tail meanwhile.  The server clears consumer_waiting once woken.
+ * @return true if the server may sleep
+ */
+static inline bool shm_ring_prepare_wait(struct shm_ring *ring, uint64_t tail)
+{
+    atomic_store_explicit(&ring->header->consumer_waiting, 1U, memory_order_seq_cst);
+
+    if (atomic_load_explicit(&ring->header->head, memory_order_seq_cst) != tail)
+    {
+        atomic_store_explicit(&ring->header->consumer_waiting, 0U, memory_order_relaxed);
+        return false;
+    }
+
+    return true;
+}
+
+#endif /* SHM_RING_H */
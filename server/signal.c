@@ -1,33 +1,80 @@
 /*
  * Acts as server for the aesd
+ *
+ * SIGINT, SIGTERM and SIGHUP are blocked in all threads and received through a signalfd,
+ * which the server loop polls next to its sockets.  No signal arriving between a check of
+ * the running state and the wait for the next event can get lost.
  * Author: Heiko Schmidt
  */
 #define _XOPEN_SOURCE 700
 
 #include <signal.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/signalfd.h>
 
-static bool appRun = true;
+#include "signal.h"
 
-static void signal_handler(const int signum)
-{
-    appRun = false;
-}
+static atomic_bool appRun = true;
+
+static int signal_fd = -1;
 
 bool is_app_running(void)
 {
-    return appRun;
+    return atomic_load(&appRun);
 }
 
 int register_sighandler(void)
 {
-    struct sigaction sa;
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+
+    // threads created later inherit the mask, so only the signalfd receives the signals
+    const int rc = pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    if(rc != 0) {
+        errno = rc;
+        return -1;
+    }
+
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    return signal_fd < 0 ? -1 : 0;
+}
+
+int get_signal_fd(void)
+{
+    return signal_fd;
+}
+
+int process_signals(void)
+{
+    struct signalfd_siginfo info;
+    int events = 0;
 
-    memset((void*)&sa, 0x0, sizeof(struct sigaction));
-    sa.sa_handler = &signal_handler;
+    while(read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        switch(info.ssi_signo) {
+            case SIGINT:
+            case SIGTERM:
+                atomic_store(&appRun, false);
+                events |= SIGNAL_EVENT_SHUTDOWN;
+                break;
+            case SIGHUP:
+                events |= SIGNAL_EVENT_RELOAD;
+                break;
+            default:
+                break;
+        }
+    }
 
-    sigaction(SIGINT, &sa, NULL);
-    sigaction(SIGTERM, &sa, NULL);
+    return events;
 }
@@ -4,5 +4,26 @@
  */
 #include <stdbool.h>
 
+// returned by process_signals()
+#define SIGNAL_EVENT_SHUTDOWN 0x1
+#define SIGNAL_EVENT_RELOAD 0x2
+
 extern bool is_app_running(void);
-extern int register_sighandler(void);
\ No newline at end of file
+
+/**
+ * Blocks the handled signals and creates the signalfd receiving them, must be called
+ * before any thread is created.
+ * @return 0 on success, -1 with errno set otherwise
+ */
+extern int register_sighandler(void);
+
+/**
+ * @return the signalfd to poll for readability
+ */
+extern int get_signal_fd(void);
+
+/**
+ * Consumes all pending signals, clearing the running state on SIGINT or SIGTERM.
+ * @return the SIGNAL_EVENT_* flags of the received signals
+ */
+extern int process_signals(void);
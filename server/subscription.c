@@ -0,0 +1,115 @@
+/*
+ * Acts as server for the aesd
+ *
+ * Each committed record is copied once into a reference counted buffer, the subscribers
+ * only queue pointers to it.  The last subscriber which sent it frees it.
+ * Author: Heiko Schmidt
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/eventfd.h>
+
+#include "subscription.h"
+
+static LIST_HEAD(subscriber_list, subscriber) subscribers = LIST_HEAD_INITIALIZER(subscribers);
+
+int subscriber_init(struct subscriber *sub)
+{
+    memset(sub, 0x0, sizeof(*sub));
+    atomic_init(&sub->lagged, false);
+    atomic_init(&sub->head, 0);
+    atomic_init(&sub->tail, 0);
+
+    sub->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    return sub->event_fd < 0 ? -1 : 0;
+}
+
+void subscriber_destroy(struct subscriber *sub)
+{
+    struct shared_record *rec;
+
+    while((rec = subscriber_pop(sub)) != NULL)
+        shared_record_put(rec);
+
+    if(sub->event_fd >= 0)
+        close(sub->event_fd);
+    sub->event_fd = -1;
+}
+
+void subscription_add(struct subscriber *sub)
+{
+    LIST_INSERT_HEAD(&subscribers, sub, entries);
+}
+
+void subscription_remove(struct subscriber *sub)
+{
+    LIST_REMOVE(sub, entries);
+}
+
+void subscription_publish(const char *data, size_t len, uint64_t seq)
+{
+    struct subscriber *sub;
+
+    if(LIST_EMPTY(&subscribers))
+        return;
+
+    struct shared_record *rec = (struct shared_record*)malloc(sizeof(struct shared_record) + len);
+    if(rec == NULL) {
+        // treated like a full queue, the subscribers cannot follow anymore
+        LIST_FOREACH(sub, &subscribers, entries) {
+            atomic_store(&sub->lagged, true);
+        }
+        syslog(LOG_ERR, "Unable to allocate record for subscribers");
+        return;
+    }
+
+    // the reference of the publisher keeps the record alive while it is queued
+    atomic_init(&rec->refs, 1);
+    rec->seq = seq;
+    rec->len = len;
+    memcpy(rec->data, data, len);
+
+    LIST_FOREACH(sub, &subscribers, entries) {
+        const size_t head = atomic_load_explicit(&sub->head, memory_order_relaxed);
+        const size_t tail = atomic_load_explicit(&sub->tail, memory_order_acquire);
+        const uint64_t one = 1;
+
+        if(atomic_load_explicit(&sub->lagged, memory_order_relaxed))
+            continue;
+
+        if(head - tail == SUBSCRIBER_QUEUE_LEN) {
+            atomic_store(&sub->lagged, true);
+        } else {
+            atomic_fetch_add_explicit(&rec->refs, 1, memory_order_relaxed);
+            sub->queue[head % SUBSCRIBER_QUEUE_LEN] = rec;
+            atomic_store_explicit(&sub->head, head + 1, memory_order_release);
+        }
+
+        (void)write(sub->event_fd, &one, sizeof(one));
+    }
+
+    shared_record_put(rec);
+}
+
+struct shared_record *subscriber_pop(struct subscriber *sub)
+{
+    const size_t tail = atomic_load_explicit(&sub->tail, memory_order_relaxed);
+
+    if(atomic_load_explicit(&sub->head, memory_order_acquire) == tail)
+        return NULL;
+
+    struct shared_record *rec = sub->queue[tail % SUBSCRIBER_QUEUE_LEN];
+    atomic_store_explicit(&sub->tail, tail + 1, memory_order_release);
+
+    return rec;
+}
+
+void shared_record_put(struct shared_record *rec)
+{
+    if(atomic_fetch_sub_explicit(&rec->refs, 1, memory_order_acq_rel) == 1)
+        free(rec);
+}
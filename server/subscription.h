@@ -0,0 +1,89 @@
+/*
+ * Acts as server for the aesd
+ * Author: Heiko Schmidt
+ */
+#ifndef SUBSCRIPTION_H
+#define SUBSCRIPTION_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/queue.h>
+
+// records queued per subscriber before it is considered too slow and dropped
+#define SUBSCRIBER_QUEUE_LEN 1024U
+
+/**
+ * A committed record, shared by all subscribers it was queued for
+ */
+struct shared_record
+{
+    atomic_uint refs;
+    // sequence number of the last record contained
+    uint64_t seq;
+    size_t len;
+    char data[];
+};
+
+/**
+ * Receiving end of a subscription, owned by the connection thread of the client
+ */
+struct subscriber
+{
+    /**
+     * Readable while records are queued
+     */
+    int event_fd;
+    /**
+     * Set when the queue overflowed, records were lost from then on
+     */
+    atomic_bool lagged;
+
+    // single producer single consumer ring, the producer holds the publish lock
+    struct shared_record *queue[SUBSCRIBER_QUEUE_LEN];
+    atomic_size_t head;
+    atomic_size_t tail;
+
+    LIST_ENTRY(subscriber) entries;
+};
+
+extern int subscriber_init(struct subscriber *sub);
+
+/**
+ * Releases the records still queued, the subscriber must have been removed
+ */
+extern void subscriber_destroy(struct subscriber *sub);
+
+/**
+ * Adds or removes @param sub from the receivers of subscription_publish().  Must be called
+ * with the same lock held which serializes the publishing.
+ */
+extern void subscription_add(struct subscriber *sub);
+extern void subscription_remove(struct subscriber *sub);
+
+/**
+ * Queues one copy of @param data, ending with record @param seq, for all subscribers.
+ * Called with the publish lock held in the order the records are committed.
+ */
+extern void subscription_publish(const char *data, size_t len, uint64_t seq);
+
+/**
+ * Takes the next record from the queue of @param sub, to be released with
+ * shared_record_put() after sending it.
+ * @return the record or NULL if the queue is empty
+ */
+extern struct shared_record *subscriber_pop(struct subscriber *sub);
+
+/**
+ * @return true if records are queued for @param sub
+ */
+static inline bool subscriber_has_pending(struct subscriber *sub)
+{
+    return atomic_load_explicit(&sub->head, memory_order_acquire) !=
+            atomic_load_explicit(&sub->tail, memory_order_relaxed);
+}
+
+extern void shared_record_put(struct shared_record *rec);
+
+#endif /* SUBSCRIPTION_H */
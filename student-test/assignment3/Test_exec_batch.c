@@ -0,0 +1,113 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../examples/systemcalls/exec-batch.h"
+
+#define OUTFILE "/tmp/exec-batch-test.txt"
+#define PARALLEL_COMMANDS 16
+
+static char *const echo_hello[] = { "/bin/echo", "hello", NULL };
+static char *const echo_file[] = { "/bin/echo", "to file", NULL };
+static char *const stderr_exit[] = { "/bin/sh", "-c", "echo error >&2; exit 3", NULL };
+static char *const killed[] = { "/bin/sh", "-c", "kill -TERM $$", NULL };
+static char *const missing[] = { "/nonexistent/command", NULL };
+// more than a pipe buffer, so the output has to be drained while the command runs
+static char *const large_output[] = { "/bin/sh", "-c", "head -c 200000 /dev/zero | tr '\\0' x", NULL };
+
+void test_exec_batch_captures_output_and_status()
+{
+    struct exec_cmd cmds[] = {
+        { .argv = echo_hello },
+        { .argv = stderr_exit },
+        { .argv = killed },
+        { .argv = large_output },
+    };
+    const size_t count = sizeof(cmds) / sizeof(cmds[0]);
+
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_batch(cmds, count, count), "a failing command must fail the batch");
+
+    TEST_ASSERT_EQUAL_INT(0, cmds[0].status);
+    TEST_ASSERT_EQUAL_STRING("hello\n", cmds[0].out);
+    TEST_ASSERT_EQUAL_size_t(6, cmds[0].out_len);
+    TEST_ASSERT_EQUAL_size_t(0, cmds[0].err_len);
+
+    TEST_ASSERT_EQUAL_INT(3, cmds[1].status);
+    TEST_ASSERT_EQUAL_size_t(0, cmds[1].out_len);
+    TEST_ASSERT_EQUAL_STRING("error\n", cmds[1].err);
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(128 + 15, cmds[2].status, "killed by SIGTERM");
+
+    TEST_ASSERT_EQUAL_INT(0, cmds[3].status);
+    TEST_ASSERT_EQUAL_size_t(200000, cmds[3].out_len);
+    TEST_ASSERT_EQUAL_size_t(200000, strspn(cmds[3].out, "x"));
+
+    for(size_t i = 0; i < count; i++)
+        exec_cmd_free_output(&cmds[i]);
+}
+
+void test_exec_batch_reports_missing_command()
+{
+    struct exec_cmd cmds[] = {
+        { .argv = missing },
+        { .argv = echo_hello },
+    };
+
+    TEST_ASSERT_FALSE(do_exec_batch(cmds, 2, 1));
+    TEST_ASSERT_EQUAL_INT(-1, cmds[0].status);
+    // the following command still runs
+    TEST_ASSERT_EQUAL_INT(0, cmds[1].status);
+    TEST_ASSERT_EQUAL_STRING("hello\n", cmds[1].out);
+
+    exec_cmd_free_output(&cmds[0]);
+    exec_cmd_free_output(&cmds[1]);
+}
+
+void test_exec_batch_redirects_to_file()
+{
+    struct exec_cmd cmd = { .argv = echo_file, .outfile = OUTFILE };
+    char buf[32];
+
+    remove(OUTFILE);
+    TEST_ASSERT_TRUE(do_exec_batch(&cmd, 1, 1));
+    TEST_ASSERT_EQUAL_INT(0, cmd.status);
+    TEST_ASSERT_EQUAL_size_t(0, cmd.out_len);
+
+    FILE *f = fopen(OUTFILE, "r");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_NOT_NULL(fgets(buf, sizeof(buf), f));
+    fclose(f);
+    remove(OUTFILE);
+    TEST_ASSERT_EQUAL_STRING("to file\n", buf);
+
+    exec_cmd_free_output(&cmd);
+}
+
+void test_exec_batch_more_commands_than_parallel()
+{
+    struct exec_cmd cmds[PARALLEL_COMMANDS];
+    char scripts[PARALLEL_COMMANDS][64];
+    char *argv[PARALLEL_COMMANDS][4];
+    char expected[16];
+
+    // odd commands sleep a little, so commands finish out of order
+    for(size_t i = 0; i < PARALLEL_COMMANDS; i++) {
+        snprintf(scripts[i], sizeof(scripts[i]), "%secho %zu; exit %zu", i % 2 ? "sleep 0.05; " : "", i, i % 3);
+        argv[i][0] = "/bin/sh";
+        argv[i][1] = "-c";
+        argv[i][2] = scripts[i];
+        argv[i][3] = NULL;
+        memset(&cmds[i], 0, sizeof(cmds[i]));
+        cmds[i].argv = argv[i];
+    }
+
+    TEST_ASSERT_FALSE(do_exec_batch(cmds, PARALLEL_COMMANDS, 3));
+
+    for(size_t i = 0; i < PARALLEL_COMMANDS; i++) {
+        snprintf(expected, sizeof(expected), "%zu\n", i);
+        TEST_ASSERT_EQUAL_INT((int)(i % 3), cmds[i].status);
+        TEST_ASSERT_EQUAL_STRING(expected, cmds[i].out);
+        exec_cmd_free_output(&cmds[i]);
+    }
+}
@@ -0,0 +1,174 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include "../../examples/threading/threadpool.h"
+
+#define WORKERS 4
+#define DEQUE_CAPACITY 16
+#define TASKS 200
+#define DELAY_MS 100
+#define NSEC_PER_MSEC 1000000LL
+
+struct counted_task {
+    struct threadpool_task task;
+    struct threadpool_future future;
+    atomic_int *counter;
+    int index;
+    // order in which the task ran among all tasks sharing the counter
+    int ran_as;
+    struct timespec ran_at;
+};
+
+static bool count_task(void *arg)
+{
+    struct counted_task *t = (struct counted_task*)arg;
+
+    t->ran_as = atomic_fetch_add(t->counter, 1);
+    clock_gettime(CLOCK_MONOTONIC, &t->ran_at);
+
+    // odd tasks report failure through their future
+    return t->index % 2 == 0;
+}
+
+static bool sleep_task(void *arg)
+{
+    const struct timespec ts = { .tv_sec = 0, .tv_nsec = *(int*)arg * NSEC_PER_MSEC };
+
+    nanosleep(&ts, NULL);
+    return true;
+}
+
+static void init_counted(struct counted_task *t, atomic_int *counter, int index, bool with_future)
+{
+    memset(t, 0x0, sizeof(*t));
+    t->counter = counter;
+    t->index = index;
+    t->ran_as = -1;
+    t->task.fn = count_task;
+    t->task.arg = t;
+    if(with_future) {
+        threadpool_future_init(&t->future);
+        t->task.future = &t->future;
+    }
+}
+
+static long long elapsed_ms(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000LL + (to->tv_nsec - from->tv_nsec) / NSEC_PER_MSEC;
+}
+
+void test_threadpool_submit_and_wait()
+{
+    static struct counted_task tasks[TASKS];
+    atomic_int counter = 0;
+    struct threadpool *pool = threadpool_create(WORKERS, DEQUE_CAPACITY);
+
+    TEST_ASSERT_NOT_NULL(pool);
+
+    int oldest = 0;
+    for(int i = 0; i < TASKS; i++) {
+        init_counted(&tasks[i], &counter, i, true);
+        // all deques full, wait for the oldest outstanding task and try again
+        while(!threadpool_submit(pool, &tasks[i].task))
+            threadpool_future_wait(&tasks[oldest++].future);
+    }
+
+    for(int i = 0; i < TASKS; i++) {
+        TEST_ASSERT_EQUAL_INT_MESSAGE(i % 2 == 0, threadpool_future_wait(&tasks[i].future),
+                "the future must carry the result of its task");
+        TEST_ASSERT_TRUE_MESSAGE(tasks[i].ran_as >= 0, "every task must have run once its future completed");
+        threadpool_future_destroy(&tasks[i].future);
+    }
+    TEST_ASSERT_EQUAL_INT_MESSAGE(TASKS, atomic_load(&counter), "every task must run exactly once");
+
+    threadpool_destroy(pool);
+}
+
+void test_threadpool_delayed_tasks()
+{
+    struct counted_task delayed, immediate;
+    struct timespec submitted;
+    atomic_int counter = 0;
+    struct threadpool *pool = threadpool_create(1, DEQUE_CAPACITY);
+
+    TEST_ASSERT_NOT_NULL(pool);
+
+    init_counted(&delayed, &counter, 0, true);
+    init_counted(&immediate, &counter, 2, true);
+
+    clock_gettime(CLOCK_MONOTONIC, &submitted);
+    TEST_ASSERT_TRUE(threadpool_submit_after(pool, &delayed.task, DELAY_MS));
+    TEST_ASSERT_TRUE(threadpool_submit_after(pool, &immediate.task, 0));
+
+    TEST_ASSERT_TRUE(threadpool_future_wait(&delayed.future));
+    TEST_ASSERT_TRUE(threadpool_future_wait(&immediate.future));
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, immediate.ran_as, "a task without delay must not wait for a delayed one");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(1, delayed.ran_as, "a delayed task must run after the immediate one");
+    TEST_ASSERT_TRUE_MESSAGE(elapsed_ms(&submitted, &delayed.ran_at) >= DELAY_MS,
+            "a delayed task must not run before its delay passed");
+
+    threadpool_future_destroy(&delayed.future);
+    threadpool_future_destroy(&immediate.future);
+    threadpool_destroy(pool);
+}
+
+void test_threadpool_destroy_runs_pending_work()
+{
+    static struct counted_task tasks[DEQUE_CAPACITY];
+    struct counted_task delayed;
+    struct threadpool_task blocker;
+    int block_ms = DELAY_MS / 2;
+    atomic_int counter = 0;
+    struct threadpool *pool = threadpool_create(1, DEQUE_CAPACITY + 1);
+
+    TEST_ASSERT_NOT_NULL(pool);
+
+    // keeps the only worker busy, so everything below is still queued on destroy
+    memset(&blocker, 0x0, sizeof(blocker));
+    blocker.fn = sleep_task;
+    blocker.arg = &block_ms;
+    TEST_ASSERT_TRUE(threadpool_submit(pool, &blocker));
+
+    for(int i = 0; i < DEQUE_CAPACITY; i++) {
+        init_counted(&tasks[i], &counter, i, false);
+        TEST_ASSERT_TRUE(threadpool_submit(pool, &tasks[i].task));
+    }
+    init_counted(&delayed, &counter, DEQUE_CAPACITY, false);
+    TEST_ASSERT_TRUE(threadpool_submit_after(pool, &delayed.task, DELAY_MS));
+
+    threadpool_destroy(pool);
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(DEQUE_CAPACITY + 1, atomic_load(&counter),
+            "destroy must run queued and delayed tasks before stopping");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(DEQUE_CAPACITY, delayed.ran_as, "the delayed task must run last");
+}
+
+void test_threadpool_mutex_job()
+{
+    struct threadpool_mutex_job job;
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    struct threadpool *pool = threadpool_create(2, DEQUE_CAPACITY);
+
+    TEST_ASSERT_NOT_NULL(pool);
+
+    // the future is initialized by the pool, garbage must not matter
+    memset(&job, 0xa5, sizeof(job));
+
+    for(int round = 0; round < 2; round++) {
+        TEST_ASSERT_TRUE(threadpool_start_obtaining_mutex(pool, &job, &mutex, 10, 10));
+        TEST_ASSERT_TRUE_MESSAGE(threadpool_future_wait(&job.future), "the job must obtain and release the mutex");
+        TEST_ASSERT_TRUE(job.data.thread_complete_success);
+        threadpool_future_destroy(&job.future);
+
+        TEST_ASSERT_EQUAL_INT_MESSAGE(0, pthread_mutex_trylock(&mutex), "the job must release the mutex");
+        pthread_mutex_unlock(&mutex);
+    }
+
+    TEST_ASSERT_FALSE(threadpool_start_obtaining_mutex(pool, &job, &mutex, -1, 0));
+    threadpool_future_destroy(&job.future);
+
+    threadpool_destroy(pool);
+}
@@ -0,0 +1,156 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+// largest batch tested, well above the buffer capacity
+#define MAX_BATCH (2 * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 3)
+#define MAX_PREFILL (2 * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 3)
+#define MAX_EVICTED (MAX_PREFILL + MAX_BATCH)
+
+/**
+ * Entries dropped through the evict hook, in the order the hook saw them
+ */
+struct evict_log
+{
+    struct aesd_buffer_entry entry[MAX_EVICTED];
+    size_t count;
+};
+
+// every entry points to its own byte in here, so entries can be told apart by pointer
+static const char text[MAX_PREFILL + MAX_BATCH];
+
+static void log_evict(const struct aesd_buffer_entry *entry, void *ctx)
+{
+    struct evict_log *log = (struct evict_log *)ctx;
+
+    TEST_ASSERT_LESS_THAN_MESSAGE(MAX_EVICTED, log->count, "evict log overflow");
+    log->entry[log->count++] = *entry;
+}
+
+static void make_entry(struct aesd_buffer_entry *entry, size_t index)
+{
+    entry->buffptr = &text[index];
+    entry->size = index % 7 + 1;
+}
+
+static void init_with_log(struct aesd_circular_buffer *buffer, struct evict_log *log)
+{
+    aesd_circular_buffer_init(buffer);
+    memset(log, 0, sizeof(*log));
+    aesd_circular_buffer_set_evict_hook(buffer, log_evict, log);
+}
+
+static void assert_same_buffer(const struct aesd_circular_buffer *expected, const struct aesd_circular_buffer *actual,
+        const char *message)
+{
+    TEST_ASSERT_EQUAL_UINT8_MESSAGE(expected->in_offs, actual->in_offs, message);
+    TEST_ASSERT_EQUAL_UINT8_MESSAGE(expected->out_offs, actual->out_offs, message);
+    TEST_ASSERT_EQUAL_MESSAGE(expected->full, actual->full, message);
+    TEST_ASSERT_EQUAL_MESSAGE(expected->init_state, actual->init_state, message);
+    for(size_t i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(expected->entry[i].buffptr, actual->entry[i].buffptr, message);
+        TEST_ASSERT_EQUAL_size_t_MESSAGE(expected->entry[i].size, actual->entry[i].size, message);
+    }
+}
+
+static void assert_same_entries(const struct aesd_buffer_entry *expected, const struct aesd_buffer_entry *actual,
+        size_t count, const char *message)
+{
+    for(size_t i = 0; i < count; i++) {
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(expected[i].buffptr, actual[i].buffptr, message);
+        TEST_ASSERT_EQUAL_size_t_MESSAGE(expected[i].size, actual[i].size, message);
+    }
+}
+
+/**
+ * Prefills two buffers with @param prefill single adds, then adds @param count entries one
+ * by one to the first and as a batch to the second.  Both must end up identical, with the
+ * same entries dropped in the same order through the evict hook and the evicted array.
+ */
+static void check_batch_matches_single_adds(size_t prefill, size_t count)
+{
+    struct aesd_circular_buffer single, batch;
+    struct evict_log single_log, batch_log;
+    struct aesd_buffer_entry add[MAX_BATCH];
+    struct aesd_buffer_entry evicted[MAX_BATCH];
+    char message[64];
+    size_t i;
+
+    snprintf(message, sizeof(message), "prefill %zu, batch of %zu", prefill, count);
+
+    init_with_log(&single, &single_log);
+    init_with_log(&batch, &batch_log);
+
+    for(i = 0; i < prefill; i++) {
+        struct aesd_buffer_entry entry;
+
+        make_entry(&entry, i);
+        aesd_circular_buffer_add_entry(&single, &entry);
+        aesd_circular_buffer_add_entry(&batch, &entry);
+    }
+
+    // only the entries dropped by the batch are compared
+    single_log.count = 0;
+    batch_log.count = 0;
+
+    for(i = 0; i < count; i++)
+        make_entry(&add[i], prefill + i);
+
+    for(i = 0; i < count; i++)
+        aesd_circular_buffer_add_entry(&single, &add[i]);
+
+    const size_t evicted_cnt = aesd_circular_buffer_add_entries(&batch, add, count, evicted);
+
+    assert_same_buffer(&single, &batch, message);
+
+    TEST_ASSERT_EQUAL_size_t_MESSAGE(single_log.count, evicted_cnt, message);
+    TEST_ASSERT_EQUAL_size_t_MESSAGE(single_log.count, batch_log.count, message);
+    assert_same_entries(single_log.entry, evicted, evicted_cnt, message);
+    assert_same_entries(single_log.entry, batch_log.entry, batch_log.count, message);
+}
+
+void test_add_entries_matches_add_entry()
+{
+    // covers empty, partially filled, full and wrapped buffers, batches fitting into the free
+    // entries, batches wrapping the ring and batches larger than the whole buffer
+    for(size_t prefill = 0; prefill <= MAX_PREFILL; prefill++) {
+        for(size_t count = 1; count <= MAX_BATCH; count++)
+            check_batch_matches_single_adds(prefill, count);
+    }
+}
+
+void test_add_entries_full_flag()
+{
+    struct aesd_circular_buffer buffer;
+    struct evict_log log;
+    struct aesd_buffer_entry add[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 1];
+
+    for(size_t i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 1; i++)
+        make_entry(&add[i], i);
+
+    // filling the buffer exactly does not overwrite anything yet
+    init_with_log(&buffer, &log);
+    TEST_ASSERT_EQUAL_size_t(0, aesd_circular_buffer_add_entries(&buffer, add, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, NULL));
+    TEST_ASSERT_FALSE(buffer.full);
+    TEST_ASSERT_EQUAL_UINT8(buffer.out_offs, buffer.in_offs);
+    TEST_ASSERT_EQUAL_size_t(0, log.count);
+
+    // one more entry drops the oldest one
+    TEST_ASSERT_EQUAL_size_t(1, aesd_circular_buffer_add_entries(&buffer, &add[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED], 1, NULL));
+    TEST_ASSERT_TRUE(buffer.full);
+    TEST_ASSERT_EQUAL_size_t(1, log.count);
+    TEST_ASSERT_EQUAL_PTR(add[0].buffptr, log.entry[0].buffptr);
+}
+
+void test_add_entries_empty_batch()
+{
+    struct aesd_circular_buffer buffer;
+    struct evict_log log;
+
+    init_with_log(&buffer, &log);
+    TEST_ASSERT_EQUAL_size_t(0, aesd_circular_buffer_add_entries(&buffer, NULL, 0, NULL));
+    TEST_ASSERT_TRUE(buffer.init_state);
+    TEST_ASSERT_EQUAL_size_t(0, log.count);
+}